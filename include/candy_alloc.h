@@ -0,0 +1,10 @@
+#pragma once
+
+#include "core.h"
+
+void candy_init_allocator(candy_context *ctx);
+void candy_destroy_allocator(candy_context *ctx);
+candy_allocation candy_alloc_memory(candy_context *ctx, const VkMemoryRequirements &reqs,
+                                    VkMemoryPropertyFlags props, bool optimal_tiling);
+void candy_free_memory(candy_context *ctx, candy_allocation *allocation);
+void candy_alloc_dump_stats(candy_context *ctx);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "core.h"
+
+void candy_init_arena(candy_context *ctx);
+void candy_destroy_arena(candy_context *ctx);
+void *candy_arena_resize_state(candy_context *ctx, size_t size);
+void *candy_arena_reserve(candy_context *ctx, size_t capacity);
+bool candy_arena_commit(candy_context *ctx, void *region, size_t size);
+size_t candy_arena_committed(candy_context *ctx);
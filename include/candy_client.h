@@ -0,0 +1,33 @@
+#pragma once
+
+#include "candy_net.h"
+#include "candy_predict.h"
+#include "candy_snapshot.h"
+
+#include <cstdint>
+
+// Kept free of core.h like candy_predict.h: the game module drives it from its
+// fixed step, one command per tick
+
+// One connection to a dedicated server. Every tick sends the newest commands and
+// the newest snapshot tick decoded; every packet back carries a snapshot and the
+// ack the local player's prediction is reconciled with.
+struct candy_client {
+    bool active;
+    candy_net_endpoint endpoint;
+    candy_net_connection *server;
+    candy_snapshot_history *history; // decoded snapshots, baselines for the next
+
+    int32_t player;                  // -1 until the server says which one we are
+    const candy_snapshot *snapshot;  // newest decoded, nullptr before the first
+    uint64_t snapshot_arrival_ns;    // when its packet reached the socket
+    uint32_t snapshots_received;
+    uint32_t snapshots_failed;
+
+    candy_predict predict;
+};
+
+bool candy_client_connect(candy_client *client, candy_net_address address,
+                          float tick_rate, uint64_t now_ns);
+void candy_client_close(candy_client *client);
+void candy_client_tick(candy_client *client, uint8_t buttons, float dt, uint64_t now_ns);
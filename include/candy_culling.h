@@ -0,0 +1,11 @@
+#pragma once
+
+#include "core.h"
+
+void candy_init_gpu_culling(candy_context *ctx);
+void candy_destroy_gpu_culling(candy_context *ctx);
+void candy_record_gpu_culling(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                              uint32_t frame);
+void candy_record_indirect_draws(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                 uint32_t frame, uint32_t first_object,
+                                 uint32_t object_count);
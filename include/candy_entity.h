@@ -0,0 +1,91 @@
+#pragma once
+
+#include "candy_reflect.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Kept free of core.h like candy_reflect.h: the store is plain data inside a game
+// state, so it lives in the arena and is migrated on reload. Its columns live in
+// memory of their own, given at init, which stays put across reloads.
+
+constexpr uint32_t ENTITY_CAPACITY = 65536;  // MAX_INSTANCES, the most a store can hold
+constexpr uint32_t ENTITY_SIMD_WIDTH = 16;   // floats per 64 byte cache line
+constexpr uint32_t ENTITY_INVALID = UINT32_MAX;
+
+static_assert(ENTITY_CAPACITY % ENTITY_SIMD_WIDTH == 0, "columns must stay padded");
+
+// Generation 0 is never handed out, so a zeroed handle is always stale
+struct candy_entity {
+    uint32_t slot;
+    uint32_t generation;
+};
+
+// Structure of arrays, dense in [0, count): removal moves the last entity into the
+// hole, so loops run over contiguous columns. Columns are cache line aligned and the
+// capacity is a multiple of ENTITY_SIMD_WIDTH, so kernels may round count up to a
+// full vector; lanes past count hold stale values and are never read back.
+// Handles go through the slot table and survive any number of moves. The store
+// itself is only this header, the columns point into the memory it was given.
+struct candy_entity_store {
+    uint32_t count;
+    uint32_t free_slot; // head of the free slot list, ENTITY_INVALID when empty
+    uint32_t slot_count; // slots ever handed out
+    uint32_t capacity;   // rows per column, a multiple of ENTITY_SIMD_WIDTH
+
+    float *px;
+    float *py;
+    float *pz;
+    float *vx;
+    float *vy;
+    float *vz;
+    // Position at the previous tick, to interpolate with the render alpha
+    float *prev_x;
+    float *prev_y;
+    float *prev_z;
+
+    uint32_t *dense_slot; // dense index -> slot
+    // slot -> dense index while alive, next free slot while free
+    uint32_t *slot_dense;
+    uint32_t *slot_generation;
+};
+
+// Exported by the engine, for game_state_layout tables holding handles or a store
+extern const candy_state_layout candy_entity_layout;
+extern const candy_state_layout candy_entity_store_layout;
+
+uint32_t candy_entity_capacity(uint32_t capacity);
+size_t candy_entity_store_bytes(uint32_t capacity);
+void candy_entity_store_init(candy_entity_store *store, uint32_t capacity, void *memory);
+candy_entity candy_entity_create(candy_entity_store *store);
+bool candy_entity_destroy(candy_entity_store *store, candy_entity entity,
+                          uint32_t *moved_from, uint32_t *moved_to);
+uint32_t candy_entity_index(const candy_entity_store *store, candy_entity entity);
+
+// Instruction sets the integration kernel is built for, picked at runtime
+enum candy_simd_level {
+    CANDY_SIMD_SCALAR,
+    CANDY_SIMD_SSE,
+    CANDY_SIMD_AVX2,
+    CANDY_SIMD_LEVEL_COUNT,
+};
+
+struct candy_integrate_params {
+    float dt;
+    float damping; // velocity lost per second, 0 keeps it
+    // Entities are clamped into the box and lose their velocity on the clamped axis
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+candy_simd_level candy_simd_detect();
+const char *candy_simd_level_name(candy_simd_level level);
+void candy_entity_integrate(candy_entity_store *store,
+                            const candy_integrate_params *params);
+void candy_entity_integrate_level(candy_entity_store *store,
+                                  const candy_integrate_params *params,
+                                  candy_simd_level level);
+float candy_integrate_keep(const candy_integrate_params *params);
+void candy_entity_integrate_one(float p[3], float v[3],
+                                const candy_integrate_params *params, float keep);
+void candy_entity_bench_integrate(uint32_t count);
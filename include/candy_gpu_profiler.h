@@ -0,0 +1,16 @@
+#pragma once
+
+#include "core.h"
+
+void candy_init_gpu_profiler(candy_context *ctx);
+void candy_destroy_gpu_profiler(candy_context *ctx);
+void candy_gpu_profiler_collect(candy_context *ctx, uint32_t frame);
+void candy_gpu_profiler_begin_frame(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                    uint32_t frame);
+void candy_gpu_profiler_end_frame(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                  uint32_t frame);
+void candy_gpu_scope_begin(candy_context *ctx, VkCommandBuffer cmd_buffer, uint32_t frame,
+                           candy_gpu_scope scope);
+void candy_gpu_scope_end(candy_context *ctx, VkCommandBuffer cmd_buffer, uint32_t frame,
+                         candy_gpu_scope scope);
+const char *candy_gpu_scope_name(candy_gpu_scope scope);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "candy_entity.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Kept free of core.h like candy_entity.h, so a server can use it too. Works on the
+// xy plane the game is played on; z is ignored.
+
+constexpr uint32_t GRID_BUCKET_COUNT = 8192; // power of two
+
+static_assert((GRID_BUCKET_COUNT & (GRID_BUCKET_COUNT - 1)) == 0,
+              "buckets are picked with a mask");
+
+// Uniform grid over an unbounded plane: cells are hashed into a fixed number of
+// buckets, and entities are counting sorted by bucket into one flat array, so a
+// rebuild allocates nothing. Entries hold dense indices into the store the grid was
+// built from and are only valid until the store changes. The per entity arrays point
+// into memory given at init, sized for a store of the same capacity.
+struct candy_grid {
+    float cell_size;
+    float inv_cell_size;
+    uint32_t count;
+    uint32_t capacity;
+
+    // Entries of bucket b are entries[bucket_start[b], bucket_start[b + 1])
+    uint32_t bucket_start[GRID_BUCKET_COUNT + 1];
+    uint32_t *entries;
+    uint32_t *entity_bucket; // scratch for the rebuild
+};
+
+// Nearest entity a ray hits, index is ENTITY_INVALID when there is none
+struct candy_grid_hit {
+    uint32_t index;
+    float t; // distance along the ray
+};
+
+// Exported by the engine, for game_state_layout tables holding a grid. Only where its
+// memory is goes along, the entries are rebuilt.
+extern const candy_state_layout candy_grid_layout;
+
+size_t candy_grid_bytes(uint32_t capacity);
+void candy_grid_init(candy_grid *grid, uint32_t capacity, void *memory);
+void candy_grid_build(candy_grid *grid, const candy_entity_store *store, float cell_size);
+uint32_t candy_grid_query_radius(const candy_grid *grid, const candy_entity_store *store,
+                                 float x, float y, float radius, uint32_t *out,
+                                 uint32_t max_out);
+candy_grid_hit candy_grid_raycast(const candy_grid *grid, const candy_entity_store *store,
+                                  float x, float y, float dir_x, float dir_y,
+                                  float max_t, float entity_radius, uint32_t ignore);
@@ -8,6 +8,8 @@ void candy_create_imgui_render_pass(candy_context *ctx);
 void candy_init_imgui(candy_context *ctx);
 void candy_imgui_new_frame(candy_context *ctx);
 void candy_imgui_render_menu(candy_context *ctx);
+void candy_imgui_prepare(candy_context *ctx);
+void candy_imgui_record(candy_context *ctx, VkCommandBuffer cmd_buffer);
 void candy_imgui_render(candy_context *ctx, VkCommandBuffer cmd_buffer,
-                        uint32_t image_index);
+                        uint32_t image_index, VkCommandBuffer secondary);
 void candy_cleanup_imgui(candy_context *ctx);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "candy_snapshot.h"
+
+#include <cstdint>
+
+// Kept free of core.h like candy_snapshot.h. Times are steady clock nanoseconds.
+
+constexpr uint32_t INTERP_HISTORY = 16;                   // snapshots kept, a ring
+constexpr int64_t INTERP_JITTER_SCALE = 3;                 // jitters of delay kept
+constexpr int64_t INTERP_MAX_EXTRAPOLATION_NS = 100000000; // past the newest snapshot
+constexpr int64_t INTERP_SMOOTHING = 16; // estimates move 1/16 of the way per snapshot
+
+static_assert((INTERP_HISTORY & (INTERP_HISTORY - 1)) == 0, "history is a ring");
+
+// The last snapshots received, drawn some delay behind the newest, so there is
+// nearly always one on each side of the time drawn. Positions are kept by snapshot,
+// then by network id: sampling streams the same ids of two rows.
+//
+// The delay is the snapshot interval plus INTERP_JITTER_SCALE times the measured
+// jitter, the smoothed change in transit time between snapshots. Past the newest
+// snapshot entities carry on at their last velocity for up to
+// INTERP_MAX_EXTRAPOLATION_NS, then stop.
+//
+// Owned by the render thread, never copied. Rows hold capacity ids, grown to the
+// largest snapshot pushed, so a match networking 16 players keeps 16 per row and one
+// networking thousands keeps thousands.
+struct candy_interp {
+    uint64_t tick_ns; // server tick length, to turn ticks into time
+    uint32_t count;   // snapshots held
+    uint32_t newest;  // slot of the newest
+    uint32_t tick[INTERP_HISTORY];
+    uint32_t entity_count[INTERP_HISTORY];
+
+    // Server time to local time, learnt from arrivals
+    int64_t offset_ns;       // local arrival minus server time, smoothed
+    int64_t jitter_ns;       // smoothed change in transit time
+    int64_t interval_ns;     // smoothed time between snapshots
+    int64_t delay_ns;        // behind the newest snapshot, moving toward the target
+    uint64_t last_arrival_ns;
+
+    // INTERP_HISTORY rows of capacity ids each, in one allocation
+    uint32_t capacity;
+    float *x;
+    float *y;
+    float *z;
+    uint8_t *present;
+};
+
+// Where to sample: between two slots, t past `from` by their distance. Beyond 1
+// while extrapolating.
+struct candy_interp_time {
+    bool valid; // false before the first snapshot
+    uint32_t from;
+    uint32_t to;
+    float t;
+    int64_t extrapolated_ns; // 0 while between snapshots
+};
+
+void candy_interp_init(candy_interp *interp, uint64_t tick_ns);
+void candy_interp_destroy(candy_interp *interp);
+void candy_interp_push(candy_interp *interp, const candy_snapshot *snapshot,
+                       uint64_t arrival_ns);
+candy_interp_time candy_interp_locate(const candy_interp *interp, uint64_t now_ns);
+void candy_interp_sample(const candy_interp *interp, const candy_interp_time *time,
+                         uint32_t count, float *x, float *y, float *z);
+bool candy_interp_present(const candy_interp *interp, const candy_interp_time *time,
+                          uint32_t id);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "core.h"
+
+// candy_job_spawn, candy_job_wait and candy_parallel_for are declared in core.h for
+// the game modules
+void candy_init_jobs(candy_context *ctx);
+void candy_destroy_jobs(candy_context *ctx);
+void candy_jobs_drain(candy_context *ctx);
+bool candy_test_jobs_overflow(candy_context *ctx);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "candy_entity.h"
+#include "candy_grid.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// The rules of a match, shared by the game module and the dedicated server. Kept free
+// of core.h like candy_entity.h: players move by button bits, wherever those come from.
+
+constexpr uint32_t MATCH_MAX_PLAYERS = 16;
+constexpr float MATCH_PLAYER_ACCELERATION = 8.0f; // units per second squared
+constexpr float MATCH_PLAYER_DAMPING = 4.0f;      // top speed is acceleration / damping
+constexpr float MATCH_PLAYER_RADIUS = 0.05f;
+constexpr float MATCH_FIRE_RANGE = 2.0f;
+constexpr float MATCH_FIRE_COOLDOWN = 0.25f; // seconds
+constexpr float MATCH_FIRE_KNOCKBACK = 2.0f; // units per second
+constexpr float MATCH_GRID_CELL_SIZE = 0.1f;
+constexpr uint32_t MATCH_INPUT_COMMANDS = 8; // newest commands in every input packet
+constexpr uint32_t MATCH_INPUT_HEADER_SIZE = 9; // bytes on the wire before the commands
+constexpr uint32_t MATCH_INPUT_MAX_SIZE = MATCH_INPUT_HEADER_SIZE + MATCH_INPUT_COMMANDS;
+constexpr uint32_t MATCH_ACK_SIZE = 29;
+constexpr uint32_t MATCH_NO_TICK = UINT32_MAX;
+
+enum candy_match_button : uint8_t {
+    MATCH_BUTTON_UP = 1 << 0,
+    MATCH_BUTTON_DOWN = 1 << 1,
+    MATCH_BUTTON_LEFT = 1 << 2,
+    MATCH_BUTTON_RIGHT = 1 << 3,
+    MATCH_BUTTON_FIRE = 1 << 4,
+};
+
+struct candy_match {
+    candy_entity_store entities;
+    candy_entity players[MATCH_MAX_PLAYERS];
+
+    // Per entity game data, by dense index like the store's columns, in the same
+    // memory. Whoever destroys an entity moves kill_count along, as
+    // candy_entity_destroy reports.
+    uint32_t *kill_count;
+    float fire_cooldown[MATCH_MAX_PLAYERS];
+    uint32_t tick;
+
+    // Rebuilt at the end of every tick, only its memory is kept in the layout
+    candy_grid grid;
+};
+
+// One player's exact state, what prediction replays from
+struct candy_match_motion {
+    float p[3];
+    float v[3];
+};
+
+// What a client sends in every packet: the newest snapshot tick it decoded for the
+// server to delta against, MATCH_NO_TICK before the first, and its newest commands.
+// A command is one tick of buttons, stamped with the client's own command tick;
+// each is sent MATCH_INPUT_COMMANDS times, so a lost packet loses none.
+struct candy_match_input {
+    uint32_t acked_tick;
+    uint32_t first_tick; // command tick of buttons[0]
+    uint32_t count;
+    uint8_t buttons[MATCH_INPUT_COMMANDS];
+};
+
+// What the server sends ahead of every snapshot: which player the client is, the
+// newest of its commands applied, MATCH_NO_TICK before the first, and that player's
+// state right after it, unquantized
+struct candy_match_ack {
+    uint8_t player;
+    uint32_t input_tick;
+    candy_match_motion motion;
+};
+
+// Exported by the engine, for game_state_layout tables holding a match
+extern const candy_state_layout candy_match_layout;
+
+size_t candy_match_bytes(uint32_t capacity);
+void candy_match_init(candy_match *match, uint32_t capacity, void *memory);
+void candy_match_tick(candy_match *match, const uint8_t *buttons, float dt);
+candy_integrate_params candy_match_integrate_params(float dt);
+void candy_match_push(float *vx, float *vy, uint8_t buttons, float dt);
+void candy_match_move(candy_match_motion *motion, uint8_t buttons,
+                      const candy_integrate_params *params, float keep);
+bool candy_match_get_motion(const candy_match *match, uint32_t player,
+                            candy_match_motion *out);
+
+uint32_t candy_match_write_input(const candy_match_input *input,
+                                 uint8_t out[MATCH_INPUT_MAX_SIZE]);
+bool candy_match_read_input(const uint8_t *data, uint32_t size, candy_match_input *out);
+void candy_match_write_ack(const candy_match_ack *ack, uint8_t out[MATCH_ACK_SIZE]);
+bool candy_match_read_ack(const uint8_t *data, uint32_t size, candy_match_ack *out);
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+
+// Kept free of core.h like candy_entity.h, so a server can use it too. Times are
+// passed in as steady clock nanoseconds.
+
+constexpr uint32_t NET_PROTOCOL_ID = 0x45505346;   // "EPSF"
+constexpr uint32_t NET_MAX_PACKET = 1200;          // payload bytes, stays under the MTU
+constexpr uint32_t NET_SEQUENCE_WINDOW = 256;      // packets remembered each way
+constexpr uint32_t NET_RELIABLE_WINDOW = 64;       // reliable messages in flight
+constexpr uint32_t NET_MAX_MESSAGE = 256;          // bytes per reliable message
+constexpr uint32_t NET_PACKET_MESSAGES = 16;       // reliable messages per packet
+constexpr uint32_t NET_DELAYED_PACKETS = 1024;     // held back by the conditioner
+constexpr uint32_t NET_UDP_OVERHEAD = 28;          // IPv4 and UDP headers, for stats
+constexpr uint64_t NET_TIMEOUT_NS = 5000000000ull; // silence before a connection drops
+
+static_assert(NET_SEQUENCE_WINDOW % 32 == 0 && 65536 % NET_SEQUENCE_WINDOW == 0,
+              "sequence slots must survive wrap around");
+static_assert(65536 % NET_RELIABLE_WINDOW == 0, "message slots must survive wrap around");
+
+// IPv4, host byte order
+struct candy_net_address {
+    uint32_t ip;
+    uint16_t port;
+};
+
+// Applied to every packet an endpoint sends, to test on loopback
+struct candy_net_conditions {
+    float latency_ms;
+    float jitter_ms; // latency varies by up to this much either way, reordering packets
+    float loss;      // fraction of packets dropped
+};
+
+struct candy_net_sent_packet {
+    uint64_t send_ns;
+    uint32_t sequence; // UINT32_MAX while the slot is unused
+    uint32_t size;
+    bool acked;
+    uint32_t message_count;
+    uint16_t message_ids[NET_PACKET_MESSAGES];
+};
+
+struct candy_net_message {
+    uint64_t last_send_ns; // 0 until first sent
+    uint16_t id;
+    uint16_t size;
+    bool used;
+    uint8_t data[NET_MAX_MESSAGE];
+};
+
+// Both directions of one peer. Every packet carries the newest unreliable snapshot,
+// any reliable messages due for (re)sending and acks for the last 33 packets received.
+struct candy_net_connection {
+    candy_net_address address;
+    bool connected;
+    uint64_t last_receive_ns;
+
+    // Packets, acked through (ack, ack_bits) in every packet coming back
+    uint16_t local_sequence;
+    uint16_t remote_sequence; // newest received
+    uint64_t remote_receive_ns; // when it came, for the ack delay
+    bool received_any;
+    uint32_t received[NET_SEQUENCE_WINDOW]; // sequence per slot, UINT32_MAX if none
+    candy_net_sent_packet sent[NET_SEQUENCE_WINDOW];
+
+    // Reliable ordered channel: resent until acked, delivered in id order
+    uint16_t send_message_id;   // next id to assign
+    uint16_t oldest_unacked_id; // send window is [oldest_unacked_id, send_message_id)
+    uint16_t receive_message_id; // next id to deliver
+    candy_net_message send_queue[NET_RELIABLE_WINDOW];
+    candy_net_message receive_queue[NET_RELIABLE_WINDOW];
+
+    // Unreliable channel: only the newest snapshot matters, each way
+    uint32_t send_snapshot_size;
+    uint8_t send_snapshot[NET_MAX_PACKET];
+    uint32_t receive_snapshot_size;
+    uint16_t receive_snapshot_sequence;
+    uint64_t receive_snapshot_ns; // when it reached the socket
+    bool receive_snapshot_fresh;
+    uint8_t receive_snapshot[NET_MAX_PACKET];
+
+    // Estimates, smoothed
+    float rtt_ms;
+    float loss; // fraction of the packets sent a while ago that were never acked
+    float sent_kbps;
+    float received_kbps;
+    uint64_t stats_start_ns;
+    uint64_t stats_sent_bytes;
+    uint64_t stats_received_bytes;
+};
+
+struct candy_net_delayed_packet {
+    uint64_t deliver_ns;
+    candy_net_address to;
+    uint32_t size;
+    uint8_t data[NET_MAX_PACKET];
+};
+
+// One UDP socket with its connections. A server accepts any peer speaking the
+// protocol; a client only talks to the peers it connected to.
+struct candy_net_endpoint {
+    int fd;
+    uint16_t port;
+    bool accept_connections;
+    float send_rate; // packets per second to every peer
+    uint64_t next_send_ns;
+
+    candy_net_connection *connections;
+    uint32_t max_connections;
+
+    candy_net_conditions conditions;
+    uint32_t rng;
+    candy_net_delayed_packet *delayed;
+    uint32_t delayed_count;
+
+    uint64_t packets_dropped; // by the conditioner
+    uint64_t packets_invalid;
+};
+
+candy_net_address candy_net_loopback_address(uint16_t port);
+bool candy_net_parse_address(const char *text, candy_net_address *out);
+bool candy_net_open(candy_net_endpoint *endpoint, uint16_t port, uint32_t max_connections,
+                    bool accept_connections, float send_rate);
+void candy_net_close(candy_net_endpoint *endpoint);
+candy_net_connection *candy_net_connect(candy_net_endpoint *endpoint,
+                                        candy_net_address address, uint64_t now_ns);
+
+void candy_net_receive(candy_net_endpoint *endpoint, uint64_t now_ns);
+bool candy_net_send_due(const candy_net_endpoint *endpoint, uint64_t now_ns);
+void candy_net_send(candy_net_endpoint *endpoint, uint64_t now_ns);
+
+bool candy_net_send_message(candy_net_connection *connection, const void *data,
+                            uint32_t size);
+uint32_t candy_net_receive_message(candy_net_connection *connection, void *out,
+                                   uint32_t max_size);
+void candy_net_set_snapshot(candy_net_connection *connection, const void *data,
+                            uint32_t size);
+uint32_t candy_net_receive_snapshot(candy_net_connection *connection, void *out,
+                                    uint32_t max_size);
+
+void candy_net_loopback_test(uint32_t client_count,
+                             const candy_net_conditions *conditions, float seconds);
+bool candy_net_test_first_ack();
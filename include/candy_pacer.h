@@ -0,0 +1,13 @@
+#pragma once
+
+#include "core.h"
+
+void candy_sleep_until_ns(uint64_t deadline_ns);
+void candy_init_frame_pacer(candy_context *ctx);
+void candy_pacer_begin_frame(candy_context *ctx);
+void candy_pacer_input_sampled(candy_context *ctx);
+void candy_pacer_frame_submitted(candy_context *ctx, uint32_t frame);
+void candy_pacer_frame_retired(candy_context *ctx, uint32_t frame);
+void candy_pacer_end_frame(candy_context *ctx);
+const char *candy_present_mode_name(VkPresentModeKHR mode);
+int candy_present_mode_index(VkPresentModeKHR mode);
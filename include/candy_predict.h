@@ -0,0 +1,38 @@
+#pragma once
+
+#include "candy_match.h"
+
+#include <cstdint>
+
+// Kept free of core.h like candy_match.h, so it can be benchmarked and tested alone
+
+constexpr uint32_t PREDICT_HISTORY = 1024; // commands kept, about 17 s at 60 ticks/s
+
+static_assert((PREDICT_HISTORY & (PREDICT_HISTORY - 1)) == 0, "history is a ring");
+
+// The local player's commands by command tick, and where they took it. Each command
+// moves the player right away. When the server reports the newest command it applied
+// and where that left the player, the prediction restarts from there and replays
+// the commands after it.
+struct candy_predict {
+    uint32_t next_tick;  // stamped on the next command
+    uint32_t acked_tick; // newest command the server applied, MATCH_NO_TICK if none
+    candy_match_motion motion; // after every command so far
+
+    // The match's fixed step, worked out once so replays only move
+    candy_integrate_params params;
+    float keep;
+
+    uint8_t buttons[PREDICT_HISTORY];
+
+    uint32_t replayed;    // commands replayed by the last reconcile
+    float error;          // how far the last reconcile moved the player
+    uint32_t corrections; // reconciles that moved it at all
+};
+
+void candy_predict_init(candy_predict *predict, float dt);
+uint32_t candy_predict_command(candy_predict *predict, uint8_t buttons);
+void candy_predict_fill_input(const candy_predict *predict, candy_match_input *input);
+void candy_predict_reconcile(candy_predict *predict, uint32_t input_tick,
+                             const candy_match_motion *server);
+void candy_predict_bench();
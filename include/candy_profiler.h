@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Kept free of core.h so it can be used by code that has no Vulkan context
+
+constexpr uint32_t ZONE_RING_SIZE = 1 << 16; // events per thread, must be a power of 2
+constexpr uint32_t MAX_ZONE_THREADS = 32;
+
+// Raw timestamps: the TSC where available, converted to wall time only on export
+static inline uint64_t candy_zone_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+void candy_profiler_init();
+void candy_profiler_shutdown();
+void candy_zone_emit(const char *name, uint64_t begin, uint64_t end);
+void candy_zone_thread_name(const char *name);
+
+// Call once per frame, from the main thread, after the frame's last zone closed
+void candy_profiler_frame_end();
+// Captures the next frame_count frames and writes them as Chrome trace JSON
+void candy_profiler_capture(uint32_t frame_count);
+bool candy_profiler_capturing();
+
+// name must be a string literal, only the pointer is stored
+struct candy_zone_scope {
+    const char *name;
+    uint64_t begin;
+
+    candy_zone_scope(const char *zone_name) : name(zone_name), begin(candy_zone_now()) {}
+    ~candy_zone_scope() { candy_zone_emit(name, begin, candy_zone_now()); }
+};
+
+#define CANDY_ZONE_CONCAT_INNER(a, b) a##b
+#define CANDY_ZONE_CONCAT(a, b) CANDY_ZONE_CONCAT_INNER(a, b)
+#define CANDY_ZONE(name) candy_zone_scope CANDY_ZONE_CONCAT(candy_zone_, __LINE__)(name)
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "core.h"
+
+void candy_init_recorder(candy_context *ctx);
+void candy_destroy_recorder(candy_context *ctx);
+void candy_record_secondaries_begin(candy_context *ctx, uint32_t frame,
+                                    uint32_t image_index);
+void candy_record_secondaries_wait(candy_context *ctx);
+void candy_execute_scene_secondaries(candy_context *ctx, VkCommandBuffer cmd_buffer);
+VkCommandBuffer candy_imgui_secondary(candy_context *ctx);
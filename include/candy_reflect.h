@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Kept free of core.h: game modules describe their state with it, the engine only
+// reads the tables.
+
+// Scalars are matched by kind, their width comes from the field size
+enum candy_field_type : uint32_t {
+    CANDY_FIELD_BYTES, // opaque, carried over only at the same size
+    CANDY_FIELD_BOOL,
+    CANDY_FIELD_INT,
+    CANDY_FIELD_UINT,
+    CANDY_FIELD_FLOAT,
+    CANDY_FIELD_STRUCT, // migrated member by member through `element`
+};
+
+struct candy_state_layout;
+
+// One member of a state struct. Arrays are described by their element, count times.
+struct candy_state_field {
+    const char *name;
+    uint32_t offset;
+    uint32_t size; // of one element
+    uint32_t count;
+    candy_field_type type;
+    const candy_state_layout *element; // CANDY_FIELD_STRUCT only
+    const void *default_value;         // one element, zero when null
+};
+
+// Exported by a game module as `game_state_layout`, next to game_state_size
+struct candy_state_layout {
+    uint32_t size;
+    uint32_t field_count;
+    const candy_state_field *fields;
+};
+
+template <typename T> constexpr candy_field_type candy_field_type_of() {
+    if constexpr (std::is_same_v<T, bool>) {
+        return CANDY_FIELD_BOOL;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return CANDY_FIELD_FLOAT;
+    } else if constexpr (std::is_integral_v<T>) {
+        return std::is_signed_v<T> ? CANDY_FIELD_INT : CANDY_FIELD_UINT;
+    } else {
+        return CANDY_FIELD_BYTES;
+    }
+}
+
+template <typename M>
+constexpr candy_state_field candy_make_field(const char *name, size_t offset,
+                                             const void *default_value,
+                                             const candy_state_layout *element) {
+    using E = std::remove_all_extents_t<M>;
+    return {
+        .name = name,
+        .offset = (uint32_t)offset,
+        .size = (uint32_t)sizeof(E),
+        .count = (uint32_t)(sizeof(M) / sizeof(E)),
+        .type = element ? CANDY_FIELD_STRUCT : candy_field_type_of<E>(),
+        .element = element,
+        .default_value = default_value,
+    };
+}
+
+#define CANDY_FIELD(type, member)                                                        \
+    candy_make_field<decltype(type::member)>(#member, offsetof(type, member), nullptr,   \
+                                             nullptr)
+#define CANDY_FIELD_DEFAULT(type, member, default_ptr)                                   \
+    candy_make_field<decltype(type::member)>(#member, offsetof(type, member),            \
+                                             default_ptr, nullptr)
+#define CANDY_FIELD_STRUCT(type, member, element_layout)                                 \
+    candy_make_field<decltype(type::member)>(#member, offsetof(type, member), nullptr,   \
+                                             &element_layout)
+#define CANDY_LAYOUT(type, fields)                                                       \
+    {(uint32_t)sizeof(type), (uint32_t)(sizeof(fields) / sizeof(fields[0])), fields}
+
+// What a migration did, per field name. Struct members count once, not per element.
+struct candy_migrate_stats {
+    uint32_t copied;
+    uint32_t converted;
+    uint32_t defaulted;
+    uint32_t dropped;
+};
+
+bool candy_validate_layout(const candy_state_layout *layout);
+uint32_t candy_layout_hash(const candy_state_layout *layout);
+void candy_migrate_state(const candy_state_layout *old_layout, const void *old_state,
+                         const candy_state_layout *new_layout, void *new_state,
+                         candy_migrate_stats *stats);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "core.h"
+
+void candy_sample_input(candy_context *ctx);
+void candy_start_sim_thread(candy_context *ctx);
+void candy_stop_sim_thread(candy_context *ctx);
+void candy_sim_reset_snapshots(candy_context *ctx);
+void *candy_sim_acquire_snapshot(candy_context *ctx);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "candy_entity.h"
+
+#include <cstdint>
+
+// Kept free of core.h like candy_net.h, so a server can use it too
+
+constexpr uint32_t SNAPSHOT_MAX_ENTITIES = 4096;
+constexpr uint32_t SNAPSHOT_COUNT_BITS = 13;       // 0 to SNAPSHOT_MAX_ENTITIES
+constexpr float SNAPSHOT_POSITION_RANGE = 64.0f;   // positions kept in [-range, range)
+constexpr uint32_t SNAPSHOT_POSITION_BITS = 20;    // 1/8192 of a unit over that range
+constexpr uint32_t SNAPSHOT_HISTORY = 32;          // ticks a baseline stays usable
+
+static_assert((1u << SNAPSHOT_COUNT_BITS) > SNAPSHOT_MAX_ENTITIES, "count must fit");
+static_assert((SNAPSHOT_HISTORY & (SNAPSHOT_HISTORY - 1)) == 0, "history is a ring");
+
+// The networked part of the game state, quantized, by network id. Ids are entity
+// slots, which stay put while dense indices move.
+struct candy_snapshot {
+    uint32_t tick;
+    uint32_t count; // ids in use are below this
+
+    alignas(64) uint8_t present[SNAPSHOT_MAX_ENTITIES];
+    alignas(64) uint32_t x[SNAPSHOT_MAX_ENTITIES];
+    alignas(64) uint32_t y[SNAPSHOT_MAX_ENTITIES];
+    alignas(64) uint32_t z[SNAPSHOT_MAX_ENTITIES];
+    alignas(64) uint32_t kills[SNAPSHOT_MAX_ENTITIES];
+};
+
+// Recent snapshots by tick. The server keeps what it sent, a client what it decoded.
+// Clients send back the newest tick they decoded, which both sides then still hold
+// as the baseline for the next delta.
+struct candy_snapshot_history {
+    bool valid[SNAPSHOT_HISTORY];
+    candy_snapshot snapshots[SNAPSHOT_HISTORY];
+};
+
+uint32_t candy_snapshot_quantize(float v);
+float candy_snapshot_dequantize(uint32_t q);
+
+void candy_snapshot_capture(const candy_entity_store *store, const uint32_t *kills,
+                            uint32_t tick, candy_snapshot *out);
+candy_snapshot *candy_snapshot_history_store(candy_snapshot_history *history,
+                                             uint32_t tick);
+const candy_snapshot *candy_snapshot_history_find(const candy_snapshot_history *history,
+                                                  uint32_t tick);
+
+uint32_t candy_snapshot_encode(const candy_snapshot *snapshot,
+                               const candy_snapshot *baseline, uint8_t *out,
+                               uint32_t capacity);
+const candy_snapshot *candy_snapshot_decode(const uint8_t *data, uint32_t size,
+                                            candy_snapshot_history *history);
+
+void candy_snapshot_bench();
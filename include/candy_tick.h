@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+// Kept free of core.h like candy_net.h, for the dedicated server. Times are
+// CLOCK_MONOTONIC nanoseconds, the same clock as steady_clock.
+
+constexpr uint32_t TICK_STATS_CAPACITY = 16384;    // ticks kept between two reports
+constexpr uint64_t TICK_DEFAULT_SPIN_NS = 100000;  // spun before a deadline
+constexpr uint32_t TICK_MAX_CATCHUP = 8;           // ticks run back to back when late
+constexpr uint32_t TICK_MAX_CORES = 64;
+
+// Per tick samples since the last report
+struct candy_tick_stats {
+    uint32_t count;
+    uint64_t skipped; // ticks dropped to catch up
+    uint64_t cpu_ns[TICK_STATS_CAPACITY];
+    uint64_t late_ns[TICK_STATS_CAPACITY]; // start past the deadline
+};
+
+// Fixed rate ticks on absolute deadlines, so a slow tick does not push back the
+// ones after it. Sleeps in the kernel until spin_ns before each deadline and spins
+// the rest, which takes the scheduler's wake up latency out of the jitter.
+struct candy_tick_scheduler {
+    uint64_t tick_ns;
+    uint64_t spin_ns;
+    uint64_t tick;
+    uint64_t deadline_ns; // start of the current tick, then of the next
+    uint64_t tick_cpu_ns; // thread CPU time at the start of the current tick
+    uint64_t report_start_ns; // when the samples in stats began
+    candy_tick_stats stats;
+};
+
+uint64_t candy_tick_now_ns();
+uint64_t candy_tick_thread_cpu_ns();
+void candy_tick_sleep_until_ns(uint64_t deadline_ns, uint64_t spin_ns);
+bool candy_tick_pin_thread(const uint32_t *cores, uint32_t count);
+uint32_t candy_tick_parse_cores(const char *list, uint32_t *cores, uint32_t max_cores);
+
+void candy_tick_init(candy_tick_scheduler *scheduler, float tick_rate, uint64_t spin_ns);
+uint64_t candy_tick_begin(candy_tick_scheduler *scheduler);
+void candy_tick_end(candy_tick_scheduler *scheduler);
+void candy_tick_report(candy_tick_scheduler *scheduler);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "core.h"
+
+void candy_create_staging_ring(candy_context *ctx, VkDeviceSize size);
+void candy_destroy_staging_ring(candy_context *ctx);
+void candy_upload_buffer(candy_context *ctx, VkBuffer dst, VkDeviceSize dst_offset,
+                         const void *data, VkDeviceSize size);
+void candy_staging_retire_frame(candy_context *ctx, uint32_t frame);
+void candy_record_staging_uploads(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                  uint32_t frame);
+void candy_flush_staging_now(candy_context *ctx);
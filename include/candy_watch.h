@@ -0,0 +1,9 @@
+#pragma once
+
+#include "core.h"
+
+void candy_start_module_watcher(candy_context *ctx);
+void candy_stop_module_watcher(candy_context *ctx);
+bool candy_open_module(const char *path, uint32_t version, candy_loaded_module *out);
+bool candy_preload_module(uint32_t version, candy_loaded_module *out);
+bool candy_take_staged_module(candy_context *ctx, candy_loaded_module *out);
@@ -2,15 +2,19 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <ostream>
 #include <string.h>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 #include <vector> // For reading our shader files
 
@@ -24,6 +28,15 @@
 #include <glm/glm.hpp>
 #include <vulkan/vulkan_core.h>
 
+#include "candy_client.h"
+#include "candy_entity.h"
+#include "candy_grid.h"
+#include "candy_interp.h"
+#include "candy_match.h"
+#include "candy_net.h"
+#include "candy_reflect.h"
+#include "candy_snapshot.h"
+
 // ============================================================================
 // ERROR HANDLING
 // ============================================================================
@@ -56,6 +69,52 @@ constexpr uint32_t MAX_SHADER_MODULES = 16;
 
 constexpr uint32_t MAX_FRAME_IN_FLIGHT = 2;
 
+constexpr const char *PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// Game module and the files the build drops next to it (see CMakeLists.txt)
+constexpr const char *GAME_MODULE_DIR = "output";
+constexpr const char *GAME_MODULE_PATH = "output/libgame.so";
+constexpr const char *GAME_MODULE_NAME = "libgame.so";
+constexpr const char *GAME_MODULE_LOCK = "libgame.so.lock";   // exists while linking
+constexpr const char *GAME_MODULE_MARKER = "libgame.so.ready"; // touched when done
+constexpr const char *GAME_MODULE_COPY_DIR = "output/.reload"; // versioned copies
+constexpr int MODULE_SETTLE_MS = 100; // quiet time before a module without marker is used
+
+// Game state arena: one reservation at a fixed address, committed as it is used
+constexpr uintptr_t ARENA_BASE_ADDRESS = 0x100000000000; // 16 TiB, clear of heap and libs
+constexpr size_t ARENA_RESERVE_SIZE = 64ull * 1024 * 1024 * 1024;
+constexpr size_t ARENA_STATE_CAPACITY = 256 * 1024 * 1024; // root state, at the base
+constexpr size_t ARENA_COMMIT_GRANULE = 64 * 1024;
+constexpr uint32_t ARENA_MAX_REGIONS = 64;
+
+// GPU memory sub-allocator: buddy allocation inside large per-memory-type blocks
+constexpr VkDeviceSize ALLOC_BLOCK_SIZE = 64 * 1024 * 1024;
+constexpr uint32_t ALLOC_MIN_SHIFT = 8; // 256 byte smallest node
+constexpr uint32_t ALLOC_MAX_ORDERS = 32;
+constexpr uint32_t ALLOC_MAX_BLOCKS = 64;
+
+constexpr uint32_t MAX_INSTANCES = 65536;
+static_assert(ENTITY_CAPACITY <= MAX_INSTANCES, "every entity must fit an instance");
+constexpr uint32_t MAX_RECORD_THREADS = 4;
+constexpr uint32_t GPU_PROFILER_HISTORY = 128; // frames kept for the menu graph
+constexpr uint32_t TRACE_CAPTURE_FRAMES = 120;  // frames per F9 / menu trace capture
+constexpr uint32_t PACER_HISTORY = 128;
+constexpr uint64_t PACER_SPIN_NS = 1000000; // the last stretch of a sleep is spun
+constexpr uint32_t MIN_INSTANCES_PER_SLICE = 4096; // below this one thread records all
+
+constexpr uint32_t JOB_MAX_WORKERS = 16;
+constexpr uint32_t JOB_MAX_THREADS = 32; // workers plus every other thread that spawns
+constexpr uint32_t JOB_DEQUE_SIZE = 4096; // per thread, must be a power of 2
+constexpr uint32_t JOB_IDLE_SPINS = 4096; // steal attempts before a worker sleeps
+constexpr uint32_t BENCH_FILL_GRAIN = 4096; // bench instances per parallel_for piece
+
+constexpr uint32_t SIM_SNAPSHOT_COUNT = 3;
+constexpr uint32_t SIM_SNAPSHOT_FRESH = 0x4; // mailbox flag, beside the snapshot index
+constexpr uint32_t INPUT_KEY_WORDS = (GLFW_KEY_LAST + 64) / 64;
+
+constexpr VkDeviceSize STAGING_RING_SIZE = 16 * 1024 * 1024;
+constexpr uint32_t MAX_STAGING_COPIES = 256;
+
 #ifdef NDEBUG
 constexpr bool ENABLE_VALIDATION = false;
 #else
@@ -80,6 +139,93 @@ struct candy_config {
     bool enable_hot_reloading;
     const char *app_name;
     const char *window_title;
+
+    // Headless mode: no window, no surface, no swapchain. Frames are rendered into
+    // offscreen images and optionally read back to host memory.
+    bool headless;
+    bool headless_readback;
+    uint32_t headless_frame_count;
+
+    // GPU driven culling/drawing, falls back to a plain instanced draw if disabled
+    bool enable_gpu_culling;
+    // Synthetic instances drawn every frame, for benchmarking in headless runs
+    uint32_t bench_instance_count;
+
+    // Frame pacing, 0 fps leaves the frame rate to the present mode
+    float target_fps;
+    bool late_latch;
+    VkPresentModeKHR present_mode;
+
+    // Frames traced from startup with the CPU zone profiler, 0 to only trace on F9
+    uint32_t trace_frames;
+
+    // Fixed timestep simulation, independent of the frame rate
+    float tick_rate;
+    uint32_t max_catchup_ticks; // ticks run at most per frame, the rest is dropped
+
+    // Benchmarks the entity integration kernels over N entities and exits, 0 to run
+    uint32_t bench_integrate_count;
+
+    // Benchmarks snapshot serialization at 16, 256 and 4096 entities and exits
+    bool bench_snapshot;
+
+    // Runs a server and N clients over loopback with the given conditions and exits
+    uint32_t net_loopback_clients;
+    float net_loopback_seconds;
+    candy_net_conditions net_conditions;
+
+    // Plays on a dedicated server instead of locally, predicting the local player
+    bool connect;
+    candy_net_address connect_address;
+
+    // Checks prediction against the match and times worst case replays, then exits
+    bool bench_predict;
+
+    // Loads this module, runs its init, a second of ticks and its cleanup, then exits
+    // with whether all of it worked. Nothing is rendered.
+    const char *check_module;
+
+    // Runs the named self test and exits with whether it passed, see candy_run_test
+    const char *test;
+};
+
+// A sub-allocation handed out by the candy allocator. Bind resources with
+// (memory, offset); mapped is non-null for HOST_VISIBLE memory.
+struct candy_allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped;
+    uint32_t block_index;
+    uint32_t order; // UINT32_MAX for dedicated blocks
+};
+
+// One vkAllocateMemory. free_bits[k] has a bit per buddy node of order k (node size
+// 1 << (k + ALLOC_MIN_SHIFT)), set while that node is free.
+struct candy_alloc_block {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void *mapped;
+    uint32_t memory_type;
+    uint32_t top_order;
+    bool optimal_tiling; // images and buffers never share a block (granularity)
+    bool dedicated;
+
+    uint64_t *free_bits[ALLOC_MAX_ORDERS];
+    uint32_t free_count[ALLOC_MAX_ORDERS];
+    VkDeviceSize allocated; // sum of node sizes handed out
+    VkDeviceSize requested; // sum of sizes asked for
+    uint32_t allocation_count;
+};
+
+struct candy_allocator {
+    // Cached once, candy_find_memory_type used to query this on every call
+    VkPhysicalDeviceMemoryProperties mem_props;
+    VkDeviceSize buffer_image_granularity;
+    uint32_t max_allocation_count;
+
+    candy_alloc_block blocks[ALLOC_MAX_BLOCKS];
+    uint32_t block_count;
 };
 
 // Hot data - accessed every frame (cache-line aligned)
@@ -90,6 +236,39 @@ struct alignas(64) candy_frame_data {
     VkSemaphore render_finished_semaphores[MAX_FRAME_IN_FLIGHT];
     VkFence in_flight_fences[MAX_FRAME_IN_FLIGHT];
     uint32_t current_frame;
+
+    // Startup timing, reported once after the first frame is submitted
+    uint64_t init_start_ns;
+    bool first_frame_logged;
+};
+
+// Command pools are externally synchronised, so every recording thread owns one per
+// frame in flight and records a single secondary command buffer from it.
+struct candy_record_thread {
+    std::thread thread;
+    VkCommandPool command_pools[MAX_FRAME_IN_FLIGHT];
+    VkCommandBuffer command_buffers[MAX_FRAME_IN_FLIGHT];
+    bool recorded; // the buffer for the current frame holds commands
+};
+
+// Worker threads that record the scene pass in instance slices, plus one that records
+// the ImGui pass, while the main thread records the primary buffer.
+struct candy_recorder {
+    candy_record_thread threads[MAX_RECORD_THREADS];
+    uint32_t thread_count;
+    uint32_t scene_thread_count; // threads past this record the ImGui pass
+
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    uint64_t generation; // bumped once per frame to wake the workers
+    uint32_t pending;
+    bool quit;
+
+    // Frame being recorded, written under the mutex before generation is bumped
+    uint32_t frame;
+    uint32_t image_index;
+    uint32_t slice_count;
 };
 
 // All core long-lived vulkan handles
@@ -108,7 +287,15 @@ struct candy_core {
     uint32_t present_queue_family;
 
     VkBuffer vertex_buffer;
-    VkDeviceMemory vertex_buffer_memory;
+    candy_allocation vertex_buffer_alloc;
+    VkBuffer index_buffer;
+    candy_allocation index_buffer_alloc;
+
+    // Optional device capabilities, filled in at logical device creation
+    bool has_draw_indirect_count;
+    bool has_multi_draw_indirect;
+    bool has_draw_indirect_first_instance;
+    uint32_t max_draw_indirect_count;
 };
 
 // This is "warm" data. This is all recreated together when the window is resized.
@@ -126,7 +313,234 @@ struct candy_swapchain {
     bool has_framebuffer_resized = false;
 };
 
+// Offscreen render targets that stand in for the swapchain in headless mode.
+// The images live in swapchain.images/image_views/framebuffers so the regular
+// command recording path can be reused; this only holds what the swapchain would own.
+struct candy_offscreen {
+    candy_allocation image_allocs[MAX_FRAME_IN_FLIGHT];
+
+    // One tightly packed RGBA8 region per frame in flight, persistently mapped
+    VkBuffer readback_buffer;
+    candy_allocation readback_alloc;
+    void *readback_data;
+    VkDeviceSize readback_frame_size;
+};
+
+struct candy_staging_copy {
+    VkBuffer dst;
+    VkBufferCopy region;
+};
+
+// Persistently mapped upload ring. Uploads are copied in at head, recorded into the
+// next frame's command buffer, and retired once that frame's in_flight_fence signals.
+struct candy_staging_ring {
+    VkBuffer buffer;
+    candy_allocation alloc;
+    uint8_t *mapped;
+    VkDeviceSize size;
+
+    // Monotonic byte counters, the physical offset is counter % size
+    uint64_t head;
+    uint64_t tail;
+    uint64_t frame_end[MAX_FRAME_IN_FLIGHT];
+
+    // Copies waiting to be recorded
+    candy_staging_copy pending[MAX_STAGING_COPIES];
+    uint32_t pending_count;
+};
+
+// Per-instance vertex data, fed through vertex binding 1
+struct candy_instance {
+    glm::vec3 offset;
+    float scale;
+};
+
+// One persistently mapped instance buffer per frame in flight. The game writes into
+// the current frame's buffer between candy_begin_frame and candy_draw_frame.
+struct candy_instance_buffers {
+    VkBuffer buffers[MAX_FRAME_IN_FLIGHT];
+    candy_allocation allocs[MAX_FRAME_IN_FLIGHT];
+    candy_instance *mapped[MAX_FRAME_IN_FLIGHT];
+    uint32_t count;
+};
+
+// GPU driven drawing: a compute pass frustum culls the instances and writes one
+// VkDrawIndexedIndirectCommand per visible object, consumed by the render pass.
+struct candy_gpu_culling {
+    bool enabled;
+
+    VkDescriptorSetLayout set_layout;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_sets[MAX_FRAME_IN_FLIGHT];
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+
+    VkBuffer draw_buffers[MAX_FRAME_IN_FLIGHT];
+    candy_allocation draw_allocs[MAX_FRAME_IN_FLIGHT];
+    VkBuffer count_buffers[MAX_FRAME_IN_FLIGHT];
+    candy_allocation count_allocs[MAX_FRAME_IN_FLIGHT];
+
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmd_draw_indexed_indirect_count;
+
+    // Bounding sphere radius of the mesh at scale 1, and the planes (xyz normal,
+    // w distance) a sphere must be on the positive side of
+    float bound_radius;
+    glm::vec4 frustum_planes[6];
+};
+
+// Matches the push constant block in cull.comp
+struct candy_cull_push_constants {
+    glm::vec4 planes[6];
+    uint32_t object_count;
+    uint32_t index_count;
+    uint32_t compact;
+    float bound_radius;
+};
+
+// Passes timed on the GPU, each bracketed by a pair of timestamps
+enum candy_gpu_scope : uint32_t {
+    CANDY_GPU_SCOPE_CULLING,
+    CANDY_GPU_SCOPE_SCENE,
+    CANDY_GPU_SCOPE_IMGUI,
+    CANDY_GPU_SCOPE_FRAME, // first to last timestamp of the primary buffer
+    CANDY_GPU_SCOPE_COUNT,
+};
+
+// One timestamp query pool per frame in flight. A pool is read back once its frame's
+// fence has signalled, so results arrive MAX_FRAME_IN_FLIGHT frames late but never
+// stall the CPU.
+struct candy_gpu_profiler {
+    bool enabled;
+    float timestamp_period; // nanoseconds per tick
+    uint64_t timestamp_mask; // from the queue family's timestampValidBits
+
+    VkQueryPool query_pools[MAX_FRAME_IN_FLIGHT];
+    bool pool_written[MAX_FRAME_IN_FLIGHT];
+    bool scope_written[MAX_FRAME_IN_FLIGHT][CANDY_GPU_SCOPE_COUNT];
+
+    // Milliseconds, ring buffer indexed by history_head
+    float history[CANDY_GPU_SCOPE_COUNT][GPU_PROFILER_HISTORY];
+    uint32_t history_head;
+    uint32_t history_count;
+
+    // Totals for the headless report
+    double total_ms[CANDY_GPU_SCOPE_COUNT];
+    uint32_t total_samples[CANDY_GPU_SCOPE_COUNT];
+};
+
+// Caps the frame rate and measures where the frame time goes. With late latch the
+// wait moves in front of input sampling, so the game runs on input as fresh as the
+// deadline allows; otherwise the wait sits after present like a plain limiter.
+struct candy_frame_pacer {
+    float target_fps;
+    bool late_latch;
+
+    // The swapchain is recreated when requested differs from active
+    VkPresentModeKHR requested_present_mode;
+    VkPresentModeKHR present_mode;
+    bool present_mode_available[3]; // FIFO, MAILBOX, IMMEDIATE
+
+    uint64_t deadline_ns;  // when the next frame should be submitted
+    uint64_t frame_begin_ns;
+    uint64_t input_ns;
+    uint64_t frame_input_ns[MAX_FRAME_IN_FLIGHT]; // input time of the submitted frame
+    double predicted_work_ns; // input sampling to present, biased towards the max
+
+    // Latest measurements in milliseconds and their history
+    float cpu_ms;
+    float gpu_ms;
+    float latency_ms; // input sampling until the frame's fence was seen signalled
+    float cpu_history[PACER_HISTORY];
+    float gpu_history[PACER_HISTORY];
+    float latency_history[PACER_HISTORY];
+    uint32_t history_head;
+};
+
+// One published snapshot of the game state, immutable while the render thread has it.
+// While connected it also carries the client's newest decoded network snapshot, the
+// positions of its ids only, for the render thread's interpolation buffer.
+struct candy_sim_snapshot {
+    void *state;
+    uint64_t tick;
+    uint64_t tick_time_ns; // when the snapshot's last tick was due
+
+    candy_snapshot *network;     // nullptr unless connected
+    bool has_network;            // false before the first snapshot decoded
+    uint64_t network_arrival_ns; // when its packet reached the socket
+};
+
+// Fixed timestep simulation on its own thread. After every batch of ticks the module
+// publishes a snapshot, or the state is copied into one, through a triple buffered
+// mailbox, so neither side ever waits for the other. The render thread draws the
+// newest snapshot with alpha, how far the frame is past that snapshot's tick (0 to 1).
+struct candy_sim_clock {
+    float tick_rate; // ticks per second, render thread, pushed to tick_ns every frame
+    uint32_t max_catchup_ticks; // ticks run at most per batch, the rest is dropped
+    std::atomic<uint64_t> tick_ns;
+
+    std::thread thread;
+    std::mutex mutex; // held while ticking and publishing, and by hot reload
+    std::atomic<bool> quit;
+    bool running;
+
+    // Sim thread only
+    uint64_t last_ns;
+    uint64_t accumulator_ns; // wall time not simulated yet
+
+    candy_sim_snapshot snapshots[SIM_SNAPSHOT_COUNT];
+    std::atomic<uint32_t> mailbox; // newest snapshot, | SIM_SNAPSHOT_FRESH if unseen
+    uint32_t back;                 // written by the sim thread, under the mutex
+    uint32_t front;                // drawn by the render thread
+
+    std::atomic<uint64_t> tick;          // ticks run since start
+    std::atomic<uint64_t> dropped_ticks; // lost to the catch up limit
+    std::atomic<uint32_t> batch_ticks;   // ticks in the last batch
+    float alpha;                         // render thread
+};
+
+// Work stealing job scheduler. Every thread that spawns gets its own deque; idle
+// workers steal from the others. Jobs may spawn and wait on further jobs.
+struct candy_job_queue;
+
+struct candy_job_counter {
+    std::atomic<uint32_t> pending;
+};
+
+struct candy_job {
+    void (*fn)(void *data, uint32_t begin, uint32_t end);
+    void *data;
+    uint32_t begin;
+    uint32_t end;
+    candy_job_counter *counter;
+};
+
+struct candy_job_system {
+    std::thread workers[JOB_MAX_WORKERS];
+    uint32_t worker_count;
+
+    candy_job_queue *queues[JOB_MAX_THREADS];
+    std::atomic<uint32_t> queue_count;
+    std::mutex register_mutex;
+    std::atomic<uint32_t> steal_seed;
+
+    std::atomic<int64_t> in_flight; // spawned and not finished
+    std::atomic<int64_t> queued;    // spawned and not taken by a thread yet
+    std::mutex sleep_mutex;
+    std::condition_variable wake_cv;
+    std::atomic<uint32_t> sleeping;
+    std::atomic<bool> quit;
+};
+
+// Keyboard state sampled by the main thread, one bit per GLFW key
+struct candy_input {
+    std::atomic<uint64_t> keys[INPUT_KEY_WORDS];
+};
+
 struct candy_pipeline {
+    // Shared by the engine and ImGui pipelines, persisted to PIPELINE_CACHE_PATH
+    VkPipelineCache cache;
+    size_t cache_loaded_bytes;
+
     VkRenderPass render_pass;
     VkPipelineLayout pipeline_layout;
     VkPipeline graphics_pipeline;
@@ -150,20 +564,82 @@ struct candy_imgui {
 
 struct candy_game_api {
     void (*init)(candy_context *ctx, void *game_state);
-    void (*update)(candy_context *ctx, void *game_state, uint32_t delta_time);
-    void (*render)(candy_context *ctx, void *game_state);
+    // Called once per fixed tick with the tick length in seconds, on the simulation
+    // thread. Input comes from candy_key_down, GLFW is main thread only.
+    void (*update)(candy_context *ctx, void *game_state, float dt);
+    // Called once per frame on the main thread with the newest snapshot, what publish
+    // wrote or else a read only copy of the state; alpha in [0, 1] blends the previous
+    // tick into the last. While connected, ctx->interp holds the server's snapshots.
+    void (*render)(candy_context *ctx, void *snapshot, float alpha);
     void (*cleanup)(candy_context *ctx, void *game_state);
 
-    void (*on_reload)(void *old_state, void *new_state);
+    // Runs in place: new_state is the live state, already resized and with new bytes
+    // zeroed. old_state is the same pointer when the layout did not change, otherwise a
+    // temporary copy of the old state. Returns false, without having written to
+    // new_state, to reject the new module, which rolls back to the old one.
+    // With a layout on both sides the engine has migrated every field beforehand, so
+    // on_reload is only needed for fixups a field by field copy cannot express.
+    bool (*on_reload)(void *old_state, void *new_state);
+    size_t state_size;
+    const candy_state_layout *layout; // game_state_layout, optional
+
+    // Optional, as game_publish and game_snapshot_size. Called on the simulation
+    // thread after every batch of ticks to write what render reads into a snapshot of
+    // snapshot_size bytes, so a large state is never copied whole.
+    void (*publish)(const void *game_state, void *snapshot);
+    size_t snapshot_size; // state_size without publish
+};
+
+// A module dlopen'ed from its own versioned copy, with every symbol resolved
+struct candy_loaded_module {
+    void *dll_handle;
+    candy_game_api api;
+    uint32_t version;
+};
+
+// Background inotify watch on GAME_MODULE_DIR. Finished builds are loaded on the
+// watcher thread and handed over in `staged`; the main loop only reads `staged_ready`.
+struct candy_module_watcher {
+    std::thread thread;
+    int inotify_fd;
+    int wake_pipe[2];  // written to stop the thread
+    int taken_pipe[2]; // written by the main thread once it took `staged`
+    bool running;
+
+    // Owned by the watcher while staged_ready is false, by the main thread after
+    candy_loaded_module staged;
+    std::atomic<bool> staged_ready;
+    uint32_t next_version;
+};
+
+// A range of the arena handed out once and kept for the life of the process.
+// Only [offset, offset + committed) is readable and writable.
+struct candy_arena_region {
+    size_t offset;
+    size_t capacity;
+    size_t committed;
+};
+
+// Virtual memory that never moves, so modules can keep pointers into it across
+// reloads. Region 0 is the root game state at the base, the rest are reserved by
+// the modules. Main thread only.
+struct candy_arena {
+    uint8_t *base;
+    size_t reserved;
+    size_t next_offset;
+    candy_arena_region regions[ARENA_MAX_REGIONS];
+    uint32_t region_count;
     size_t state_size;
 };
 
 struct candy_game_module {
     void *dll_handle;
     candy_game_api api;
-    void *game_state;
+    void *game_state; // root region of the arena
+    uint32_t version;
+    candy_arena arena;
 
-    time_t last_write_time;
+    candy_module_watcher watcher;
     uint32_t reload_count;
 };
 // Main candy context
@@ -176,13 +652,26 @@ struct candy_context {
 
     // --- Core Systems ---
     candy_core core;
+    candy_allocator allocator;
 
     // --- Rendering Pipeline (recreated if swapchain changes format) ---
     candy_swapchain swapchain;
+    candy_offscreen offscreen;
     candy_pipeline pipeline;
+    candy_gpu_culling culling;
 
     // --- Hot Data ---
     candy_frame_data frame_data;
+    candy_recorder recorder;
+    candy_gpu_profiler gpu_profiler;
+    candy_frame_pacer pacer;
+    candy_sim_clock sim;
+    candy_input input;
+    candy_job_system jobs;
+    candy_instance_buffers instances;
+    candy_staging_ring staging;
+    candy_client client; // sim thread only, inactive unless connected
+    candy_interp interp; // render thread, fed the client's snapshots as they publish
 
     // --- Hot reload ---
     candy_game_module game_module;
@@ -216,18 +705,23 @@ struct candy_vertex {
     glm::vec2 pos;
     glm::vec3 color;
 
-    static VkVertexInputBindingDescription get_bindings_description() {
+    // Binding 0 is the mesh, binding 1 the per-instance candy_instance stream
+    static std::array<VkVertexInputBindingDescription, 2> get_bindings_description() {
+        std::array<VkVertexInputBindingDescription, 2> binding_description {};
+
+        binding_description[0].binding = 0;
+        binding_description[0].stride = sizeof(candy_vertex);
+        binding_description[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-        VkVertexInputBindingDescription binding_description {
-            .binding = 0,
-            .stride = sizeof(candy_vertex),
-            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX}; // we wont use instanced rendering
+        binding_description[1].binding = 1;
+        binding_description[1].stride = sizeof(candy_instance);
+        binding_description[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
         return binding_description;
     };
 
-    static std::array<VkVertexInputAttributeDescription, 2> get_attribute_description() {
-        std::array<VkVertexInputAttributeDescription, 2> attribute_description {};
+    static std::array<VkVertexInputAttributeDescription, 4> get_attribute_description() {
+        std::array<VkVertexInputAttributeDescription, 4> attribute_description {};
 
         attribute_description[0].binding = 0;
         attribute_description[0].location = 0;
@@ -239,12 +733,60 @@ struct candy_vertex {
         attribute_description[1].format = VK_FORMAT_R32G32B32_SFLOAT;
         attribute_description[1].offset = offsetof(candy_vertex, color);
 
+        attribute_description[2].binding = 1;
+        attribute_description[2].location = 2;
+        attribute_description[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attribute_description[2].offset = offsetof(candy_instance, offset);
+
+        attribute_description[3].binding = 1;
+        attribute_description[3].location = 3;
+        attribute_description[3].format = VK_FORMAT_R32_SFLOAT;
+        attribute_description[3].offset = offsetof(candy_instance, scale);
+
         return attribute_description;
     }
 };
 const std::vector<candy_vertex> vertices = {{{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
                                             {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
                                             {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}}};
+const std::vector<uint16_t> indices = {0, 1, 2};
+
 void candy_recreate_swapchain(candy_context *ctx);
+uint64_t candy_time_ns();
+
+std::vector<char> candy_read_shader_file(const std::string &filename);
+VkShaderModule candy_create_shader_module(const std::vector<char> &shader_code,
+                                          VkDevice device);
+
+uint32_t candy_find_memory_type(candy_context *ctx, uint32_t type_filter,
+                                VkMemoryPropertyFlags props);
+void candy_create_buffer(candy_context *ctx, VkDeviceSize size, VkBufferUsageFlags usage,
+                         VkMemoryPropertyFlags props, VkBuffer *buffer,
+                         candy_allocation *allocation);
+void candy_destroy_buffer(candy_context *ctx, VkBuffer buffer,
+                          candy_allocation *allocation);
+
+// Reserves `count` instances in the current frame's instance buffer and returns a
+// pointer to write them to, or nullptr if MAX_INSTANCES would be exceeded.
+candy_instance *candy_reserve_instances(candy_context *ctx, uint32_t count);
+
+// Jobs run fn(data, begin, end). Wait on a counter to join every job spawned with it.
+typedef void (*candy_job_fn)(void *data, uint32_t begin, uint32_t end);
+
+void candy_job_spawn(candy_context *ctx, candy_job_counter *counter, candy_job_fn fn,
+                     void *data, uint32_t begin, uint32_t end);
+void candy_job_wait(candy_context *ctx, candy_job_counter *counter);
+void candy_parallel_for(candy_context *ctx, uint32_t count, uint32_t grain,
+                        candy_job_fn fn, void *data);
+
+// Whether a GLFW key was down when the main thread last sampled input. Safe to call
+// from game_update on the simulation thread.
+bool candy_key_down(candy_context *ctx, int key);
+
+// Latest GPU time of a scope in milliseconds, 0 if it has not been measured yet
+float candy_gpu_scope_ms(candy_context *ctx, candy_gpu_scope scope);
+// The scope's rolling history, oldest first. Returns the number of samples copied
+uint32_t candy_gpu_scope_history(candy_context *ctx, candy_gpu_scope scope, float *out,
+                                 uint32_t max_count);
 
 void candy_destroy_swapchain(candy_context *ctx);
@@ -0,0 +1,368 @@
+#include "candy_alloc.h"
+
+// ============================================================================
+// BUDDY BLOCKS
+// ============================================================================
+
+static uint32_t candy_alloc_ceil_log2(VkDeviceSize value) {
+    uint32_t log = 0;
+    while (((VkDeviceSize)1 << log) < value) {
+        ++log;
+    }
+    return log;
+}
+
+static uint32_t candy_alloc_node_count(const candy_alloc_block *block, uint32_t order) {
+    return (uint32_t)(block->size >> (order + ALLOC_MIN_SHIFT));
+}
+
+static bool candy_alloc_test_bit(const candy_alloc_block *block, uint32_t order,
+                                 uint32_t index) {
+    return (block->free_bits[order][index / 64] >> (index % 64)) & 1;
+}
+
+static void candy_alloc_set_free(candy_alloc_block *block, uint32_t order,
+                                 uint32_t index) {
+    block->free_bits[order][index / 64] |= (uint64_t)1 << (index % 64);
+    block->free_count[order]++;
+}
+
+static void candy_alloc_clear_free(candy_alloc_block *block, uint32_t order,
+                                   uint32_t index) {
+    block->free_bits[order][index / 64] &= ~((uint64_t)1 << (index % 64));
+    block->free_count[order]--;
+}
+
+static bool candy_alloc_block_init_bits(candy_alloc_block *block) {
+    block->top_order = candy_alloc_ceil_log2(block->size) - ALLOC_MIN_SHIFT;
+    CANDY_ASSERT(block->top_order < ALLOC_MAX_ORDERS, "Allocator block too large");
+
+    // All orders share one zeroed allocation
+    size_t word_counts[ALLOC_MAX_ORDERS];
+    size_t total_words = 0;
+    for (uint32_t k = 0; k <= block->top_order; ++k) {
+        word_counts[k] = (candy_alloc_node_count(block, k) + 63) / 64;
+        total_words += word_counts[k];
+    }
+
+    uint64_t *words = (uint64_t *)calloc(total_words, sizeof(uint64_t));
+    if (!words) {
+        return false;
+    }
+
+    for (uint32_t k = 0; k <= block->top_order; ++k) {
+        block->free_bits[k] = words;
+        block->free_count[k] = 0;
+        words += word_counts[k];
+    }
+
+    candy_alloc_set_free(block, block->top_order, 0);
+    return true;
+}
+
+// Returns the byte offset of a free node of `order`, splitting larger nodes as
+// needed, or UINT64_MAX if the block has no room.
+static VkDeviceSize candy_alloc_block_take(candy_alloc_block *block, uint32_t order) {
+    uint32_t found = order;
+    while (found <= block->top_order && block->free_count[found] == 0) {
+        ++found;
+    }
+    if (found > block->top_order) {
+        return UINT64_MAX;
+    }
+
+    uint32_t word_count = (candy_alloc_node_count(block, found) + 63) / 64;
+    uint32_t index = UINT32_MAX;
+    for (uint32_t w = 0; w < word_count; ++w) {
+        if (block->free_bits[found][w]) {
+            index = w * 64 + (uint32_t)__builtin_ctzll(block->free_bits[found][w]);
+            break;
+        }
+    }
+    CANDY_ASSERT(index != UINT32_MAX, "Allocator free count out of sync");
+    candy_alloc_clear_free(block, found, index);
+
+    // Split down, keeping the left half and freeing the right buddy each time
+    while (found > order) {
+        --found;
+        index *= 2;
+        candy_alloc_set_free(block, found, index + 1);
+    }
+
+    return (VkDeviceSize)index << (order + ALLOC_MIN_SHIFT);
+}
+
+static void candy_alloc_block_give(candy_alloc_block *block, VkDeviceSize offset,
+                                   uint32_t order) {
+    uint32_t index = (uint32_t)(offset >> (order + ALLOC_MIN_SHIFT));
+
+    // Merge with the buddy for as long as it is free
+    while (order < block->top_order && candy_alloc_test_bit(block, order, index ^ 1)) {
+        candy_alloc_clear_free(block, order, index ^ 1);
+        index >>= 1;
+        ++order;
+    }
+
+    candy_alloc_set_free(block, order, index);
+}
+
+// ============================================================================
+// ALLOCATOR
+// ============================================================================
+
+void candy_init_allocator(candy_context *ctx) {
+    candy_allocator *allocator = &ctx->allocator;
+
+    vkGetPhysicalDeviceMemoryProperties(ctx->core.physical_device, &allocator->mem_props);
+
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(ctx->core.physical_device, &device_props);
+    allocator->buffer_image_granularity = device_props.limits.bufferImageGranularity;
+    allocator->max_allocation_count = device_props.limits.maxMemoryAllocationCount;
+    allocator->block_count = 0;
+
+    std::cout << "[CANDY ALLOC] " << allocator->mem_props.memoryTypeCount
+              << " memory types, " << allocator->mem_props.memoryHeapCount
+              << " heaps, bufferImageGranularity " << allocator->buffer_image_granularity
+              << std::endl;
+}
+
+static void candy_alloc_release_block(candy_context *ctx, candy_alloc_block *block) {
+    if (block->memory == VK_NULL_HANDLE) {
+        return;
+    }
+    if (block->mapped) {
+        vkUnmapMemory(ctx->core.logical_device, block->memory);
+    }
+    vkFreeMemory(ctx->core.logical_device, block->memory, nullptr);
+    if (!block->dedicated) {
+        free(block->free_bits[0]);
+    }
+    *block = {};
+}
+
+void candy_destroy_allocator(candy_context *ctx) {
+    for (uint32_t i = 0; i < ctx->allocator.block_count; ++i) {
+        if (ctx->allocator.blocks[i].allocation_count > 0) {
+            std::cerr << "[CANDY ALLOC] Block " << i << " still has "
+                      << ctx->allocator.blocks[i].allocation_count
+                      << " live allocations at shutdown" << std::endl;
+        }
+        candy_alloc_release_block(ctx, &ctx->allocator.blocks[i]);
+    }
+    ctx->allocator.block_count = 0;
+}
+
+// Blocks are ALLOC_BLOCK_SIZE, but small heaps (e.g. a 256 MiB BAR heap) get
+// blocks of at most an eighth of the heap so one block cannot starve it.
+static VkDeviceSize candy_alloc_block_size_for(const candy_allocator *allocator,
+                                               uint32_t memory_type) {
+    uint32_t heap = allocator->mem_props.memoryTypes[memory_type].heapIndex;
+    VkDeviceSize heap_size = allocator->mem_props.memoryHeaps[heap].size;
+
+    VkDeviceSize size = ALLOC_BLOCK_SIZE;
+    while (size > ((VkDeviceSize)1 << 20) && size > heap_size / 8) {
+        size >>= 1;
+    }
+    return size;
+}
+
+static uint32_t candy_alloc_new_block(candy_context *ctx, uint32_t memory_type,
+                                      VkDeviceSize size, bool optimal_tiling,
+                                      bool dedicated) {
+    candy_allocator *allocator = &ctx->allocator;
+
+    // Reuse a slot from a released dedicated block if there is one
+    uint32_t slot = allocator->block_count;
+    for (uint32_t i = 0; i < allocator->block_count; ++i) {
+        if (allocator->blocks[i].memory == VK_NULL_HANDLE) {
+            slot = i;
+            break;
+        }
+    }
+    CANDY_ASSERT(slot < ALLOC_MAX_BLOCKS, "Exceeded ALLOC_MAX_BLOCKS");
+    CANDY_ASSERT(slot < allocator->max_allocation_count,
+                 "Exceeded maxMemoryAllocationCount");
+
+    candy_alloc_block *block = &allocator->blocks[slot];
+    *block = {};
+
+    VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = nullptr,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type,
+    };
+
+    VkResult result =
+        vkAllocateMemory(ctx->core.logical_device, &alloc_info, nullptr, &block->memory);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to allocate memory block");
+
+    block->size = size;
+    block->memory_type = memory_type;
+    block->optimal_tiling = optimal_tiling;
+    block->dedicated = dedicated;
+
+    // Host visible blocks stay mapped for their whole lifetime
+    if (allocator->mem_props.memoryTypes[memory_type].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(ctx->core.logical_device, block->memory, 0, VK_WHOLE_SIZE, 0,
+                             &block->mapped);
+        CANDY_ASSERT(result == VK_SUCCESS, "Failed to map memory block");
+    }
+
+    if (!dedicated) {
+        bool bits_ok = candy_alloc_block_init_bits(block);
+        CANDY_ASSERT(bits_ok, "Failed to allocate buddy bitmaps");
+    }
+
+    if (slot == allocator->block_count) {
+        allocator->block_count++;
+    }
+    return slot;
+}
+
+candy_allocation candy_alloc_memory(candy_context *ctx, const VkMemoryRequirements &reqs,
+                                    VkMemoryPropertyFlags props, bool optimal_tiling) {
+    candy_allocator *allocator = &ctx->allocator;
+    uint32_t memory_type = candy_find_memory_type(ctx, reqs.memoryTypeBits, props);
+
+    candy_allocation allocation = {};
+
+    // Too big to sub-allocate, give it its own VkDeviceMemory
+    VkDeviceSize block_size = candy_alloc_block_size_for(allocator, memory_type);
+    if (reqs.size > block_size / 2) {
+        uint32_t slot =
+            candy_alloc_new_block(ctx, memory_type, reqs.size, optimal_tiling, true);
+        candy_alloc_block *block = &allocator->blocks[slot];
+        block->allocated = reqs.size;
+        block->requested = reqs.size;
+        block->allocation_count = 1;
+
+        allocation.memory = block->memory;
+        allocation.offset = 0;
+        allocation.size = reqs.size;
+        allocation.mapped = block->mapped;
+        allocation.block_index = slot;
+        allocation.order = UINT32_MAX;
+        return allocation;
+    }
+
+    // Buddy nodes are aligned to their own size, so rounding up to the alignment
+    // is enough to satisfy it
+    VkDeviceSize node_size = std::max(reqs.size, reqs.alignment);
+    uint32_t order =
+        std::max(candy_alloc_ceil_log2(node_size), ALLOC_MIN_SHIFT) - ALLOC_MIN_SHIFT;
+
+    VkDeviceSize offset = UINT64_MAX;
+    uint32_t slot = UINT32_MAX;
+    for (uint32_t i = 0; i < allocator->block_count && offset == UINT64_MAX; ++i) {
+        candy_alloc_block *block = &allocator->blocks[i];
+        if (block->memory == VK_NULL_HANDLE || block->dedicated ||
+            block->memory_type != memory_type ||
+            block->optimal_tiling != optimal_tiling) {
+            continue;
+        }
+        offset = candy_alloc_block_take(block, order);
+        slot = i;
+    }
+
+    if (offset == UINT64_MAX) {
+        slot = candy_alloc_new_block(ctx, memory_type, block_size, optimal_tiling, false);
+        offset = candy_alloc_block_take(&allocator->blocks[slot], order);
+        CANDY_ASSERT(offset != UINT64_MAX, "Fresh allocator block has no room");
+    }
+
+    candy_alloc_block *block = &allocator->blocks[slot];
+    block->allocated += (VkDeviceSize)1 << (order + ALLOC_MIN_SHIFT);
+    block->requested += reqs.size;
+    block->allocation_count++;
+
+    allocation.memory = block->memory;
+    allocation.offset = offset;
+    allocation.size = reqs.size;
+    allocation.mapped = block->mapped ? (uint8_t *)block->mapped + offset : nullptr;
+    allocation.block_index = slot;
+    allocation.order = order;
+    return allocation;
+}
+
+void candy_free_memory(candy_context *ctx, candy_allocation *allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    candy_alloc_block *block = &ctx->allocator.blocks[allocation->block_index];
+    CANDY_ASSERT(block->memory == allocation->memory, "Allocation freed twice");
+
+    if (block->dedicated) {
+        candy_alloc_release_block(ctx, block);
+    } else {
+        candy_alloc_block_give(block, allocation->offset, allocation->order);
+        block->allocated -= (VkDeviceSize)1 << (allocation->order + ALLOC_MIN_SHIFT);
+        block->requested -= allocation->size;
+        block->allocation_count--;
+    }
+
+    *allocation = {};
+}
+
+// ============================================================================
+// STATS
+// ============================================================================
+
+void candy_alloc_dump_stats(candy_context *ctx) {
+    const candy_allocator *allocator = &ctx->allocator;
+
+    std::cout << "[CANDY ALLOC] Stats per heap:" << std::endl;
+    for (uint32_t heap = 0; heap < allocator->mem_props.memoryHeapCount; ++heap) {
+        VkDeviceSize reserved = 0;
+        VkDeviceSize allocated = 0;
+        VkDeviceSize requested = 0;
+        VkDeviceSize largest_free = 0;
+        uint32_t block_count = 0;
+        uint32_t allocation_count = 0;
+
+        for (uint32_t i = 0; i < allocator->block_count; ++i) {
+            const candy_alloc_block *block = &allocator->blocks[i];
+            if (block->memory == VK_NULL_HANDLE ||
+                allocator->mem_props.memoryTypes[block->memory_type].heapIndex != heap) {
+                continue;
+            }
+
+            reserved += block->size;
+            allocated += block->allocated;
+            requested += block->requested;
+            block_count++;
+            allocation_count += block->allocation_count;
+
+            if (block->dedicated) {
+                continue;
+            }
+            for (uint32_t k = block->top_order + 1; k-- > 0;) {
+                if (block->free_count[k] > 0) {
+                    largest_free =
+                        std::max(largest_free, (VkDeviceSize)1 << (k + ALLOC_MIN_SHIFT));
+                    break;
+                }
+            }
+        }
+
+        if (block_count == 0) {
+            continue;
+        }
+
+        VkDeviceSize free_bytes = reserved - allocated;
+        // 0 when all free memory is one node, approaching 1 when it is scattered
+        double fragmentation =
+            free_bytes ? 1.0 - (double)largest_free / (double)free_bytes : 0.0;
+        // Bytes lost to rounding allocations up to a power of two
+        VkDeviceSize internal_waste = allocated - requested;
+
+        std::cout << "  heap " << heap << ": " << block_count << " blocks, "
+                  << allocation_count << " allocations, reserved " << reserved / 1024
+                  << " KiB, used " << requested / 1024 << " KiB, free "
+                  << free_bytes / 1024 << " KiB, rounding waste " << internal_waste / 1024
+                  << " KiB, fragmentation " << fragmentation * 100.0 << "%" << std::endl;
+    }
+}
@@ -0,0 +1,165 @@
+#include "candy_arena.h"
+
+#include <sys/mman.h>
+
+// ============================================================================
+// GAME STATE ARENA
+// ============================================================================
+
+static size_t candy_arena_round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Reserves the whole arena without backing it: PROT_NONE and MAP_NORESERVE cost
+// address space only, pages are committed per region as they are needed.
+void candy_init_arena(candy_context *ctx) {
+    candy_arena *arena = &ctx->game_module.arena;
+    *arena = {};
+
+    void *hint = (void *)ARENA_BASE_ADDRESS;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE;
+    void *base = mmap(hint, ARENA_RESERVE_SIZE, PROT_NONE, flags, -1, 0);
+
+    if (base == MAP_FAILED) {
+        // Something already lives at the base, anywhere works within one process
+        std::cerr << "[CANDY ARENA] Base address " << hint
+                  << " unavailable: " << strerror(errno) << std::endl;
+        flags &= ~MAP_FIXED_NOREPLACE;
+        base = mmap(nullptr, ARENA_RESERVE_SIZE, PROT_NONE, flags, -1, 0);
+    }
+    CANDY_ASSERT(base != MAP_FAILED, "Failed to reserve the game state arena");
+
+    // Kernels before 4.17 take MAP_FIXED_NOREPLACE as a plain hint
+    if (base != hint) {
+        std::cerr << "[CANDY ARENA] Arena mapped at " << base << " instead of " << hint
+                  << std::endl;
+    }
+
+    arena->base = (uint8_t *)base;
+    arena->reserved = ARENA_RESERVE_SIZE;
+
+    arena->regions[0] = {
+        .offset = 0,
+        .capacity = ARENA_STATE_CAPACITY,
+        .committed = 0,
+    };
+    arena->region_count = 1;
+    arena->next_offset = ARENA_STATE_CAPACITY;
+
+    std::cout << "[CANDY ARENA] Reserved " << (ARENA_RESERVE_SIZE >> 30) << " GiB at "
+              << base << std::endl;
+}
+
+void candy_destroy_arena(candy_context *ctx) {
+    candy_arena *arena = &ctx->game_module.arena;
+    if (arena->base) {
+        munmap(arena->base, arena->reserved);
+    }
+    *arena = {};
+}
+
+static candy_arena_region *candy_arena_find_region(candy_arena *arena, void *ptr) {
+    size_t offset = (uint8_t *)ptr - arena->base;
+    for (uint32_t i = 0; i < arena->region_count; ++i) {
+        if (arena->regions[i].offset == offset) {
+            return &arena->regions[i];
+        }
+    }
+    return nullptr;
+}
+
+// Commits are only ever grown, one mprotect per new high water mark
+static bool candy_arena_commit_region(candy_arena *arena, candy_arena_region *region,
+                                      size_t size) {
+    if (size <= region->committed) {
+        return true;
+    }
+    if (size > region->capacity) {
+        std::cerr << "[CANDY ARENA] " << size << " bytes exceed the region capacity of "
+                  << region->capacity << std::endl;
+        return false;
+    }
+
+    size_t target = std::min(candy_arena_round_up(size, ARENA_COMMIT_GRANULE),
+                             region->capacity);
+    uint8_t *begin = arena->base + region->offset + region->committed;
+    if (mprotect(begin, target - region->committed, PROT_READ | PROT_WRITE) != 0) {
+        std::cerr << "[CANDY ARENA] Failed to commit " << target - region->committed
+                  << " bytes: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    region->committed = target;
+    return true;
+}
+
+// The root state never moves, it grows and shrinks in place. Bytes past the old
+// size read as zero afterwards, also if an earlier larger state left data there.
+void *candy_arena_resize_state(candy_context *ctx, size_t size) {
+    candy_arena *arena = &ctx->game_module.arena;
+    candy_arena_region *root = &arena->regions[0];
+
+    if (!candy_arena_commit_region(arena, root, size)) {
+        return nullptr;
+    }
+
+    // Fresh pages come zeroed, only the part committed before has to be cleared
+    if (size > arena->state_size) {
+        size_t dirty_end = std::min(size, root->committed);
+        memset(arena->base + arena->state_size, 0, dirty_end - arena->state_size);
+    }
+
+    arena->state_size = size;
+    return arena->base;
+}
+
+// Hands out `capacity` bytes of address space that keep their address for the rest
+// of the process. Nothing is committed until candy_arena_commit.
+void *candy_arena_reserve(candy_context *ctx, size_t capacity) {
+    candy_arena *arena = &ctx->game_module.arena;
+
+    if (arena->region_count >= ARENA_MAX_REGIONS) {
+        std::cerr << "[CANDY ARENA] Out of regions (" << ARENA_MAX_REGIONS << ")"
+                  << std::endl;
+        return nullptr;
+    }
+
+    capacity = candy_arena_round_up(capacity, ARENA_COMMIT_GRANULE);
+    if (capacity == 0 || capacity > arena->reserved - arena->next_offset) {
+        std::cerr << "[CANDY ARENA] Cannot reserve " << capacity << " bytes, "
+                  << arena->reserved - arena->next_offset << " left" << std::endl;
+        return nullptr;
+    }
+
+    arena->regions[arena->region_count++] = {
+        .offset = arena->next_offset,
+        .capacity = capacity,
+        .committed = 0,
+    };
+    void *region = arena->base + arena->next_offset;
+    arena->next_offset += capacity;
+    return region;
+}
+
+// Makes the first `size` bytes of a region returned by candy_arena_reserve usable
+bool candy_arena_commit(candy_context *ctx, void *region, size_t size) {
+    candy_arena *arena = &ctx->game_module.arena;
+
+    candy_arena_region *found = candy_arena_find_region(arena, region);
+    if (!found || found == &arena->regions[0]) {
+        std::cerr << "[CANDY ARENA] " << region << " is not a reserved region"
+                  << std::endl;
+        return false;
+    }
+    return candy_arena_commit_region(arena, found, size);
+}
+
+size_t candy_arena_committed(candy_context *ctx) {
+    candy_arena *arena = &ctx->game_module.arena;
+
+    size_t committed = 0;
+    for (uint32_t i = 0; i < arena->region_count; ++i) {
+        committed += arena->regions[i].committed;
+    }
+    return committed;
+}
@@ -0,0 +1,102 @@
+#include "candy_client.h"
+
+#include <cstdlib>
+#include <iostream>
+
+// ============================================================================
+// CLIENT
+// ============================================================================
+
+// Sends at the tick rate, one packet per command; the server has to run at the same
+bool candy_client_connect(candy_client *client, candy_net_address address,
+                          float tick_rate, uint64_t now_ns) {
+    *client = {};
+    client->player = -1;
+    client->history = (candy_snapshot_history *)calloc(1, sizeof(candy_snapshot_history));
+    if (!client->history) {
+        std::cerr << "[CANDY CLIENT] Failed to allocate the snapshot history"
+                  << std::endl;
+        return false;
+    }
+    if (!candy_net_open(&client->endpoint, 0, 1, false, tick_rate)) {
+        free(client->history);
+        client->history = nullptr;
+        return false;
+    }
+    client->server = candy_net_connect(&client->endpoint, address, now_ns);
+    candy_predict_init(&client->predict, 1.0f / tick_rate);
+    client->active = true;
+
+    std::cout << "[CANDY CLIENT] Connecting to port " << address.port << " from port "
+              << client->endpoint.port << std::endl;
+    return true;
+}
+
+void candy_client_close(candy_client *client) {
+    if (!client->active) {
+        return;
+    }
+    std::cout << "[CANDY CLIENT] " << client->snapshots_received << " snapshots, "
+              << client->snapshots_failed << " failed to decode, "
+              << client->predict.corrections << " prediction corrections" << std::endl;
+    candy_net_close(&client->endpoint);
+    free(client->history);
+    *client = {};
+}
+
+// Takes in the newest server packet: the ack moves the prediction, the snapshot
+// after it everyone else. The ack is read even when the snapshot fails to decode.
+static void candy_client_receive(candy_client *client) {
+    uint8_t data[NET_MAX_PACKET];
+    uint32_t size = candy_net_receive_snapshot(client->server, data, sizeof(data));
+    candy_match_ack ack;
+    if (!candy_match_read_ack(data, size, &ack)) {
+        return;
+    }
+    client->player = ack.player;
+    candy_predict_reconcile(&client->predict, ack.input_tick, &ack.motion);
+
+    uint32_t newest = client->snapshot ? client->snapshot->tick : MATCH_NO_TICK;
+    const candy_snapshot *snapshot = candy_snapshot_decode(
+        data + MATCH_ACK_SIZE, size - MATCH_ACK_SIZE, client->history);
+    if (snapshot) {
+        client->snapshots_received++;
+        client->snapshot = snapshot;
+        client->snapshot_arrival_ns = client->server->receive_snapshot_ns;
+    } else {
+        // Decoding may have cleared the slot the newest one was in
+        client->snapshots_failed++;
+        client->snapshot = newest != MATCH_NO_TICK
+                               ? candy_snapshot_history_find(client->history, newest)
+                               : nullptr;
+    }
+}
+
+// One fixed step: reconcile with whatever came in, predict this tick's command and
+// send it along with the ones before it
+void candy_client_tick(candy_client *client, uint8_t buttons, float dt, uint64_t now_ns) {
+    candy_predict *predict = &client->predict;
+    if (dt != predict->params.dt) {
+        predict->params = candy_match_integrate_params(dt);
+        predict->keep = candy_integrate_keep(&predict->params);
+    }
+
+    candy_net_receive(&client->endpoint, now_ns);
+    if (client->server->connected) {
+        candy_client_receive(client);
+    } else {
+        // Timed out. There is no handshake, sending again is all it takes.
+        client->server =
+            candy_net_connect(&client->endpoint, client->server->address, now_ns);
+    }
+
+    candy_predict_command(predict, buttons);
+
+    candy_match_input input;
+    input.acked_tick = client->snapshot ? client->snapshot->tick : MATCH_NO_TICK;
+    candy_predict_fill_input(predict, &input);
+    uint8_t data[MATCH_INPUT_MAX_SIZE];
+    uint32_t size = candy_match_write_input(&input, data);
+    candy_net_set_snapshot(client->server, data, size);
+    candy_net_send(&client->endpoint, now_ns);
+}
@@ -0,0 +1,315 @@
+#include "candy_culling.h"
+
+#include <cmath>
+
+// ============================================================================
+// GPU CULLING
+// ============================================================================
+
+constexpr uint32_t CULL_GROUP_SIZE = 64; // local_size_x in cull.comp
+
+static void candy_create_culling_descriptors(candy_context *ctx) {
+    VkDescriptorSetLayoutBinding bindings[3];
+    for (uint32_t i = 0; i < 3; ++i) {
+        bindings[i] = {
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr,
+        };
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .bindingCount = 3,
+        .pBindings = bindings,
+    };
+
+    VkResult result = vkCreateDescriptorSetLayout(ctx->core.logical_device, &layout_info,
+                                                  nullptr, &ctx->culling.set_layout);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create culling set layout");
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 3 * MAX_FRAME_IN_FLIGHT,
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .maxSets = MAX_FRAME_IN_FLIGHT,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+    };
+
+    result = vkCreateDescriptorPool(ctx->core.logical_device, &pool_info, nullptr,
+                                    &ctx->culling.descriptor_pool);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create culling descriptor pool");
+
+    VkDescriptorSetLayout layouts[MAX_FRAME_IN_FLIGHT];
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        layouts[i] = ctx->culling.set_layout;
+    }
+
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = nullptr,
+        .descriptorPool = ctx->culling.descriptor_pool,
+        .descriptorSetCount = MAX_FRAME_IN_FLIGHT,
+        .pSetLayouts = layouts,
+    };
+
+    result = vkAllocateDescriptorSets(ctx->core.logical_device, &alloc_info,
+                                      ctx->culling.descriptor_sets);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to allocate culling descriptor sets");
+
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        VkDescriptorBufferInfo buffer_infos[3] = {
+            {ctx->instances.buffers[i], 0, VK_WHOLE_SIZE},
+            {ctx->culling.draw_buffers[i], 0, VK_WHOLE_SIZE},
+            {ctx->culling.count_buffers[i], 0, VK_WHOLE_SIZE},
+        };
+
+        VkWriteDescriptorSet writes[3];
+        for (uint32_t b = 0; b < 3; ++b) {
+            writes[b] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = nullptr,
+                .dstSet = ctx->culling.descriptor_sets[i],
+                .dstBinding = b,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pImageInfo = nullptr,
+                .pBufferInfo = &buffer_infos[b],
+                .pTexelBufferView = nullptr,
+            };
+        }
+        vkUpdateDescriptorSets(ctx->core.logical_device, 3, writes, 0, nullptr);
+    }
+}
+
+static void candy_create_culling_pipeline(candy_context *ctx) {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(candy_cull_push_constants),
+    };
+
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .setLayoutCount = 1,
+        .pSetLayouts = &ctx->culling.set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+
+    VkResult result = vkCreatePipelineLayout(ctx->core.logical_device, &layout_info,
+                                             nullptr, &ctx->culling.pipeline_layout);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create culling pipeline layout");
+
+    std::vector<char> shader_code =
+        candy_read_shader_file("../src/shaders/cull.comp.spv");
+    VkShaderModule shader_module =
+        candy_create_shader_module(shader_code, ctx->core.logical_device);
+
+    VkComputePipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .stage =
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = shader_module,
+                .pName = "main",
+                .pSpecializationInfo = nullptr,
+            },
+        .layout = ctx->culling.pipeline_layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+
+    result = vkCreateComputePipelines(ctx->core.logical_device, ctx->pipeline.cache, 1,
+                                      &pipeline_info, nullptr, &ctx->culling.pipeline);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create culling pipeline");
+
+    vkDestroyShaderModule(ctx->core.logical_device, shader_module, nullptr);
+}
+
+void candy_init_gpu_culling(candy_context *ctx) {
+    ctx->culling.enabled = false;
+
+    if (!ctx->config.enable_gpu_culling) {
+        std::cout << "[CANDY] GPU culling disabled" << std::endl;
+        return;
+    }
+    // Every indirect command draws instance `firstInstance`, so this is a must
+    if (!ctx->core.has_draw_indirect_first_instance) {
+        std::cout << "[CANDY] drawIndirectFirstInstance unsupported, GPU culling off"
+                  << std::endl;
+        return;
+    }
+
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        candy_create_buffer(ctx, sizeof(VkDrawIndexedIndirectCommand) * MAX_INSTANCES,
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &ctx->culling.draw_buffers[i], &ctx->culling.draw_allocs[i]);
+        candy_create_buffer(ctx, sizeof(uint32_t),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            &ctx->culling.count_buffers[i],
+                            &ctx->culling.count_allocs[i]);
+    }
+
+    candy_create_culling_descriptors(ctx);
+    candy_create_culling_pipeline(ctx);
+
+    if (ctx->core.has_draw_indirect_count) {
+        ctx->culling.cmd_draw_indexed_indirect_count =
+            (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(
+                ctx->core.logical_device, "vkCmdDrawIndexedIndirectCountKHR");
+    }
+
+    ctx->culling.bound_radius = 0.0f;
+    for (const candy_vertex &vertex : vertices) {
+        ctx->culling.bound_radius =
+            std::max(ctx->culling.bound_radius, glm::length(vertex.pos));
+    }
+
+    // Clip space of the current 2D setup: x, y in [-1, 1], z in [0, 1]
+    ctx->culling.frustum_planes[0] = {1.0f, 0.0f, 0.0f, 1.0f};
+    ctx->culling.frustum_planes[1] = {-1.0f, 0.0f, 0.0f, 1.0f};
+    ctx->culling.frustum_planes[2] = {0.0f, 1.0f, 0.0f, 1.0f};
+    ctx->culling.frustum_planes[3] = {0.0f, -1.0f, 0.0f, 1.0f};
+    ctx->culling.frustum_planes[4] = {0.0f, 0.0f, 1.0f, 0.0f};
+    ctx->culling.frustum_planes[5] = {0.0f, 0.0f, -1.0f, 1.0f};
+
+    ctx->culling.enabled = true;
+
+    const char *mode = ctx->culling.cmd_draw_indexed_indirect_count
+                           ? "vkCmdDrawIndexedIndirectCount"
+                       : ctx->core.has_multi_draw_indirect ? "multi-draw indirect"
+                                                           : "single indirect draws";
+    std::cout << "[CANDY] GPU culling enabled (" << mode << ")" << std::endl;
+}
+
+void candy_destroy_gpu_culling(candy_context *ctx) {
+    if (!ctx->culling.enabled) {
+        return;
+    }
+
+    vkDestroyPipeline(ctx->core.logical_device, ctx->culling.pipeline, nullptr);
+    vkDestroyPipelineLayout(ctx->core.logical_device, ctx->culling.pipeline_layout,
+                            nullptr);
+    vkDestroyDescriptorPool(ctx->core.logical_device, ctx->culling.descriptor_pool,
+                            nullptr);
+    vkDestroyDescriptorSetLayout(ctx->core.logical_device, ctx->culling.set_layout,
+                                 nullptr);
+
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        candy_destroy_buffer(ctx, ctx->culling.draw_buffers[i],
+                             &ctx->culling.draw_allocs[i]);
+        candy_destroy_buffer(ctx, ctx->culling.count_buffers[i],
+                             &ctx->culling.count_allocs[i]);
+    }
+
+    ctx->culling.enabled = false;
+}
+
+// Recorded before the main render pass. With the count path the shader appends
+// visible draws and bumps the count; otherwise it writes one command per object
+// with instanceCount 0 for culled objects.
+void candy_record_gpu_culling(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                              uint32_t frame) {
+    bool compact = ctx->culling.cmd_draw_indexed_indirect_count != nullptr;
+
+    vkCmdFillBuffer(cmd_buffer, ctx->culling.count_buffers[frame], 0, sizeof(uint32_t),
+                    0);
+
+    VkMemoryBarrier fill_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fill_barrier, 0,
+                         nullptr, 0, nullptr);
+
+    candy_cull_push_constants push = {};
+    for (uint32_t i = 0; i < 6; ++i) {
+        push.planes[i] = ctx->culling.frustum_planes[i];
+    }
+    push.object_count = ctx->instances.count;
+    push.index_count = (uint32_t)indices.size();
+    push.compact = compact ? 1 : 0;
+    push.bound_radius = ctx->culling.bound_radius;
+
+    vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, ctx->culling.pipeline);
+    vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            ctx->culling.pipeline_layout, 0, 1,
+                            &ctx->culling.descriptor_sets[frame], 0, nullptr);
+    vkCmdPushConstants(cmd_buffer, ctx->culling.pipeline_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmd_buffer, (push.object_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE,
+                  1, 1);
+
+    VkMemoryBarrier draw_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &draw_barrier, 0,
+                         nullptr, 0, nullptr);
+}
+
+// Recorded inside the main render pass, with the graphics pipeline and the vertex and
+// instance buffers already bound. Draws the commands of objects
+// [first_object, first_object + object_count); the count path always draws them all.
+void candy_record_indirect_draws(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                 uint32_t frame, uint32_t first_object,
+                                 uint32_t object_count) {
+    constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    uint32_t end = first_object + object_count;
+
+    vkCmdBindIndexBuffer(cmd_buffer, ctx->core.index_buffer, 0, VK_INDEX_TYPE_UINT16);
+
+    if (ctx->culling.cmd_draw_indexed_indirect_count) {
+        ctx->culling.cmd_draw_indexed_indirect_count(
+            cmd_buffer, ctx->culling.draw_buffers[frame], 0,
+            ctx->culling.count_buffers[frame], 0,
+            std::min(ctx->instances.count, ctx->core.max_draw_indirect_count), stride);
+        return;
+    }
+
+    if (ctx->core.has_multi_draw_indirect) {
+        uint32_t max_draws = ctx->core.max_draw_indirect_count;
+        for (uint32_t first = first_object; first < end; first += max_draws) {
+            vkCmdDrawIndexedIndirect(cmd_buffer, ctx->culling.draw_buffers[frame],
+                                     (VkDeviceSize)first * stride,
+                                     std::min(end - first, max_draws), stride);
+        }
+        return;
+    }
+
+    // No multiDrawIndirect: drawCount must be 1
+    for (uint32_t i = first_object; i < end; ++i) {
+        vkCmdDrawIndexedIndirect(cmd_buffer, ctx->culling.draw_buffers[frame],
+                                 (VkDeviceSize)i * stride, 1, stride);
+    }
+}
@@ -0,0 +1,466 @@
+#include "candy_entity.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// ============================================================================
+// ENTITY STORE
+// ============================================================================
+
+static const candy_state_field candy_entity_fields[] = {
+    CANDY_FIELD(candy_entity, slot),
+    CANDY_FIELD(candy_entity, generation),
+};
+
+extern const candy_state_layout candy_entity_layout =
+    CANDY_LAYOUT(candy_entity, candy_entity_fields);
+
+static const candy_state_field candy_entity_store_fields[] = {
+    CANDY_FIELD(candy_entity_store, count),
+    CANDY_FIELD(candy_entity_store, free_slot),
+    CANDY_FIELD(candy_entity_store, slot_count),
+    CANDY_FIELD(candy_entity_store, capacity),
+    CANDY_FIELD(candy_entity_store, px),
+    CANDY_FIELD(candy_entity_store, py),
+    CANDY_FIELD(candy_entity_store, pz),
+    CANDY_FIELD(candy_entity_store, vx),
+    CANDY_FIELD(candy_entity_store, vy),
+    CANDY_FIELD(candy_entity_store, vz),
+    CANDY_FIELD(candy_entity_store, prev_x),
+    CANDY_FIELD(candy_entity_store, prev_y),
+    CANDY_FIELD(candy_entity_store, prev_z),
+    CANDY_FIELD(candy_entity_store, dense_slot),
+    CANDY_FIELD(candy_entity_store, slot_dense),
+    CANDY_FIELD(candy_entity_store, slot_generation),
+};
+
+extern const candy_state_layout candy_entity_store_layout =
+    CANDY_LAYOUT(candy_entity_store, candy_entity_store_fields);
+
+constexpr uint32_t ENTITY_FLOAT_COLUMNS = 9;
+constexpr uint32_t ENTITY_UINT_COLUMNS = 3;
+
+// Rows a store asked for capacity really gets: padded to whole vectors, at most
+// ENTITY_CAPACITY
+uint32_t candy_entity_capacity(uint32_t capacity) {
+    capacity = std::min(std::max(capacity, 1u), ENTITY_CAPACITY);
+    return (capacity + ENTITY_SIMD_WIDTH - 1) & ~(ENTITY_SIMD_WIDTH - 1);
+}
+
+// Memory candy_entity_store_init needs for capacity rows. Every column is a whole
+// number of cache lines, so columns carved one after another stay aligned.
+size_t candy_entity_store_bytes(uint32_t capacity) {
+    capacity = candy_entity_capacity(capacity);
+    return (size_t)capacity * (ENTITY_FLOAT_COLUMNS * sizeof(float) +
+                               ENTITY_UINT_COLUMNS * sizeof(uint32_t));
+}
+
+// Carves the columns out of memory, candy_entity_store_bytes(capacity) bytes aligned
+// to 64, which must outlive the store. Only the bookkeeping is reset, columns are
+// written as entities are created.
+void candy_entity_store_init(candy_entity_store *store, uint32_t capacity, void *memory) {
+    capacity = candy_entity_capacity(capacity);
+    store->count = 0;
+    store->free_slot = ENTITY_INVALID;
+    store->slot_count = 0;
+    store->capacity = capacity;
+
+    float *f = (float *)memory;
+    float **floats[ENTITY_FLOAT_COLUMNS] = {
+        &store->px,     &store->py,     &store->pz,     &store->vx,     &store->vy,
+        &store->vz,     &store->prev_x, &store->prev_y, &store->prev_z,
+    };
+    for (uint32_t i = 0; i < ENTITY_FLOAT_COLUMNS; ++i) {
+        *floats[i] = f;
+        f += capacity;
+    }
+
+    uint32_t *u = (uint32_t *)f;
+    uint32_t **uints[ENTITY_UINT_COLUMNS] = {
+        &store->dense_slot,
+        &store->slot_dense,
+        &store->slot_generation,
+    };
+    for (uint32_t i = 0; i < ENTITY_UINT_COLUMNS; ++i) {
+        *uints[i] = u;
+        u += capacity;
+    }
+}
+
+// Returns a zeroed entity at the end of the dense range, or a null handle when full
+candy_entity candy_entity_create(candy_entity_store *store) {
+    if (store->count >= store->capacity) {
+        return {};
+    }
+
+    uint32_t slot;
+    if (store->free_slot != ENTITY_INVALID) {
+        slot = store->free_slot;
+        store->free_slot = store->slot_dense[slot];
+    } else {
+        slot = store->slot_count++;
+        store->slot_generation[slot] = 0;
+    }
+
+    // Skips 0 on wrap around, which marks null handles
+    uint32_t generation = store->slot_generation[slot] + 1;
+    store->slot_generation[slot] = generation ? generation : 1;
+
+    uint32_t index = store->count++;
+    store->slot_dense[slot] = index;
+    store->dense_slot[index] = slot;
+
+    store->px[index] = store->py[index] = store->pz[index] = 0.0f;
+    store->vx[index] = store->vy[index] = store->vz[index] = 0.0f;
+    store->prev_x[index] = store->prev_y[index] = store->prev_z[index] = 0.0f;
+
+    return {.slot = slot, .generation = store->slot_generation[slot]};
+}
+
+// Dense index of a live entity, ENTITY_INVALID for stale or null handles. Only valid
+// until the next destroy.
+uint32_t candy_entity_index(const candy_entity_store *store, candy_entity entity) {
+    if (entity.slot >= store->slot_count || entity.generation == 0 ||
+        store->slot_generation[entity.slot] != entity.generation) {
+        return ENTITY_INVALID;
+    }
+    return store->slot_dense[entity.slot];
+}
+
+// Removes an entity by moving the last one into its place. The store's columns are
+// moved here; a game keeping its own columns by dense index must do the same move,
+// from *moved_from to *moved_to (equal when the last entity itself was removed).
+bool candy_entity_destroy(candy_entity_store *store, candy_entity entity,
+                          uint32_t *moved_from, uint32_t *moved_to) {
+    uint32_t index = candy_entity_index(store, entity);
+    if (index == ENTITY_INVALID) {
+        return false;
+    }
+
+    uint32_t last = --store->count;
+    if (index != last) {
+        store->px[index] = store->px[last];
+        store->py[index] = store->py[last];
+        store->pz[index] = store->pz[last];
+        store->vx[index] = store->vx[last];
+        store->vy[index] = store->vy[last];
+        store->vz[index] = store->vz[last];
+        store->prev_x[index] = store->prev_x[last];
+        store->prev_y[index] = store->prev_y[last];
+        store->prev_z[index] = store->prev_z[last];
+
+        uint32_t moved_slot = store->dense_slot[last];
+        store->dense_slot[index] = moved_slot;
+        store->slot_dense[moved_slot] = index;
+    }
+
+    // Bumping the generation invalidates every handle to the slot
+    store->slot_generation[entity.slot]++;
+    store->slot_dense[entity.slot] = store->free_slot;
+    store->free_slot = entity.slot;
+
+    if (moved_from) {
+        *moved_from = last;
+    }
+    if (moved_to) {
+        *moved_to = index;
+    }
+    return true;
+}
+
+// ============================================================================
+// INTEGRATION KERNELS
+// ============================================================================
+
+// Every kernel does the same per axis: save the position for interpolation, damp the
+// velocity, move, clamp into the bounds and stop on the clamped axis. There is no
+// FMA, so all levels give the same bits and the choice never changes the simulation.
+// Kernels run over count rounded up to whole vectors of the padded columns.
+
+struct candy_integrate_axis {
+    float *__restrict p;
+    float *__restrict v;
+    float *__restrict prev;
+    float lo;
+    float hi;
+};
+
+typedef void (*candy_integrate_kernel)(const candy_integrate_axis *axis, uint32_t count,
+                                       float dt, float keep);
+
+static void candy_integrate_scalar(const candy_integrate_axis *axis, uint32_t count,
+                                   float dt, float keep) {
+    float *__restrict p = axis->p;
+    float *__restrict v = axis->v;
+    float *__restrict prev = axis->prev;
+
+    // Kept scalar so it stays the baseline the benchmark compares against
+#if defined(__clang__)
+#pragma clang loop vectorize(disable) interleave(disable)
+#endif
+    for (uint32_t i = 0; i < count; ++i) {
+        float pos = p[i];
+        prev[i] = pos;
+        float vel = v[i] * keep;
+        pos += vel * dt;
+        float clamped = std::min(std::max(pos, axis->lo), axis->hi);
+        v[i] = clamped == pos ? vel : 0.0f;
+        p[i] = clamped;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static void candy_integrate_sse(const candy_integrate_axis *axis, uint32_t count,
+                                float dt, float keep) {
+    __m128 vdt = _mm_set1_ps(dt);
+    __m128 vkeep = _mm_set1_ps(keep);
+    __m128 lo = _mm_set1_ps(axis->lo);
+    __m128 hi = _mm_set1_ps(axis->hi);
+
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128 pos = _mm_load_ps(axis->p + i);
+        _mm_store_ps(axis->prev + i, pos);
+        __m128 vel = _mm_mul_ps(_mm_load_ps(axis->v + i), vkeep);
+        pos = _mm_add_ps(pos, _mm_mul_ps(vel, vdt));
+        __m128 clamped = _mm_min_ps(_mm_max_ps(pos, lo), hi);
+        vel = _mm_and_ps(vel, _mm_cmpeq_ps(clamped, pos));
+        _mm_store_ps(axis->v + i, vel);
+        _mm_store_ps(axis->p + i, clamped);
+    }
+}
+
+__attribute__((target("avx2"))) static void
+candy_integrate_avx2(const candy_integrate_axis *axis, uint32_t count, float dt,
+                     float keep) {
+    __m256 vdt = _mm256_set1_ps(dt);
+    __m256 vkeep = _mm256_set1_ps(keep);
+    __m256 lo = _mm256_set1_ps(axis->lo);
+    __m256 hi = _mm256_set1_ps(axis->hi);
+
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256 pos = _mm256_load_ps(axis->p + i);
+        _mm256_store_ps(axis->prev + i, pos);
+        __m256 vel = _mm256_mul_ps(_mm256_load_ps(axis->v + i), vkeep);
+        pos = _mm256_add_ps(pos, _mm256_mul_ps(vel, vdt));
+        __m256 clamped = _mm256_min_ps(_mm256_max_ps(pos, lo), hi);
+        vel = _mm256_and_ps(vel, _mm256_cmp_ps(clamped, pos, _CMP_EQ_OQ));
+        _mm256_store_ps(axis->v + i, vel);
+        _mm256_store_ps(axis->p + i, clamped);
+    }
+}
+
+#endif
+
+static const candy_integrate_kernel candy_integrate_kernels[CANDY_SIMD_LEVEL_COUNT] = {
+    candy_integrate_scalar,
+#if defined(__x86_64__) || defined(__i386__)
+    candy_integrate_sse,
+    candy_integrate_avx2,
+#else
+    candy_integrate_scalar,
+    candy_integrate_scalar,
+#endif
+};
+
+static const char *candy_simd_level_names[CANDY_SIMD_LEVEL_COUNT] = {
+    "scalar",
+    "sse",
+    "avx2",
+};
+
+static candy_simd_level candy_simd_query() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        return CANDY_SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return CANDY_SIMD_SSE;
+    }
+#endif
+    return CANDY_SIMD_SCALAR;
+}
+
+// Best level this CPU runs, looked up once
+candy_simd_level candy_simd_detect() {
+    static const candy_simd_level level = candy_simd_query();
+    return level;
+}
+
+const char *candy_simd_level_name(candy_simd_level level) {
+    return level < CANDY_SIMD_LEVEL_COUNT ? candy_simd_level_names[level] : "unknown";
+}
+
+void candy_entity_integrate_level(candy_entity_store *store,
+                                  const candy_integrate_params *params,
+                                  candy_simd_level level) {
+    uint32_t count = (store->count + ENTITY_SIMD_WIDTH - 1) & ~(ENTITY_SIMD_WIDTH - 1);
+    if (count == 0) {
+        return;
+    }
+
+    level = std::min(level, candy_simd_detect());
+    candy_integrate_kernel kernel = candy_integrate_kernels[level];
+    float keep = candy_integrate_keep(params);
+
+    float *p[3] = {store->px, store->py, store->pz};
+    float *v[3] = {store->vx, store->vy, store->vz};
+    float *prev[3] = {store->prev_x, store->prev_y, store->prev_z};
+
+    // One axis at a time: each pass streams three columns, as many as a fused loop
+    for (uint32_t i = 0; i < 3; ++i) {
+        candy_integrate_axis axis = {
+            .p = p[i],
+            .v = v[i],
+            .prev = prev[i],
+            .lo = params->bounds_min[i],
+            .hi = params->bounds_max[i],
+        };
+        kernel(&axis, count, params->dt, keep);
+    }
+}
+
+// Saves the positions for interpolation and moves every entity by its velocity, with
+// the widest kernel the CPU supports
+void candy_entity_integrate(candy_entity_store *store,
+                            const candy_integrate_params *params) {
+    candy_entity_integrate_level(store, params, candy_simd_detect());
+}
+
+// Velocity kept over one step, the factor every kernel is given
+float candy_integrate_keep(const candy_integrate_params *params) {
+    return std::exp(-std::max(params->damping, 0.0f) * params->dt);
+}
+
+// One entity held outside a store, through the scalar kernel, so it moves by the
+// same bits candy_entity_integrate would move it. keep is candy_integrate_keep of
+// params, taken once by callers that step many times.
+void candy_entity_integrate_one(float p[3], float v[3],
+                                const candy_integrate_params *params, float keep) {
+    for (uint32_t i = 0; i < 3; ++i) {
+        float prev;
+        candy_integrate_axis axis = {
+            .p = &p[i],
+            .v = &v[i],
+            .prev = &prev,
+            .lo = params->bounds_min[i],
+            .hi = params->bounds_max[i],
+        };
+        candy_integrate_scalar(&axis, 1, params->dt, keep);
+    }
+}
+
+// ============================================================================
+// INTEGRATION BENCHMARK
+// ============================================================================
+
+static void candy_bench_integrate_setup(candy_entity_store *store, uint32_t count,
+                                        void *memory) {
+    candy_entity_store_init(store, count, memory);
+
+    // Fixed seed, so every level starts from the same entities
+    uint32_t seed = 0x9e3779b9u;
+    auto next = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return (float)(seed & 0xffffff) / (float)0x1000000 * 2.0f - 1.0f;
+    };
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t index = candy_entity_index(store, candy_entity_create(store));
+        store->px[index] = next();
+        store->py[index] = next();
+        store->vx[index] = next() * 4.0f;
+        store->vy[index] = next() * 4.0f;
+    }
+}
+
+// Runs every level this CPU supports over count entities on the calling thread and
+// prints entities per second per core, after checking the levels agree bit for bit
+void candy_entity_bench_integrate(uint32_t count) {
+    using clock = std::chrono::steady_clock;
+
+    count = std::min(std::max(count, 1u), ENTITY_CAPACITY);
+    size_t bytes = candy_entity_store_bytes(count);
+    void *memory = aligned_alloc(64, bytes);
+    void *reference_memory = aligned_alloc(64, bytes);
+    if (!memory || !reference_memory) {
+        std::cerr << "[CANDY BENCH] Failed to allocate the entity stores" << std::endl;
+        free(memory);
+        free(reference_memory);
+        return;
+    }
+    // Same capacity, so the reference columns sit at the same offsets and a copy of
+    // the memory is a copy of the store
+    candy_entity_store store_data;
+    candy_entity_store reference_data;
+    candy_entity_store *store = &store_data;
+    candy_entity_store *reference = &reference_data;
+    candy_entity_store_init(reference, count, reference_memory);
+
+    const candy_integrate_params params = {
+        .dt = 1.0f / 60.0f,
+        .damping = 0.5f,
+        .bounds_min = {-1.0f, -1.0f, -1.0f},
+        .bounds_max = {1.0f, 1.0f, 1.0f},
+    };
+    candy_simd_level best = candy_simd_detect();
+    double scalar_rate = 0.0;
+
+    std::cout << "[CANDY BENCH] Integrating " << count << " entities, best level "
+              << candy_simd_level_name(best) << std::endl;
+
+    for (uint32_t i = CANDY_SIMD_SCALAR; i <= (uint32_t)best; ++i) {
+        candy_simd_level level = (candy_simd_level)i;
+        const char *name = candy_simd_level_name(level);
+
+        candy_bench_integrate_setup(store, count, memory);
+        for (uint32_t tick = 0; tick < 64; ++tick) {
+            candy_entity_integrate_level(store, &params, level);
+        }
+
+        if (level == CANDY_SIMD_SCALAR) {
+            memcpy(reference_memory, memory, bytes);
+        } else if (memcmp(reference->px, store->px, sizeof(float) * count) != 0 ||
+                   memcmp(reference->vx, store->vx, sizeof(float) * count) != 0 ||
+                   memcmp(reference->py, store->py, sizeof(float) * count) != 0 ||
+                   memcmp(reference->vy, store->vy, sizeof(float) * count) != 0) {
+            std::cerr << "[CANDY BENCH] " << name << " differs from the scalar kernel"
+                      << std::endl;
+        }
+
+        // Batches of 64 ticks until a quarter second passed. Each batch starts over,
+        // before damping can slow the kernel down with denormal velocities.
+        uint64_t ticks = 0;
+        double seconds = 0.0;
+        while (seconds < 0.25) {
+            candy_bench_integrate_setup(store, count, memory);
+            clock::time_point start = clock::now();
+            for (uint32_t tick = 0; tick < 64; ++tick) {
+                candy_entity_integrate_level(store, &params, level);
+            }
+            seconds += std::chrono::duration<double>(clock::now() - start).count();
+            ticks += 64;
+        }
+
+        double rate = (double)ticks * count / seconds;
+        if (level == CANDY_SIMD_SCALAR) {
+            scalar_rate = rate;
+        }
+        std::cout << "[CANDY BENCH] " << name << ": " << rate / 1e6
+                  << " M entities/s/core, " << 1e9 / rate << " ns/entity, "
+                  << rate / scalar_rate << "x scalar" << std::endl;
+    }
+
+    free(memory);
+    free(reference_memory);
+}
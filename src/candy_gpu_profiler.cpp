@@ -0,0 +1,189 @@
+#include "candy_gpu_profiler.h"
+
+// ============================================================================
+// GPU PROFILER
+// ============================================================================
+
+// Each scope owns a begin and an end query
+constexpr uint32_t GPU_QUERY_COUNT = CANDY_GPU_SCOPE_COUNT * 2;
+
+void candy_init_gpu_profiler(candy_context *ctx) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    *profiler = {};
+
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(ctx->core.physical_device, &device_props);
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->core.physical_device, &family_count,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->core.physical_device, &family_count,
+                                             families.data());
+
+    uint32_t valid_bits = families[ctx->core.graphics_queue_family].timestampValidBits;
+    if (valid_bits == 0 || device_props.limits.timestampPeriod == 0.0f) {
+        std::cout << "[CANDY] GPU timestamps not supported, GPU profiler disabled\n";
+        return;
+    }
+
+    profiler->timestamp_period = device_props.limits.timestampPeriod;
+    profiler->timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        VkQueryPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = GPU_QUERY_COUNT,
+            .pipelineStatistics = 0,
+        };
+
+        VkResult result = vkCreateQueryPool(ctx->core.logical_device, &pool_info, nullptr,
+                                            &profiler->query_pools[i]);
+        CANDY_ASSERT(result == VK_SUCCESS, "Failed to create timestamp query pool");
+    }
+
+    profiler->enabled = true;
+}
+
+void candy_destroy_gpu_profiler(candy_context *ctx) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        vkDestroyQueryPool(ctx->core.logical_device, profiler->query_pools[i], nullptr);
+    }
+    profiler->enabled = false;
+}
+
+// Called once the frame's fence has signalled. Queries of scopes that were skipped
+// that frame stay unavailable, so availability is read alongside the values instead
+// of waiting on them.
+void candy_gpu_profiler_collect(candy_context *ctx, uint32_t frame) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (!profiler->enabled || !profiler->pool_written[frame]) {
+        return;
+    }
+    profiler->pool_written[frame] = false;
+
+    // (value, availability) pairs
+    uint64_t results[GPU_QUERY_COUNT][2];
+    VkResult result = vkGetQueryPoolResults(
+        ctx->core.logical_device, profiler->query_pools[frame], 0, GPU_QUERY_COUNT,
+        sizeof(results), results, sizeof(results[0]),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+        return;
+    }
+
+    uint32_t head = profiler->history_head;
+    for (uint32_t s = 0; s < CANDY_GPU_SCOPE_COUNT; ++s) {
+        uint64_t *begin = results[s * 2];
+        uint64_t *end = results[s * 2 + 1];
+
+        float ms = 0.0f;
+        if (profiler->scope_written[frame][s] && begin[1] && end[1]) {
+            uint64_t ticks = (end[0] - begin[0]) & profiler->timestamp_mask;
+            ms = (float)((double)ticks * profiler->timestamp_period / 1e6);
+            profiler->total_ms[s] += ms;
+            profiler->total_samples[s]++;
+        }
+        profiler->history[s][head] = ms;
+    }
+
+    profiler->history_head = (head + 1) % GPU_PROFILER_HISTORY;
+    if (profiler->history_count < GPU_PROFILER_HISTORY) {
+        profiler->history_count++;
+    }
+}
+
+// Must be recorded outside a render pass, before any scope of the frame
+void candy_gpu_profiler_begin_frame(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                    uint32_t frame) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+
+    vkCmdResetQueryPool(cmd_buffer, profiler->query_pools[frame], 0, GPU_QUERY_COUNT);
+    for (uint32_t s = 0; s < CANDY_GPU_SCOPE_COUNT; ++s) {
+        profiler->scope_written[frame][s] = false;
+    }
+    profiler->pool_written[frame] = true;
+
+    candy_gpu_scope_begin(ctx, cmd_buffer, frame, CANDY_GPU_SCOPE_FRAME);
+}
+
+void candy_gpu_profiler_end_frame(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                  uint32_t frame) {
+    candy_gpu_scope_end(ctx, cmd_buffer, frame, CANDY_GPU_SCOPE_FRAME);
+}
+
+void candy_gpu_scope_begin(candy_context *ctx, VkCommandBuffer cmd_buffer, uint32_t frame,
+                           candy_gpu_scope scope) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+
+    vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        profiler->query_pools[frame], scope * 2);
+}
+
+void candy_gpu_scope_end(candy_context *ctx, VkCommandBuffer cmd_buffer, uint32_t frame,
+                         candy_gpu_scope scope) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+
+    vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        profiler->query_pools[frame], scope * 2 + 1);
+    profiler->scope_written[frame][scope] = true;
+}
+
+const char *candy_gpu_scope_name(candy_gpu_scope scope) {
+    switch (scope) {
+    case CANDY_GPU_SCOPE_CULLING:
+        return "Culling";
+    case CANDY_GPU_SCOPE_SCENE:
+        return "Scene";
+    case CANDY_GPU_SCOPE_IMGUI:
+        return "ImGui";
+    case CANDY_GPU_SCOPE_FRAME:
+        return "Frame";
+    default:
+        return "Unknown";
+    }
+}
+
+float candy_gpu_scope_ms(candy_context *ctx, candy_gpu_scope scope) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (scope >= CANDY_GPU_SCOPE_COUNT || profiler->history_count == 0) {
+        return 0.0f;
+    }
+
+    uint32_t latest = (profiler->history_head + GPU_PROFILER_HISTORY - 1) %
+                      GPU_PROFILER_HISTORY;
+    return profiler->history[scope][latest];
+}
+
+uint32_t candy_gpu_scope_history(candy_context *ctx, candy_gpu_scope scope, float *out,
+                                 uint32_t max_count) {
+    candy_gpu_profiler *profiler = &ctx->gpu_profiler;
+    if (scope >= CANDY_GPU_SCOPE_COUNT) {
+        return 0;
+    }
+
+    uint32_t count = std::min(profiler->history_count, max_count);
+    uint32_t first = (profiler->history_head + GPU_PROFILER_HISTORY - count) %
+                     GPU_PROFILER_HISTORY;
+    for (uint32_t i = 0; i < count; ++i) {
+        out[i] = profiler->history[scope][(first + i) % GPU_PROFILER_HISTORY];
+    }
+    return count;
+}
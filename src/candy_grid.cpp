@@ -0,0 +1,218 @@
+#include "candy_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// ============================================================================
+// SPATIAL HASH GRID
+// ============================================================================
+
+// Clamped so far away or broken positions still land in some cell. Floors by hand,
+// std::floor is a call without SSE4.1 and keeps the rebuild from vectorizing.
+static int32_t candy_grid_cell(const candy_grid *grid, float v) {
+    float cell = std::clamp(v * grid->inv_cell_size, -1e9f, 1e9f);
+    int32_t truncated = (int32_t)cell;
+    return truncated - (cell < (float)truncated);
+}
+
+static uint32_t candy_grid_bucket(int32_t cx, int32_t cy) {
+    return ((uint32_t)cx * 0x8da6b343u ^ (uint32_t)cy * 0xd8163841u) &
+           (GRID_BUCKET_COUNT - 1);
+}
+
+// Several cells can share a bucket, so queries only take the entities whose own cell
+// is the one they visit. Each entity is then seen at most once per cell.
+static bool candy_grid_in_cell(const candy_grid *grid, const candy_entity_store *store,
+                               uint32_t index, int32_t cx, int32_t cy) {
+    return candy_grid_cell(grid, store->px[index]) == cx &&
+           candy_grid_cell(grid, store->py[index]) == cy;
+}
+
+static const candy_state_field candy_grid_fields[] = {
+    CANDY_FIELD(candy_grid, capacity),
+    CANDY_FIELD(candy_grid, entries),
+    CANDY_FIELD(candy_grid, entity_bucket),
+};
+
+extern const candy_state_layout candy_grid_layout =
+    CANDY_LAYOUT(candy_grid, candy_grid_fields);
+
+// Memory candy_grid_init needs for a store of capacity rows
+size_t candy_grid_bytes(uint32_t capacity) {
+    return (size_t)candy_entity_capacity(capacity) * 2 * sizeof(uint32_t);
+}
+
+// memory is candy_grid_bytes(capacity) bytes, which must outlive the grid. The grid
+// is empty until the first build.
+void candy_grid_init(candy_grid *grid, uint32_t capacity, void *memory) {
+    capacity = candy_entity_capacity(capacity);
+    grid->cell_size = 1.0f;
+    grid->inv_cell_size = 1.0f;
+    grid->count = 0;
+    grid->capacity = capacity;
+    grid->entries = (uint32_t *)memory;
+    grid->entity_bucket = grid->entries + capacity;
+}
+
+// Counting sort by bucket: count, prefix sum to the bucket ends, then fill each
+// bucket from its end, walking the entities backwards so they stay in dense order.
+// Entities past the grid's capacity are left out.
+void candy_grid_build(candy_grid *grid, const candy_entity_store *store,
+                      float cell_size) {
+    grid->cell_size = cell_size;
+    grid->inv_cell_size = 1.0f / cell_size;
+    grid->count = std::min(store->count, grid->capacity);
+
+    // Buckets first in a loop of their own, which vectorizes, then the histogram
+    for (uint32_t i = 0; i < grid->count; ++i) {
+        grid->entity_bucket[i] = candy_grid_bucket(candy_grid_cell(grid, store->px[i]),
+                                                   candy_grid_cell(grid, store->py[i]));
+    }
+
+    memset(grid->bucket_start, 0, sizeof(grid->bucket_start));
+    for (uint32_t i = 0; i < grid->count; ++i) {
+        grid->bucket_start[grid->entity_bucket[i]]++;
+    }
+
+    uint32_t end = 0;
+    for (uint32_t b = 0; b <= GRID_BUCKET_COUNT; ++b) {
+        end += grid->bucket_start[b];
+        grid->bucket_start[b] = end;
+    }
+
+    for (uint32_t i = grid->count; i-- > 0;) {
+        grid->entries[--grid->bucket_start[grid->entity_bucket[i]]] = i;
+    }
+}
+
+// Writes the dense index of every entity within radius of (x, y) to out, up to
+// max_out of them. Returns how many there are, which may be more than max_out.
+uint32_t candy_grid_query_radius(const candy_grid *grid, const candy_entity_store *store,
+                                 float x, float y, float radius, uint32_t *out,
+                                 uint32_t max_out) {
+    float radius_sq = radius * radius;
+    uint32_t found = 0;
+
+    auto test = [&](uint32_t index) {
+        float dx = store->px[index] - x;
+        float dy = store->py[index] - y;
+        if (dx * dx + dy * dy <= radius_sq) {
+            if (found < max_out) {
+                out[found] = index;
+            }
+            found++;
+        }
+    };
+
+    int32_t cx0 = candy_grid_cell(grid, x - radius);
+    int32_t cx1 = candy_grid_cell(grid, x + radius);
+    int32_t cy0 = candy_grid_cell(grid, y - radius);
+    int32_t cy1 = candy_grid_cell(grid, y + radius);
+
+    // A query covering more cells than there are buckets is cheaper as a plain scan
+    uint64_t cells = (uint64_t)(cx1 - cx0 + 1) * (uint64_t)(cy1 - cy0 + 1);
+    if (cells > GRID_BUCKET_COUNT) {
+        for (uint32_t i = 0; i < grid->count; ++i) {
+            test(i);
+        }
+        return found;
+    }
+
+    for (int32_t cy = cy0; cy <= cy1; ++cy) {
+        for (int32_t cx = cx0; cx <= cx1; ++cx) {
+            uint32_t bucket = candy_grid_bucket(cx, cy);
+            for (uint32_t e = grid->bucket_start[bucket];
+                 e < grid->bucket_start[bucket + 1]; ++e) {
+                uint32_t index = grid->entries[e];
+                if (candy_grid_in_cell(grid, store, index, cx, cy)) {
+                    test(index);
+                }
+            }
+        }
+    }
+    return found;
+}
+
+// First entity, as a circle of entity_radius, hit by the ray from (x, y) along
+// (dir_x, dir_y) within max_t, skipping ignore. Walks the cells the ray crosses in
+// order, testing each cell's neighbours out to entity_radius, and stops as soon as
+// the next cell starts past the best hit. max_t must be finite.
+candy_grid_hit candy_grid_raycast(const candy_grid *grid, const candy_entity_store *store,
+                                  float x, float y, float dir_x, float dir_y,
+                                  float max_t, float entity_radius, uint32_t ignore) {
+    candy_grid_hit hit = {.index = ENTITY_INVALID, .t = max_t};
+
+    float length = std::sqrt(dir_x * dir_x + dir_y * dir_y);
+    if (length == 0.0f || grid->count == 0) {
+        return hit;
+    }
+    dir_x /= length;
+    dir_y /= length;
+
+    float radius_sq = entity_radius * entity_radius;
+    int32_t reach = (int32_t)std::ceil(entity_radius * grid->inv_cell_size);
+
+    int32_t cx = candy_grid_cell(grid, x);
+    int32_t cy = candy_grid_cell(grid, y);
+    int32_t step_x = dir_x > 0.0f ? 1 : -1;
+    int32_t step_y = dir_y > 0.0f ? 1 : -1;
+
+    // Distance along the ray to the next cell boundary on each axis, and between two
+    float next_x = (float)(cx + (step_x > 0 ? 1 : 0)) * grid->cell_size;
+    float next_y = (float)(cy + (step_y > 0 ? 1 : 0)) * grid->cell_size;
+    float t_max_x = dir_x != 0.0f ? (next_x - x) / dir_x : INFINITY;
+    float t_max_y = dir_y != 0.0f ? (next_y - y) / dir_y : INFINITY;
+    float t_delta_x = dir_x != 0.0f ? grid->cell_size / std::fabs(dir_x) : INFINITY;
+    float t_delta_y = dir_y != 0.0f ? grid->cell_size / std::fabs(dir_y) : INFINITY;
+
+    for (;;) {
+        // Overlapping neighbourhoods test some entities again, which changes nothing
+        for (int32_t ny = cy - reach; ny <= cy + reach; ++ny) {
+            for (int32_t nx = cx - reach; nx <= cx + reach; ++nx) {
+                uint32_t bucket = candy_grid_bucket(nx, ny);
+                for (uint32_t e = grid->bucket_start[bucket];
+                     e < grid->bucket_start[bucket + 1]; ++e) {
+                    uint32_t index = grid->entries[e];
+                    if (index == ignore ||
+                        !candy_grid_in_cell(grid, store, index, nx, ny)) {
+                        continue;
+                    }
+
+                    float mx = store->px[index] - x;
+                    float my = store->py[index] - y;
+                    float along = mx * dir_x + my * dir_y;
+                    float dist_sq = mx * mx + my * my;
+                    float miss_sq = dist_sq - along * along;
+                    if (miss_sq > radius_sq) {
+                        continue;
+                    }
+
+                    // Starting inside the circle counts as a hit at 0
+                    float t = along - std::sqrt(radius_sq - miss_sq);
+                    if (t < 0.0f) {
+                        if (dist_sq > radius_sq) {
+                            continue;
+                        }
+                        t = 0.0f;
+                    }
+                    if (t < hit.t) {
+                        hit = {.index = index, .t = t};
+                    }
+                }
+            }
+        }
+
+        float t_next = std::min(t_max_x, t_max_y);
+        if (t_next >= hit.t) {
+            return hit;
+        }
+        if (t_max_x < t_max_y) {
+            cx += step_x;
+            t_max_x += t_delta_x;
+        } else {
+            cy += step_y;
+            t_max_y += t_delta_y;
+        }
+    }
+}
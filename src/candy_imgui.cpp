@@ -1,4 +1,7 @@
 #include "candy_imgui.h"
+#include "candy_gpu_profiler.h"
+#include "candy_pacer.h"
+#include "candy_profiler.h"
 
 // ============================================================================
 // IMGUI INTEGRATION
@@ -138,7 +141,7 @@ void candy_init_imgui(candy_context *ctx) {
     init_info.QueueFamily = ctx->core.graphics_queue_family;
     init_info.Queue = ctx->core.graphics_queue;
     init_info.ApiVersion = VK_API_VERSION_1_0;
-    init_info.PipelineCache = VK_NULL_HANDLE;
+    init_info.PipelineCache = ctx->pipeline.cache;
     init_info.DescriptorPool = ctx->imgui.descriptor_pool;
     init_info.MinImageCount = MAX_FRAME_IN_FLIGHT;
     init_info.ImageCount = ctx->swapchain.image_count;
@@ -192,12 +195,82 @@ void candy_imgui_render_menu(candy_context *ctx) {
         ImGui::Text("  FPS: %.1f", ImGui::GetIO().Framerate);
         ImGui::Text("  Frame Time: %.3f ms", 1000.0f / ImGui::GetIO().Framerate);
 
+        if (ctx->gpu_profiler.enabled &&
+            ImGui::CollapsingHeader("GPU Timings", ImGuiTreeNodeFlags_DefaultOpen)) {
+            float history[GPU_PROFILER_HISTORY];
+            for (uint32_t i = 0; i < CANDY_GPU_SCOPE_COUNT; ++i) {
+                candy_gpu_scope scope = (candy_gpu_scope)i;
+                uint32_t count =
+                    candy_gpu_scope_history(ctx, scope, history, GPU_PROFILER_HISTORY);
+
+                char overlay[32];
+                snprintf(overlay, sizeof(overlay), "%.3f ms",
+                         candy_gpu_scope_ms(ctx, scope));
+                ImGui::PlotLines(candy_gpu_scope_name(scope), history, (int)count, 0,
+                                 overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+        }
+
         // Display debug info
         ImGuiIO &io = ImGui::GetIO();
         ImGui::Text("  Display: %.0fx%.0f", io.DisplaySize.x, io.DisplaySize.y);
         ImGui::Text("  Scale: %.2fx%.2f", io.DisplayFramebufferScale.x,
                     io.DisplayFramebufferScale.y);
 
+        if (ImGui::CollapsingHeader("Frame Pacing")) {
+            candy_frame_pacer *pacer = &ctx->pacer;
+
+            ImGui::SliderFloat("Target FPS", &pacer->target_fps, 0.0f, 360.0f, "%.0f");
+            ImGui::Checkbox("Late Latch", &pacer->late_latch);
+
+            const VkPresentModeKHR modes[] = {VK_PRESENT_MODE_FIFO_KHR,
+                                              VK_PRESENT_MODE_MAILBOX_KHR,
+                                              VK_PRESENT_MODE_IMMEDIATE_KHR};
+            int current = candy_present_mode_index(pacer->present_mode);
+            if (ImGui::BeginCombo("Present Mode",
+                                  candy_present_mode_name(pacer->present_mode))) {
+                for (int i = 0; i < 3; ++i) {
+                    if (!pacer->present_mode_available[i]) {
+                        continue;
+                    }
+                    if (ImGui::Selectable(candy_present_mode_name(modes[i]),
+                                          i == current)) {
+                        // Applied at the start of the next frame
+                        pacer->requested_present_mode = modes[i];
+                    }
+                }
+                ImGui::EndCombo();
+            }
+
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "CPU %.2f ms", pacer->cpu_ms);
+            ImGui::PlotLines("##cpu", pacer->cpu_history, PACER_HISTORY,
+                             pacer->history_head, overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+            snprintf(overlay, sizeof(overlay), "GPU %.2f ms", pacer->gpu_ms);
+            ImGui::PlotLines("##gpu", pacer->gpu_history, PACER_HISTORY,
+                             pacer->history_head, overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+            snprintf(overlay, sizeof(overlay), "Latency %.2f ms", pacer->latency_ms);
+            ImGui::PlotLines("##latency", pacer->latency_history, PACER_HISTORY,
+                             pacer->history_head, overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+        }
+
+        if (ImGui::CollapsingHeader("Simulation")) {
+            candy_sim_clock *sim = &ctx->sim;
+
+            ImGui::SliderFloat("Tick Rate", &sim->tick_rate, 10.0f, 240.0f, "%.0f Hz");
+            ImGui::Text("Tick %llu, %u in the last batch, alpha %.2f",
+                        (unsigned long long)sim->tick.load(), sim->batch_ticks.load(),
+                        sim->alpha);
+            ImGui::Text("Dropped ticks: %llu",
+                        (unsigned long long)sim->dropped_ticks.load());
+        }
+
+        if (candy_profiler_capturing()) {
+            ImGui::TextDisabled("Capturing CPU trace...");
+        } else if (ImGui::Button("Capture CPU Trace (F9)", ImVec2(-1, 0))) {
+            candy_profiler_capture(TRACE_CAPTURE_FRAMES);
+        }
+
         ImGui::Separator();
 
         if (ImGui::CollapsingHeader("Settings")) {
@@ -248,11 +321,19 @@ void candy_imgui_render_menu(candy_context *ctx) {
     }
 }
 
-void candy_imgui_render(candy_context *ctx, VkCommandBuffer cmd_buffer,
-                        uint32_t image_index) {
+// Builds this frame's draw data on the main thread, before the recording threads start
+void candy_imgui_prepare(candy_context *ctx) {
     candy_imgui_render_menu(ctx);
     ImGui::Render();
+}
+
+// Runs on a recording thread, into a secondary buffer inheriting the ImGui render pass
+void candy_imgui_record(candy_context *ctx, VkCommandBuffer cmd_buffer) {
+    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd_buffer);
+}
 
+void candy_imgui_render(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                        uint32_t image_index, VkCommandBuffer secondary) {
     VkRenderPassBeginInfo info = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .pNext = nullptr,
@@ -263,8 +344,12 @@ void candy_imgui_render(candy_context *ctx, VkCommandBuffer cmd_buffer,
         .pClearValues = nullptr,
     };
 
-    vkCmdBeginRenderPass(cmd_buffer, &info, VK_SUBPASS_CONTENTS_INLINE);
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd_buffer);
+    // The pass still runs without a secondary, it moves the image to PRESENT_SRC
+    vkCmdBeginRenderPass(cmd_buffer, &info,
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (secondary != VK_NULL_HANDLE) {
+        vkCmdExecuteCommands(cmd_buffer, 1, &secondary);
+    }
     vkCmdEndRenderPass(cmd_buffer);
 }
 
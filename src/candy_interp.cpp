@@ -0,0 +1,221 @@
+#include "candy_interp.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// ============================================================================
+// INTERPOLATION BUFFER
+// ============================================================================
+
+constexpr uint32_t INTERP_CAPACITY_GRANULE = 64; // ids, rows stay cache line aligned
+
+// Rows are allocated on the first push, an uninitialized or destroyed interp has none
+void candy_interp_init(candy_interp *interp, uint64_t tick_ns) {
+    memset(interp, 0, sizeof(candy_interp));
+    interp->tick_ns = tick_ns;
+    interp->interval_ns = (int64_t)tick_ns;
+}
+
+void candy_interp_destroy(candy_interp *interp) {
+    free(interp->x);
+    memset(interp, 0, sizeof(candy_interp));
+}
+
+// Grows the rows to hold ids [0, count), keeping every snapshot held. Returns false
+// when out of memory, the rows are then left as they were.
+static bool candy_interp_reserve(candy_interp *interp, uint32_t count) {
+    if (count <= interp->capacity) {
+        return true;
+    }
+
+    uint32_t capacity = std::max(count, interp->capacity * 2);
+    capacity = (capacity + INTERP_CAPACITY_GRANULE - 1) & ~(INTERP_CAPACITY_GRANULE - 1);
+    size_t row_floats = (size_t)INTERP_HISTORY * capacity;
+    size_t bytes = row_floats * (3 * sizeof(float) + sizeof(uint8_t));
+    float *memory = (float *)aligned_alloc(64, bytes);
+    if (!memory) {
+        return false;
+    }
+    float *x = memory;
+    float *y = x + row_floats;
+    float *z = y + row_floats;
+    uint8_t *present = (uint8_t *)(z + row_floats);
+
+    for (uint32_t slot = 0; slot < INTERP_HISTORY; ++slot) {
+        uint32_t held = interp->entity_count[slot];
+        size_t from = (size_t)slot * interp->capacity;
+        size_t to = (size_t)slot * capacity;
+        if (held > 0) {
+            memcpy(x + to, interp->x + from, held * sizeof(float));
+            memcpy(y + to, interp->y + from, held * sizeof(float));
+            memcpy(z + to, interp->z + from, held * sizeof(float));
+            memcpy(present + to, interp->present + from, held);
+        }
+        memset(present + to + held, 0, capacity - held);
+    }
+
+    free(interp->x);
+    interp->capacity = capacity;
+    interp->x = x;
+    interp->y = y;
+    interp->z = z;
+    interp->present = present;
+    return true;
+}
+
+// Estimates move a fixed fraction of the way per snapshot
+static int64_t candy_interp_smooth(int64_t estimate, int64_t sample) {
+    return estimate + (sample - estimate) / INTERP_SMOOTHING;
+}
+
+// Takes in a snapshot as it arrives. Anything not newer than the newest is ignored,
+// so the current one can be pushed every tick.
+void candy_interp_push(candy_interp *interp, const candy_snapshot *snapshot,
+                       uint64_t arrival_ns) {
+    uint32_t last_tick = interp->tick[interp->newest];
+    if (interp->count > 0 && (int32_t)(snapshot->tick - last_tick) <= 0) {
+        return;
+    }
+
+    int64_t tick_ns = (int64_t)interp->tick_ns;
+    int64_t offset_ns = (int64_t)arrival_ns - (int64_t)snapshot->tick * tick_ns;
+    if (interp->count == 0) {
+        interp->offset_ns = offset_ns;
+        interp->delay_ns = interp->interval_ns;
+    } else {
+        // Jitter as in RTP: how much longer or shorter this one took than the last
+        int64_t gap_ns = (int64_t)(snapshot->tick - last_tick) * tick_ns;
+        int64_t transit_change_ns =
+            (int64_t)(arrival_ns - interp->last_arrival_ns) - gap_ns;
+        interp->jitter_ns =
+            candy_interp_smooth(interp->jitter_ns, std::abs(transit_change_ns));
+        interp->interval_ns = candy_interp_smooth(interp->interval_ns, gap_ns);
+        interp->offset_ns = candy_interp_smooth(interp->offset_ns, offset_ns);
+
+        // Eased in, a jump would show as everyone jumping. Never more than the
+        // history holds.
+        int64_t target_ns =
+            interp->interval_ns + INTERP_JITTER_SCALE * interp->jitter_ns;
+        int64_t max_ns = (int64_t)(INTERP_HISTORY - 2) * interp->interval_ns;
+        interp->delay_ns =
+            candy_interp_smooth(interp->delay_ns, std::min(target_ns, max_ns));
+    }
+    interp->last_arrival_ns = arrival_ns;
+
+    uint32_t slot = interp->count > 0 ? (interp->newest + 1) % INTERP_HISTORY : 0;
+    uint32_t count = snapshot->count;
+    if (!candy_interp_reserve(interp, count)) {
+        count = interp->capacity;
+    }
+    size_t row = (size_t)slot * interp->capacity;
+    for (uint32_t id = 0; id < count; ++id) {
+        interp->x[row + id] = candy_snapshot_dequantize(snapshot->x[id]);
+        interp->y[row + id] = candy_snapshot_dequantize(snapshot->y[id]);
+        interp->z[row + id] = candy_snapshot_dequantize(snapshot->z[id]);
+    }
+    memcpy(interp->present + row, snapshot->present, count);
+
+    // Ids past the count are absent, including those a bigger snapshot left here
+    uint32_t stale = interp->entity_count[slot];
+    if (stale > count) {
+        memset(interp->present + row + count, 0, stale - count);
+    }
+    interp->entity_count[slot] = count;
+    interp->tick[slot] = snapshot->tick;
+    interp->newest = slot;
+    interp->count = std::min(interp->count + 1, INTERP_HISTORY);
+}
+
+// Finds the two snapshots around now minus the delay, in server time
+candy_interp_time candy_interp_locate(const candy_interp *interp, uint64_t now_ns) {
+    candy_interp_time time = {};
+    if (interp->count == 0) {
+        return time;
+    }
+    time.valid = true;
+
+    int64_t tick_ns = (int64_t)interp->tick_ns;
+    int64_t render_ns = (int64_t)now_ns - interp->offset_ns - interp->delay_ns;
+
+    // Newest first, for the newest at or before the render time
+    uint32_t newer = interp->newest;
+    for (uint32_t i = 0; i < interp->count; ++i) {
+        uint32_t slot = (interp->newest + INTERP_HISTORY - i) % INTERP_HISTORY;
+        int64_t slot_ns = (int64_t)interp->tick[slot] * tick_ns;
+        if (slot_ns <= render_ns) {
+            if (i == 0) {
+                break; // past the newest
+            }
+            int64_t span_ns =
+                (int64_t)(interp->tick[newer] - interp->tick[slot]) * tick_ns;
+            time.from = slot;
+            time.to = newer;
+            time.t = (float)((double)(render_ns - slot_ns) / (double)span_ns);
+            return time;
+        }
+        newer = slot;
+    }
+
+    if (newer != interp->newest) {
+        // Older than everything held
+        time.from = time.to = newer;
+        return time;
+    }
+    if (interp->count < 2) {
+        time.from = time.to = interp->newest;
+        return time;
+    }
+
+    // Carries on from the last two, for a while
+    uint32_t previous = (interp->newest + INTERP_HISTORY - 1) % INTERP_HISTORY;
+    int64_t newest_ns = (int64_t)interp->tick[interp->newest] * tick_ns;
+    int64_t span_ns =
+        (int64_t)(interp->tick[interp->newest] - interp->tick[previous]) * tick_ns;
+    time.extrapolated_ns = std::min(render_ns - newest_ns, INTERP_MAX_EXTRAPOLATION_NS);
+    time.from = previous;
+    time.to = interp->newest;
+    time.t = (float)(1.0 + (double)time.extrapolated_ns / (double)span_ns);
+    return time;
+}
+
+// Positions of ids [0, count) into x, y and z. Two rows per axis, read in order, so
+// thousands of entities cost about as much as a copy. An entity new in `to` is
+// placed there, one absent from it gets whatever is left in the row, and ids no
+// snapshot had get 0: check candy_interp_present.
+void candy_interp_sample(const candy_interp *interp, const candy_interp_time *time,
+                         uint32_t count, float *x, float *y, float *z) {
+    uint32_t held = time->valid ? std::min(count, interp->capacity) : 0;
+    memset(x + held, 0, (count - held) * sizeof(float));
+    memset(y + held, 0, (count - held) * sizeof(float));
+    memset(z + held, 0, (count - held) * sizeof(float));
+    if (held == 0) {
+        return;
+    }
+
+    size_t from = (size_t)time->from * interp->capacity;
+    size_t to = (size_t)time->to * interp->capacity;
+    const float *from_x = interp->x + from;
+    const float *from_y = interp->y + from;
+    const float *from_z = interp->z + from;
+    const float *to_x = interp->x + to;
+    const float *to_y = interp->y + to;
+    const float *to_z = interp->z + to;
+    const uint8_t *from_present = interp->present + from;
+    const float t = time->t;
+
+    for (uint32_t id = 0; id < held; ++id) {
+        float a_x = from_present[id] ? from_x[id] : to_x[id];
+        float a_y = from_present[id] ? from_y[id] : to_y[id];
+        float a_z = from_present[id] ? from_z[id] : to_z[id];
+        x[id] = a_x + (to_x[id] - a_x) * t;
+        y[id] = a_y + (to_y[id] - a_y) * t;
+        z[id] = a_z + (to_z[id] - a_z) * t;
+    }
+}
+
+bool candy_interp_present(const candy_interp *interp, const candy_interp_time *time,
+                          uint32_t id) {
+    return time->valid && id < interp->capacity &&
+           interp->present[(size_t)time->to * interp->capacity + id];
+}
@@ -0,0 +1,399 @@
+#include "candy_jobs.h"
+#include "candy_profiler.h"
+
+// ============================================================================
+// JOB SYSTEM
+// ============================================================================
+
+// A Chase-Lev deque per thread: the owner pushes and pops at the bottom, every other
+// thread steals from the top. Jobs are kept by value in the deque slots and copied
+// out when taken. Push refuses a full deque, so a slot is only written again once its
+// job was taken; a thief still copying it then loses the race on top and drops the
+// copy.
+struct candy_job_queue {
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    candy_job slots[JOB_DEQUE_SIZE];
+};
+
+static thread_local candy_job_queue *candy_tls_job_queue = nullptr;
+static thread_local bool candy_tls_job_overflow = false;
+
+static bool candy_job_push(candy_job_queue *queue, const candy_job *job) {
+    int64_t bottom = queue->bottom.load(std::memory_order_relaxed);
+    int64_t top = queue->top.load(std::memory_order_acquire);
+    if (bottom - top >= (int64_t)JOB_DEQUE_SIZE) {
+        return false;
+    }
+
+    queue->slots[bottom & (JOB_DEQUE_SIZE - 1)] = *job;
+    std::atomic_thread_fence(std::memory_order_release);
+    queue->bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+static bool candy_job_pop(candy_job_queue *queue, candy_job *out) {
+    int64_t bottom = queue->bottom.load(std::memory_order_relaxed) - 1;
+    queue->bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = queue->top.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+        queue->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const candy_job *job = &queue->slots[bottom & (JOB_DEQUE_SIZE - 1)];
+    if (top == bottom) {
+        // Last job: race the thieves for it
+        bool won = queue->top.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        queue->bottom.store(bottom + 1, std::memory_order_relaxed);
+        if (!won) {
+            return false;
+        }
+    }
+    *out = *job;
+    return true;
+}
+
+static bool candy_job_steal(candy_job_queue *queue, candy_job *out) {
+    int64_t top = queue->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = queue->bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return false;
+    }
+
+    candy_job copy = queue->slots[top & (JOB_DEQUE_SIZE - 1)];
+    if (!queue->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                            std::memory_order_relaxed)) {
+        return false;
+    }
+    *out = copy;
+    return true;
+}
+
+// Any thread that spawns or waits gets a queue on first use, like the profiler rings
+static candy_job_queue *candy_job_thread_queue(candy_job_system *jobs) {
+    if (candy_tls_job_queue || candy_tls_job_overflow) {
+        return candy_tls_job_queue;
+    }
+
+    std::lock_guard<std::mutex> lock(jobs->register_mutex);
+    uint32_t index = jobs->queue_count.load(std::memory_order_relaxed);
+    if (index >= JOB_MAX_THREADS) {
+        std::cerr << "[CANDY JOBS] More than " << JOB_MAX_THREADS
+                  << " threads, jobs of this thread run inline" << std::endl;
+        candy_tls_job_overflow = true;
+        return nullptr;
+    }
+
+    candy_job_queue *queue = (candy_job_queue *)calloc(1, sizeof(candy_job_queue));
+    CANDY_ASSERT(queue != nullptr, "Failed to allocate a job queue");
+    jobs->queues[index] = queue;
+    jobs->queue_count.store(index + 1, std::memory_order_release);
+
+    candy_tls_job_queue = queue;
+    return queue;
+}
+
+static void candy_job_run(candy_job_system *jobs, candy_job *job) {
+    job->fn(job->data, job->begin, job->end);
+
+    if (job->counter) {
+        job->counter->pending.fetch_sub(1, std::memory_order_release);
+    }
+    jobs->in_flight.fetch_sub(1, std::memory_order_release);
+}
+
+// Own queue first, newest job first for locality, then steal the oldest job of the
+// others, starting from a different victim every time
+static bool candy_job_find(candy_job_system *jobs, candy_job_queue *own,
+                           candy_job *out) {
+    if (jobs->queued.load(std::memory_order_relaxed) <= 0) {
+        return false;
+    }
+
+    bool found = own && candy_job_pop(own, out);
+    if (!found) {
+        uint32_t count = jobs->queue_count.load(std::memory_order_acquire);
+        uint32_t start = jobs->steal_seed.fetch_add(1, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < count && !found; ++i) {
+            candy_job_queue *victim = jobs->queues[(start + i) % count];
+            found = victim != own && candy_job_steal(victim, out);
+        }
+    }
+
+    if (found) {
+        jobs->queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return found;
+}
+
+static void candy_job_worker(candy_context *ctx, uint32_t index) {
+    candy_job_system *jobs = &ctx->jobs;
+
+    char name[16];
+    snprintf(name, sizeof(name), "job %u", index);
+    candy_zone_thread_name(name);
+    candy_job_queue *own = candy_job_thread_queue(jobs);
+
+    uint32_t idle_spins = 0;
+    while (!jobs->quit.load(std::memory_order_acquire)) {
+        candy_job job;
+        if (candy_job_find(jobs, own, &job)) {
+            CANDY_ZONE("Job");
+            candy_job_run(jobs, &job);
+            idle_spins = 0;
+            continue;
+        }
+
+        if (++idle_spins < JOB_IDLE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            continue;
+        }
+
+        // Sleep until a spawn wakes us. Either this thread sees the job queued, or
+        // the spawner sees it sleeping and notifies under the mutex, after the wait.
+        std::unique_lock<std::mutex> lock(jobs->sleep_mutex);
+        jobs->sleeping.fetch_add(1, std::memory_order_seq_cst);
+        if (jobs->queued.load(std::memory_order_seq_cst) <= 0 &&
+            !jobs->quit.load(std::memory_order_relaxed)) {
+            jobs->wake_cv.wait(lock);
+        }
+        jobs->sleeping.fetch_sub(1, std::memory_order_relaxed);
+        idle_spins = 0;
+    }
+}
+
+void candy_init_jobs(candy_context *ctx) {
+    candy_job_system *jobs = &ctx->jobs;
+    jobs->queue_count.store(0);
+    jobs->in_flight.store(0);
+    jobs->queued.store(0);
+    jobs->sleeping.store(0);
+    jobs->quit.store(false);
+
+    // The main thread takes part whenever it waits, so it gets the first queue
+    candy_job_thread_queue(jobs);
+
+    uint32_t cores = std::thread::hardware_concurrency();
+    uint32_t worker_count = cores > 1 ? cores - 1 : 1;
+    worker_count = std::min(worker_count, JOB_MAX_WORKERS);
+
+    jobs->worker_count = worker_count;
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        jobs->workers[i] = std::thread(candy_job_worker, ctx, i);
+    }
+
+    std::cout << "[CANDY] Job system with " << worker_count << " workers" << std::endl;
+}
+
+void candy_destroy_jobs(candy_context *ctx) {
+    candy_job_system *jobs = &ctx->jobs;
+
+    candy_jobs_drain(ctx);
+    {
+        std::lock_guard<std::mutex> lock(jobs->sleep_mutex);
+        jobs->quit.store(true, std::memory_order_release);
+    }
+    jobs->wake_cv.notify_all();
+
+    for (uint32_t i = 0; i < jobs->worker_count; ++i) {
+        jobs->workers[i].join();
+    }
+    jobs->worker_count = 0;
+
+    // Threads still holding a queue pointer only ever touch it through spawn or wait
+    uint32_t count = jobs->queue_count.load();
+    for (uint32_t i = 0; i < count; ++i) {
+        free(jobs->queues[i]);
+        jobs->queues[i] = nullptr;
+    }
+    jobs->queue_count.store(0);
+    candy_tls_job_queue = nullptr;
+}
+
+// Queues fn(data, begin, end). counter, if any, is incremented now and decremented
+// once the job finished. Runs the job right away if this thread's queue is full.
+void candy_job_spawn(candy_context *ctx, candy_job_counter *counter, candy_job_fn fn,
+                     void *data, uint32_t begin, uint32_t end) {
+    candy_job_system *jobs = &ctx->jobs;
+
+    if (counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+    jobs->in_flight.fetch_add(1, std::memory_order_seq_cst);
+
+    candy_job_queue *queue = candy_job_thread_queue(jobs);
+    candy_job job = {
+        .fn = fn,
+        .data = data,
+        .begin = begin,
+        .end = end,
+        .counter = counter,
+    };
+
+    if (queue && candy_job_push(queue, &job)) {
+        jobs->queued.fetch_add(1, std::memory_order_seq_cst);
+        if (jobs->sleeping.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(jobs->sleep_mutex);
+            jobs->wake_cv.notify_one();
+        }
+        return;
+    }
+    candy_job_run(jobs, &job);
+}
+
+// Blocks until every job counted by counter finished, running queued jobs meanwhile,
+// so waiting from inside a job cannot deadlock the workers.
+void candy_job_wait(candy_context *ctx, candy_job_counter *counter) {
+    candy_job_system *jobs = &ctx->jobs;
+    candy_job_queue *own = candy_job_thread_queue(jobs);
+
+    while (counter->pending.load(std::memory_order_acquire) > 0) {
+        candy_job job;
+        if (candy_job_find(jobs, own, &job)) {
+            candy_job_run(jobs, &job);
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+}
+
+// Waits for every job in the system, fire and forget ones included. Hot reload calls
+// this before the module's code goes away.
+void candy_jobs_drain(candy_context *ctx) {
+    candy_job_system *jobs = &ctx->jobs;
+    candy_job_queue *own = candy_job_thread_queue(jobs);
+
+    while (jobs->in_flight.load(std::memory_order_acquire) > 0) {
+        candy_job job;
+        if (candy_job_find(jobs, own, &job)) {
+            candy_job_run(jobs, &job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+struct candy_parallel_for_data {
+    candy_job_fn fn;
+    void *data;
+    uint32_t grain;
+    candy_job_counter counter;
+    candy_context *ctx;
+};
+
+// Splits its range in halves, handing the upper half out, until it is one grain.
+// Thieves take the largest pieces first.
+static void candy_parallel_for_job(void *data, uint32_t begin, uint32_t end) {
+    candy_parallel_for_data *pf = (candy_parallel_for_data *)data;
+
+    while (end - begin > pf->grain) {
+        uint32_t mid = begin + (end - begin) / 2;
+        candy_job_spawn(pf->ctx, &pf->counter, candy_parallel_for_job, pf, mid, end);
+        end = mid;
+    }
+    pf->fn(pf->data, begin, end);
+}
+
+// Calls fn(data, begin, end) over [0, count) in pieces of at most grain, and returns
+// once all of them ran. The calling thread works along.
+void candy_parallel_for(candy_context *ctx, uint32_t count, uint32_t grain,
+                        candy_job_fn fn, void *data) {
+    if (count == 0) {
+        return;
+    }
+
+    grain = std::max(grain, 1u);
+    if (count <= grain || ctx->jobs.worker_count == 0) {
+        fn(data, 0, count);
+        return;
+    }
+
+    candy_parallel_for_data pf = {
+        .fn = fn,
+        .data = data,
+        .grain = grain,
+        .counter = {},
+        .ctx = ctx,
+    };
+    candy_parallel_for_job(&pf, 0, count);
+    candy_job_wait(ctx, &pf.counter);
+}
+
+// ============================================================================
+// SELF TEST
+// ============================================================================
+
+struct candy_jobs_test_data {
+    std::atomic<uint32_t> *runs; // per job
+    std::atomic<uint32_t> inline_runs;
+    std::atomic<bool> gate;
+    std::thread::id spawner;
+};
+
+// Workers hold on to their job until the gate opens, so the spawner's queue fills up
+// and stays full. Jobs the spawner runs itself, past a full queue, go straight on.
+static void candy_jobs_test_job(void *data, uint32_t begin, uint32_t end) {
+    (void)end;
+    candy_jobs_test_data *test = (candy_jobs_test_data *)data;
+    if (std::this_thread::get_id() == test->spawner) {
+        test->inline_runs.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        while (!test->gate.load(std::memory_order_acquire)) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+    test->runs[begin].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Spawns several times JOB_DEQUE_SIZE jobs from one thread while none of them can
+// finish, then lets them go. Every job must run exactly once, whether it was queued,
+// stolen or run in place because the queue was full.
+bool candy_test_jobs_overflow(candy_context *ctx) {
+    const uint32_t count = JOB_DEQUE_SIZE * 4 + 7;
+
+    candy_jobs_test_data test;
+    test.runs = (std::atomic<uint32_t> *)calloc(count, sizeof(std::atomic<uint32_t>));
+    if (!test.runs) {
+        return false;
+    }
+    test.inline_runs.store(0);
+    test.gate.store(false);
+    test.spawner = std::this_thread::get_id();
+
+    candy_init_jobs(ctx);
+    candy_job_counter counter = {};
+    for (uint32_t i = 0; i < count; ++i) {
+        candy_job_spawn(ctx, &counter, candy_jobs_test_job, &test, i, i + 1);
+    }
+    uint32_t inline_runs = test.inline_runs.load();
+    test.gate.store(true, std::memory_order_release);
+    candy_job_wait(ctx, &counter);
+    uint32_t workers = ctx->jobs.worker_count;
+    candy_destroy_jobs(ctx);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        wrong += test.runs[i].load() != 1;
+    }
+    free(test.runs);
+
+    // Only a full queue makes the spawner run jobs itself
+    bool overflowed = inline_runs >= count - JOB_DEQUE_SIZE - workers;
+    bool passed = wrong == 0 && overflowed;
+    std::cout << "[CANDY TEST] Spawning " << count << " jobs into a " << JOB_DEQUE_SIZE
+              << " job queue: " << inline_runs << " run in place, " << wrong
+              << " not run exactly once: " << (passed ? "passed" : "FAILED")
+              << std::endl;
+    return passed;
+}
@@ -0,0 +1,231 @@
+#include "candy_match.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// ============================================================================
+// MATCH
+// ============================================================================
+
+static const candy_state_field candy_match_fields[] = {
+    CANDY_FIELD_STRUCT(candy_match, entities, candy_entity_store_layout),
+    CANDY_FIELD_STRUCT(candy_match, players, candy_entity_layout),
+    CANDY_FIELD(candy_match, kill_count),
+    CANDY_FIELD(candy_match, fire_cooldown),
+    CANDY_FIELD(candy_match, tick),
+    CANDY_FIELD_STRUCT(candy_match, grid, candy_grid_layout),
+};
+
+extern const candy_state_layout candy_match_layout =
+    CANDY_LAYOUT(candy_match, candy_match_fields);
+
+// Rows a match asked for capacity gets, always room for the players
+static uint32_t candy_match_capacity(uint32_t capacity) {
+    return candy_entity_capacity(std::max(capacity, MATCH_MAX_PLAYERS));
+}
+
+// Memory candy_match_init needs for capacity entities: the store's columns, the
+// kill counts and the grid, one after another
+size_t candy_match_bytes(uint32_t capacity) {
+    capacity = candy_match_capacity(capacity);
+    return candy_entity_store_bytes(capacity) + capacity * sizeof(uint32_t) +
+           candy_grid_bytes(capacity);
+}
+
+// memory is candy_match_bytes(capacity) bytes aligned to 64, which must outlive the
+// match. The state holding the match only keeps pointers into it.
+void candy_match_init(candy_match *match, uint32_t capacity, void *memory) {
+    capacity = candy_match_capacity(capacity);
+    uint8_t *bytes = (uint8_t *)memory;
+    candy_entity_store_init(&match->entities, capacity, bytes);
+    bytes += candy_entity_store_bytes(capacity);
+    match->kill_count = (uint32_t *)bytes;
+    bytes += capacity * sizeof(uint32_t);
+    candy_grid_init(&match->grid, capacity, bytes);
+
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        match->players[i] = candy_entity_create(&match->entities);
+        match->kill_count[candy_entity_index(&match->entities, match->players[i])] = 0;
+        match->fire_cooldown[i] = 0.0f;
+    }
+    match->tick = 0;
+    candy_grid_build(&match->grid, &match->entities, MATCH_GRID_CELL_SIZE);
+}
+
+// Shoots along the way the player moves, against last tick's grid
+static void candy_match_fire(candy_match *match, uint32_t player) {
+    candy_entity_store *entities = &match->entities;
+
+    float dir_x = entities->vx[player];
+    float dir_y = entities->vy[player];
+    if (dir_x == 0.0f && dir_y == 0.0f) {
+        dir_x = 1.0f;
+    }
+
+    candy_grid_hit hit =
+        candy_grid_raycast(&match->grid, entities, entities->px[player],
+                           entities->py[player], dir_x, dir_y, MATCH_FIRE_RANGE,
+                           MATCH_PLAYER_RADIUS, player);
+    if (hit.index != ENTITY_INVALID) {
+        float length = std::sqrt(dir_x * dir_x + dir_y * dir_y);
+        entities->vx[hit.index] += dir_x / length * MATCH_FIRE_KNOCKBACK;
+        entities->vy[hit.index] += dir_y / length * MATCH_FIRE_KNOCKBACK;
+        match->kill_count[player]++;
+    }
+}
+
+// One fixed step: buttons holds MATCH_MAX_PLAYERS bit sets, by player. Players act in
+// order, so the same buttons from the same state give the same result anywhere.
+void candy_match_tick(candy_match *match, const uint8_t *buttons, float dt) {
+    candy_entity_store *entities = &match->entities;
+
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        uint32_t player = candy_entity_index(entities, match->players[i]);
+        if (player == ENTITY_INVALID) {
+            continue;
+        }
+
+        candy_match_push(&entities->vx[player], &entities->vy[player], buttons[i], dt);
+        match->fire_cooldown[i] = std::max(match->fire_cooldown[i] - dt, 0.0f);
+        if ((buttons[i] & MATCH_BUTTON_FIRE) && match->fire_cooldown[i] == 0.0f) {
+            match->fire_cooldown[i] = MATCH_FIRE_COOLDOWN;
+            candy_match_fire(match, player);
+        }
+    }
+
+    const candy_integrate_params params = candy_match_integrate_params(dt);
+    candy_entity_integrate(entities, &params);
+    candy_grid_build(&match->grid, entities, MATCH_GRID_CELL_SIZE);
+    match->tick++;
+}
+
+// Everyone stays on screen
+candy_integrate_params candy_match_integrate_params(float dt) {
+    return {
+        .dt = dt,
+        .damping = MATCH_PLAYER_DAMPING,
+        .bounds_min = {-1.0f, -1.0f, 0.0f},
+        .bounds_max = {1.0f, 1.0f, 0.0f},
+    };
+}
+
+void candy_match_push(float *vx, float *vy, uint8_t buttons, float dt) {
+    float push = MATCH_PLAYER_ACCELERATION * dt;
+    if (buttons & MATCH_BUTTON_UP) {
+        *vy += push;
+    }
+    if (buttons & MATCH_BUTTON_DOWN) {
+        *vy -= push;
+    }
+    if (buttons & MATCH_BUTTON_LEFT) {
+        *vx -= push;
+    }
+    if (buttons & MATCH_BUTTON_RIGHT) {
+        *vx += push;
+    }
+}
+
+// One tick of one player's movement alone: what candy_match_tick does to it, bit for
+// bit, as long as no shot knocks it back. Cheap enough to replay hundreds of ticks.
+void candy_match_move(candy_match_motion *motion, uint8_t buttons,
+                      const candy_integrate_params *params, float keep) {
+    candy_match_push(&motion->v[0], &motion->v[1], buttons, params->dt);
+    candy_entity_integrate_one(motion->p, motion->v, params, keep);
+}
+
+bool candy_match_get_motion(const candy_match *match, uint32_t player,
+                            candy_match_motion *out) {
+    const candy_entity_store *entities = &match->entities;
+    uint32_t index = candy_entity_index(entities, match->players[player]);
+    if (index == ENTITY_INVALID) {
+        return false;
+    }
+    *out = {
+        .p = {entities->px[index], entities->py[index], entities->pz[index]},
+        .v = {entities->vx[index], entities->vy[index], entities->vz[index]},
+    };
+    return true;
+}
+
+// ============================================================================
+// INPUT PACKETS
+// ============================================================================
+
+// Little endian, like the transport's own fields
+static uint8_t *candy_match_put_u32(uint8_t *out, uint32_t v) {
+    for (uint32_t i = 0; i < 4; ++i) {
+        out[i] = (uint8_t)(v >> (i * 8));
+    }
+    return out + 4;
+}
+
+static const uint8_t *candy_match_get_u32(const uint8_t *data, uint32_t *v) {
+    *v = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        *v |= (uint32_t)data[i] << (i * 8);
+    }
+    return data + 4;
+}
+
+// acked_tick, first_tick, a command count byte, then one byte of buttons each
+uint32_t candy_match_write_input(const candy_match_input *input,
+                                 uint8_t out[MATCH_INPUT_MAX_SIZE]) {
+    uint32_t count = std::min(input->count, MATCH_INPUT_COMMANDS);
+    uint8_t *p = candy_match_put_u32(out, input->acked_tick);
+    p = candy_match_put_u32(p, input->first_tick);
+    *p++ = (uint8_t)count;
+    memcpy(p, input->buttons, count);
+    return (uint32_t)(p - out) + count;
+}
+
+bool candy_match_read_input(const uint8_t *data, uint32_t size, candy_match_input *out) {
+    if (size < MATCH_INPUT_HEADER_SIZE) {
+        return false;
+    }
+    const uint8_t *p = candy_match_get_u32(data, &out->acked_tick);
+    p = candy_match_get_u32(p, &out->first_tick);
+    out->count = *p++;
+    if (out->count > MATCH_INPUT_COMMANDS ||
+        size != MATCH_INPUT_HEADER_SIZE + out->count) {
+        return false;
+    }
+    memcpy(out->buttons, p, out->count);
+    return true;
+}
+
+// player, input_tick, then position and velocity as raw float bits
+void candy_match_write_ack(const candy_match_ack *ack, uint8_t out[MATCH_ACK_SIZE]) {
+    out[0] = ack->player;
+    uint8_t *p = candy_match_put_u32(out + 1, ack->input_tick);
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint32_t bits;
+        memcpy(&bits, &ack->motion.p[i], sizeof(bits));
+        p = candy_match_put_u32(p, bits);
+    }
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint32_t bits;
+        memcpy(&bits, &ack->motion.v[i], sizeof(bits));
+        p = candy_match_put_u32(p, bits);
+    }
+}
+
+// Reads the ack at the front of a server packet; the snapshot follows it
+bool candy_match_read_ack(const uint8_t *data, uint32_t size, candy_match_ack *out) {
+    if (size < MATCH_ACK_SIZE || data[0] >= MATCH_MAX_PLAYERS) {
+        return false;
+    }
+    out->player = data[0];
+    const uint8_t *p = candy_match_get_u32(data + 1, &out->input_tick);
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint32_t bits;
+        p = candy_match_get_u32(p, &bits);
+        memcpy(&out->motion.p[i], &bits, sizeof(bits));
+    }
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint32_t bits;
+        p = candy_match_get_u32(p, &bits);
+        memcpy(&out->motion.v[i], &bits, sizeof(bits));
+    }
+    return true;
+}
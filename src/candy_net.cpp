@@ -0,0 +1,1033 @@
+#include "candy_net.h"
+#include "candy_snapshot.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// ============================================================================
+// PACKET IO
+// ============================================================================
+
+// Little endian on the wire, whatever the host
+struct candy_net_writer {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+struct candy_net_reader {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t offset;
+    bool overflow;
+};
+
+static void candy_net_write_bytes(candy_net_writer *w, const void *src, uint32_t size) {
+    memcpy(w->data + w->size, src, size);
+    w->size += size;
+}
+
+static void candy_net_write_u8(candy_net_writer *w, uint8_t v) {
+    w->data[w->size++] = v;
+}
+
+static void candy_net_write_u16(candy_net_writer *w, uint16_t v) {
+    candy_net_write_u8(w, (uint8_t)v);
+    candy_net_write_u8(w, (uint8_t)(v >> 8));
+}
+
+static void candy_net_write_u32(candy_net_writer *w, uint32_t v) {
+    candy_net_write_u16(w, (uint16_t)v);
+    candy_net_write_u16(w, (uint16_t)(v >> 16));
+}
+
+// Reads past the end return zeros and set overflow, checked once per packet
+static bool candy_net_read_bytes(candy_net_reader *r, void *dst, uint32_t size) {
+    if (r->overflow || r->size - r->offset < size) {
+        r->overflow = true;
+        memset(dst, 0, size);
+        return false;
+    }
+    memcpy(dst, r->data + r->offset, size);
+    r->offset += size;
+    return true;
+}
+
+// Points into the packet instead of copying
+static const uint8_t *candy_net_read_skip(candy_net_reader *r, uint32_t size) {
+    if (r->overflow || r->size - r->offset < size) {
+        r->overflow = true;
+        return nullptr;
+    }
+    const uint8_t *data = r->data + r->offset;
+    r->offset += size;
+    return data;
+}
+
+static uint8_t candy_net_read_u8(candy_net_reader *r) {
+    uint8_t v = 0;
+    candy_net_read_bytes(r, &v, 1);
+    return v;
+}
+
+static uint16_t candy_net_read_u16(candy_net_reader *r) {
+    uint16_t lo = candy_net_read_u8(r);
+    return (uint16_t)(lo | candy_net_read_u8(r) << 8);
+}
+
+static uint32_t candy_net_read_u32(candy_net_reader *r) {
+    uint32_t lo = candy_net_read_u16(r);
+    return lo | (uint32_t)candy_net_read_u16(r) << 16;
+}
+
+// protocol, sequence, ack, ack bits, ack delay, message count
+constexpr uint32_t NET_HEADER_SIZE = 4 + 2 + 2 + 4 + 2 + 1;
+
+// Set in the message count byte once the sender received anything, so the ack fields
+// mean something. Until then they are zero and must not ack the peer's packet 0.
+constexpr uint8_t NET_HAS_ACK = 0x80;
+
+static_assert(NET_PACKET_MESSAGES < NET_HAS_ACK, "the message count must leave the flag");
+
+// Sequence numbers wrap, a is newer than b if it is less than half the range ahead
+static bool candy_net_sequence_greater(uint16_t a, uint16_t b) {
+    return a != b && (uint16_t)(a - b) < 32768;
+}
+
+// ============================================================================
+// CONDITIONER
+// ============================================================================
+
+static float candy_net_random(candy_net_endpoint *endpoint) {
+    uint32_t x = endpoint->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    endpoint->rng = x;
+    return (float)(x & 0xffffff) / (float)0x1000000;
+}
+
+static void candy_net_sendto(candy_net_endpoint *endpoint, candy_net_address to,
+                             const uint8_t *data, uint32_t size) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(to.ip);
+    addr.sin_port = htons(to.port);
+    sendto(endpoint->fd, data, size, 0, (const sockaddr *)&addr, sizeof(addr));
+}
+
+// Drops or holds back the packet as the conditions say, sends it right away otherwise
+static void candy_net_send_packet(candy_net_endpoint *endpoint, candy_net_address to,
+                                  const uint8_t *data, uint32_t size, uint64_t now_ns) {
+    const candy_net_conditions *c = &endpoint->conditions;
+    if (c->loss > 0.0f && candy_net_random(endpoint) < c->loss) {
+        endpoint->packets_dropped++;
+        return;
+    }
+
+    float delay_ms = c->latency_ms + c->jitter_ms * (candy_net_random(endpoint) * 2 - 1);
+    if (delay_ms <= 0.0f || endpoint->delayed_count == NET_DELAYED_PACKETS) {
+        candy_net_sendto(endpoint, to, data, size);
+        return;
+    }
+
+    candy_net_delayed_packet *delayed = &endpoint->delayed[endpoint->delayed_count++];
+    delayed->deliver_ns = now_ns + (uint64_t)(delay_ms * 1e6f);
+    delayed->to = to;
+    delayed->size = size;
+    memcpy(delayed->data, data, size);
+}
+
+static void candy_net_flush_delayed(candy_net_endpoint *endpoint, uint64_t now_ns) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < endpoint->delayed_count; ++i) {
+        candy_net_delayed_packet *delayed = &endpoint->delayed[i];
+        if (delayed->deliver_ns <= now_ns) {
+            candy_net_sendto(endpoint, delayed->to, delayed->data, delayed->size);
+        } else {
+            if (kept != i) {
+                endpoint->delayed[kept] = *delayed;
+            }
+            kept++;
+        }
+    }
+    endpoint->delayed_count = kept;
+}
+
+// ============================================================================
+// ENDPOINTS
+// ============================================================================
+
+candy_net_address candy_net_loopback_address(uint16_t port) {
+    return {.ip = INADDR_LOOPBACK, .port = port};
+}
+
+// Reads "a.b.c.d:port"
+bool candy_net_parse_address(const char *text, candy_net_address *out) {
+    const char *colon = strrchr(text, ':');
+    if (!colon || colon - text >= 16) {
+        return false;
+    }
+    char ip[16];
+    memcpy(ip, text, (size_t)(colon - text));
+    ip[colon - text] = '\0';
+
+    in_addr addr;
+    char *end;
+    unsigned long port = strtoul(colon + 1, &end, 10);
+    if (inet_pton(AF_INET, ip, &addr) != 1 || *end != '\0' || port == 0 ||
+        port > 65535) {
+        return false;
+    }
+    *out = {.ip = ntohl(addr.s_addr), .port = (uint16_t)port};
+    return true;
+}
+
+// Binds a non-blocking UDP socket on every interface, port 0 picks a free one
+bool candy_net_open(candy_net_endpoint *endpoint, uint16_t port, uint32_t max_connections,
+                    bool accept_connections, float send_rate) {
+    *endpoint = {};
+    endpoint->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (endpoint->fd < 0) {
+        std::cerr << "[CANDY NET] Failed to create a socket: " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    socklen_t addr_size = sizeof(addr);
+    if (bind(endpoint->fd, (const sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(endpoint->fd, (sockaddr *)&addr, &addr_size) != 0 ||
+        fcntl(endpoint->fd, F_SETFL, O_NONBLOCK) != 0) {
+        std::cerr << "[CANDY NET] Failed to bind port " << port << ": " << strerror(errno)
+                  << std::endl;
+        close(endpoint->fd);
+        endpoint->fd = -1;
+        return false;
+    }
+
+    // Packets are stamped as they reach the socket, not when they are read. Without it
+    // they count as arriving when read.
+    int on = 1;
+    setsockopt(endpoint->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+
+    endpoint->port = ntohs(addr.sin_port);
+    endpoint->accept_connections = accept_connections;
+    endpoint->send_rate = std::max(send_rate, 1.0f);
+    endpoint->max_connections = std::max(max_connections, 1u);
+    endpoint->connections = (candy_net_connection *)calloc(endpoint->max_connections,
+                                                           sizeof(candy_net_connection));
+    endpoint->delayed =
+        (candy_net_delayed_packet *)calloc(NET_DELAYED_PACKETS,
+                                           sizeof(candy_net_delayed_packet));
+    endpoint->rng = 0x2545f491u ^ endpoint->port;
+    if (!endpoint->connections || !endpoint->delayed) {
+        std::cerr << "[CANDY NET] Failed to allocate the endpoint" << std::endl;
+        candy_net_close(endpoint);
+        return false;
+    }
+    return true;
+}
+
+void candy_net_close(candy_net_endpoint *endpoint) {
+    if (endpoint->fd >= 0) {
+        close(endpoint->fd);
+    }
+    free(endpoint->connections);
+    free(endpoint->delayed);
+    *endpoint = {};
+    endpoint->fd = -1;
+}
+
+static void candy_net_reset_connection(candy_net_connection *connection,
+                                       candy_net_address address, uint64_t now_ns) {
+    *connection = {};
+    connection->address = address;
+    connection->connected = true;
+    connection->last_receive_ns = now_ns;
+    connection->stats_start_ns = now_ns;
+    for (uint32_t i = 0; i < NET_SEQUENCE_WINDOW; ++i) {
+        connection->received[i] = UINT32_MAX;
+        connection->sent[i].sequence = UINT32_MAX;
+    }
+}
+
+static candy_net_connection *candy_net_find(candy_net_endpoint *endpoint,
+                                            candy_net_address address) {
+    for (uint32_t i = 0; i < endpoint->max_connections; ++i) {
+        candy_net_connection *connection = &endpoint->connections[i];
+        if (connection->connected && connection->address.ip == address.ip &&
+            connection->address.port == address.port) {
+            return connection;
+        }
+    }
+    return nullptr;
+}
+
+// There is no handshake: the peer learns of us from the first packet we send
+candy_net_connection *candy_net_connect(candy_net_endpoint *endpoint,
+                                        candy_net_address address, uint64_t now_ns) {
+    candy_net_connection *connection = candy_net_find(endpoint, address);
+    if (connection) {
+        return connection;
+    }
+
+    for (uint32_t i = 0; i < endpoint->max_connections; ++i) {
+        if (!endpoint->connections[i].connected) {
+            candy_net_reset_connection(&endpoint->connections[i], address, now_ns);
+            return &endpoint->connections[i];
+        }
+    }
+    return nullptr;
+}
+
+// ============================================================================
+// RECEIVING
+// ============================================================================
+
+// Only the newest packet acked comes with how long the peer held on to the ack, so
+// only it gives a round trip sample; the wait for the peer's send tick is taken out.
+static void candy_net_ack_packet(candy_net_connection *connection, uint16_t sequence,
+                                 uint64_t now_ns, uint64_t ack_delay_ns, bool sample) {
+    candy_net_sent_packet *sent = &connection->sent[sequence % NET_SEQUENCE_WINDOW];
+    if (sent->sequence != sequence || sent->acked) {
+        return;
+    }
+    sent->acked = true;
+
+    uint64_t elapsed_ns = now_ns - sent->send_ns;
+    if (sample && elapsed_ns > ack_delay_ns) {
+        float rtt_ms = (float)((double)(elapsed_ns - ack_delay_ns) / 1e6);
+        float smoothed = connection->rtt_ms + (rtt_ms - connection->rtt_ms) * 0.1f;
+        connection->rtt_ms = connection->rtt_ms == 0.0f ? rtt_ms : smoothed;
+    }
+
+    // Messages the packet carried are through, the send window moves past them
+    for (uint32_t i = 0; i < sent->message_count; ++i) {
+        uint16_t id = sent->message_ids[i];
+        candy_net_message *message = &connection->send_queue[id % NET_RELIABLE_WINDOW];
+        if (message->used && message->id == id) {
+            message->used = false;
+        }
+    }
+    while (connection->oldest_unacked_id != connection->send_message_id &&
+           !connection->send_queue[connection->oldest_unacked_id % NET_RELIABLE_WINDOW]
+                .used) {
+        connection->oldest_unacked_id++;
+    }
+}
+
+// now_ns is when the packet arrived, which may be a little before the receive call
+static void candy_net_process_packet(candy_net_connection *connection,
+                                     candy_net_reader *r, uint64_t now_ns) {
+    uint16_t sequence = candy_net_read_u16(r);
+    uint16_t ack = candy_net_read_u16(r);
+    uint32_t ack_bits = candy_net_read_u32(r);
+    uint64_t ack_delay_ns = (uint64_t)candy_net_read_u16(r) * 100000;
+    uint8_t count_byte = candy_net_read_u8(r);
+    bool has_ack = (count_byte & NET_HAS_ACK) != 0;
+    uint32_t message_count = count_byte & ~NET_HAS_ACK;
+
+    // Parsed up front, nothing is applied unless the whole packet is valid
+    struct {
+        uint16_t id;
+        uint16_t size;
+        const uint8_t *data;
+    } messages[NET_PACKET_MESSAGES];
+    if (message_count > NET_PACKET_MESSAGES) {
+        r->overflow = true;
+        return;
+    }
+    for (uint32_t i = 0; i < message_count; ++i) {
+        messages[i].id = candy_net_read_u16(r);
+        messages[i].size = candy_net_read_u16(r);
+        if (messages[i].size == 0 || messages[i].size > NET_MAX_MESSAGE) {
+            r->overflow = true;
+            return;
+        }
+        messages[i].data = candy_net_read_skip(r, messages[i].size);
+    }
+    uint32_t snapshot_size = candy_net_read_u16(r);
+    const uint8_t *snapshot = candy_net_read_skip(r, snapshot_size);
+    if (r->overflow || r->offset != r->size) {
+        r->overflow = true;
+        return;
+    }
+
+    // Duplicates and packets too old to be acked any more are ignored whole. Slots
+    // hold the full sequence, so ones skipped over never ack a packet by mistake.
+    bool newest = !connection->received_any ||
+                  candy_net_sequence_greater(sequence, connection->remote_sequence);
+    uint32_t *slot = &connection->received[sequence % NET_SEQUENCE_WINDOW];
+    if (*slot == sequence ||
+        (!newest && (uint16_t)(connection->remote_sequence - sequence) >=
+                        NET_SEQUENCE_WINDOW)) {
+        return;
+    }
+
+    // Messages past the receive window, while the game has not read the older ones,
+    // would be lost once acked. Such packets are left unacked, to be sent again.
+    for (uint32_t i = 0; i < message_count; ++i) {
+        uint16_t id = messages[i].id;
+        if (!candy_net_sequence_greater(connection->receive_message_id, id) &&
+            (uint16_t)(id - connection->receive_message_id) >= NET_RELIABLE_WINDOW) {
+            return;
+        }
+    }
+    *slot = sequence;
+
+    if (newest) {
+        connection->remote_sequence = sequence;
+        connection->remote_receive_ns = now_ns;
+        connection->received_any = true;
+    }
+    connection->last_receive_ns = now_ns;
+    connection->stats_received_bytes += r->size + NET_UDP_OVERHEAD;
+
+    if (has_ack) {
+        candy_net_ack_packet(connection, ack, now_ns, ack_delay_ns, true);
+        for (uint32_t i = 0; i < 32; ++i) {
+            if (ack_bits & (1u << i)) {
+                candy_net_ack_packet(connection, (uint16_t)(ack - 1 - i), now_ns, 0,
+                                     false);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < message_count; ++i) {
+        uint16_t ahead = messages[i].id - connection->receive_message_id;
+        if (ahead >= NET_RELIABLE_WINDOW) {
+            continue; // delivered already
+        }
+        candy_net_message *message =
+            &connection->receive_queue[messages[i].id % NET_RELIABLE_WINDOW];
+        if (!message->used) {
+            message->used = true;
+            message->id = messages[i].id;
+            message->size = messages[i].size;
+            memcpy(message->data, messages[i].data, messages[i].size);
+        }
+    }
+
+    // Older snapshots arriving late are of no use
+    if (snapshot_size > 0 &&
+        (connection->receive_snapshot_size == 0 ||
+         candy_net_sequence_greater(sequence, connection->receive_snapshot_sequence))) {
+        memcpy(connection->receive_snapshot, snapshot, snapshot_size);
+        connection->receive_snapshot_size = snapshot_size;
+        connection->receive_snapshot_sequence = sequence;
+        connection->receive_snapshot_ns = now_ns;
+        connection->receive_snapshot_fresh = true;
+    }
+}
+
+// Loss is the share of remembered packets never acked, leaving out those young
+// enough to still be on their way
+static void candy_net_update_stats(candy_net_connection *connection, uint64_t now_ns) {
+    uint64_t grace_ns = (uint64_t)(std::max(connection->rtt_ms * 2.0f, 100.0f) * 1e6f);
+    uint32_t sent = 0;
+    uint32_t lost = 0;
+    for (uint32_t i = 0; i < NET_SEQUENCE_WINDOW; ++i) {
+        const candy_net_sent_packet *packet = &connection->sent[i];
+        if (packet->sequence != UINT32_MAX && now_ns - packet->send_ns >= grace_ns) {
+            sent++;
+            lost += !packet->acked;
+        }
+    }
+    connection->loss = sent > 0 ? (float)lost / (float)sent : 0.0f;
+
+    uint64_t elapsed_ns = now_ns - connection->stats_start_ns;
+    if (elapsed_ns >= 1000000000ull) {
+        float seconds = (float)((double)elapsed_ns / 1e9);
+        connection->sent_kbps = (float)connection->stats_sent_bytes * 0.008f / seconds;
+        connection->received_kbps =
+            (float)connection->stats_received_bytes * 0.008f / seconds;
+        connection->stats_sent_bytes = 0;
+        connection->stats_received_bytes = 0;
+        connection->stats_start_ns = now_ns;
+    }
+}
+
+// When the kernel stamped the packet, on the caller's clock. Stamps are realtime, so
+// they are taken as an age against the realtime clock now.
+static uint64_t candy_net_receive_time(msghdr *msg, uint64_t now_ns, int64_t real_ns) {
+    for (cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            int64_t stamp_ns = (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+            int64_t age_ns = std::clamp(real_ns - stamp_ns, (int64_t)0, (int64_t)now_ns);
+            return now_ns - (uint64_t)age_ns;
+        }
+    }
+    return now_ns;
+}
+
+// Reads every packet waiting on the socket, drops silent connections, refreshes the
+// estimates and sends delayed packets that are due
+void candy_net_receive(candy_net_endpoint *endpoint, uint64_t now_ns) {
+    uint8_t data[NET_MAX_PACKET + 1];
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(timespec))];
+
+    timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t real_ns = (int64_t)real.tv_sec * 1000000000ll + real.tv_nsec;
+
+    for (;;) {
+        sockaddr_in addr = {};
+        iovec iov = {.iov_base = data, .iov_len = sizeof(data)};
+        msghdr msg = {};
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t size = recvmsg(endpoint->fd, &msg, 0);
+        if (size < 0) {
+            break; // EAGAIN once the socket is empty
+        }
+        uint64_t receive_ns = candy_net_receive_time(&msg, now_ns, real_ns);
+
+        candy_net_reader r = {
+            .data = data,
+            .size = (uint32_t)size,
+            .offset = 0,
+            .overflow = false,
+        };
+        if (size > (ssize_t)NET_MAX_PACKET || size < (ssize_t)NET_HEADER_SIZE ||
+            candy_net_read_u32(&r) != NET_PROTOCOL_ID) {
+            endpoint->packets_invalid++;
+            continue;
+        }
+
+        candy_net_address from = {.ip = ntohl(addr.sin_addr.s_addr),
+                                   .port = ntohs(addr.sin_port)};
+        candy_net_connection *connection = candy_net_find(endpoint, from);
+        if (!connection && endpoint->accept_connections) {
+            connection = candy_net_connect(endpoint, from, now_ns);
+            if (connection) {
+                std::cout << "[CANDY NET] Port " << endpoint->port << ": peer "
+                          << from.port << " connected" << std::endl;
+            }
+        }
+        if (!connection) {
+            continue;
+        }
+
+        candy_net_process_packet(connection, &r, receive_ns);
+        if (r.overflow) {
+            endpoint->packets_invalid++;
+        }
+    }
+
+    for (uint32_t i = 0; i < endpoint->max_connections; ++i) {
+        candy_net_connection *connection = &endpoint->connections[i];
+        if (!connection->connected) {
+            continue;
+        }
+        if (now_ns - connection->last_receive_ns > NET_TIMEOUT_NS) {
+            std::cout << "[CANDY NET] Port " << endpoint->port << ": peer "
+                      << connection->address.port << " timed out" << std::endl;
+            connection->connected = false;
+            continue;
+        }
+        candy_net_update_stats(connection, now_ns);
+    }
+
+    candy_net_flush_delayed(endpoint, now_ns);
+}
+
+// Next in order reliable message, 0 when the next one has not arrived
+uint32_t candy_net_receive_message(candy_net_connection *connection, void *out,
+                                   uint32_t max_size) {
+    candy_net_message *message =
+        &connection->receive_queue[connection->receive_message_id % NET_RELIABLE_WINDOW];
+    if (!message->used || message->id != connection->receive_message_id ||
+        message->size > max_size) {
+        return 0;
+    }
+
+    memcpy(out, message->data, message->size);
+    message->used = false;
+    connection->receive_message_id++;
+    return message->size;
+}
+
+// Newest snapshot the peer sent, once; 0 when nothing newer arrived since
+uint32_t candy_net_receive_snapshot(candy_net_connection *connection, void *out,
+                                    uint32_t max_size) {
+    if (!connection->receive_snapshot_fresh ||
+        connection->receive_snapshot_size > max_size) {
+        return 0;
+    }
+    connection->receive_snapshot_fresh = false;
+    memcpy(out, connection->receive_snapshot, connection->receive_snapshot_size);
+    return connection->receive_snapshot_size;
+}
+
+// ============================================================================
+// SENDING
+// ============================================================================
+
+// Queues a message to arrive exactly once and in order. Fails while the window is
+// full of unacked messages.
+bool candy_net_send_message(candy_net_connection *connection, const void *data,
+                            uint32_t size) {
+    uint16_t in_flight = connection->send_message_id - connection->oldest_unacked_id;
+    if (size == 0 || size > NET_MAX_MESSAGE || in_flight >= NET_RELIABLE_WINDOW) {
+        return false;
+    }
+
+    uint16_t id = connection->send_message_id++;
+    candy_net_message *message = &connection->send_queue[id % NET_RELIABLE_WINDOW];
+    message->last_send_ns = 0;
+    message->id = id;
+    message->size = (uint16_t)size;
+    message->used = true;
+    memcpy(message->data, data, size);
+    return true;
+}
+
+// Replaces whatever the next packet would have carried; sent once, never resent
+void candy_net_set_snapshot(candy_net_connection *connection, const void *data,
+                            uint32_t size) {
+    uint32_t budget = NET_MAX_PACKET - NET_HEADER_SIZE - 2;
+    if (size > budget) {
+        std::cerr << "[CANDY NET] Snapshot of " << size << " bytes does not fit in "
+                  << budget << std::endl;
+        size = 0;
+    }
+    memcpy(connection->send_snapshot, data, size);
+    connection->send_snapshot_size = size;
+}
+
+bool candy_net_send_due(const candy_net_endpoint *endpoint, uint64_t now_ns) {
+    return now_ns >= endpoint->next_send_ns;
+}
+
+static void candy_net_send_connection(candy_net_endpoint *endpoint,
+                                      candy_net_connection *connection, uint64_t now_ns) {
+    uint8_t data[NET_MAX_PACKET];
+    candy_net_writer w = {.data = data, .size = 0, .capacity = NET_MAX_PACKET};
+
+    uint16_t sequence = connection->local_sequence++;
+    uint32_t ack_bits = 0;
+    for (uint32_t i = 0; i < 32; ++i) {
+        uint16_t s = (uint16_t)(connection->remote_sequence - 1 - i);
+        if (connection->received[s % NET_SEQUENCE_WINDOW] == s) {
+            ack_bits |= 1u << i;
+        }
+    }
+
+    candy_net_write_u32(&w, NET_PROTOCOL_ID);
+    candy_net_write_u16(&w, sequence);
+    candy_net_write_u16(&w, connection->remote_sequence);
+    candy_net_write_u32(&w, ack_bits);
+    uint64_t ack_delay = (now_ns - connection->remote_receive_ns) / 100000; // 0.1 ms
+    candy_net_write_u16(&w, (uint16_t)std::min(ack_delay, (uint64_t)UINT16_MAX));
+    uint32_t message_count_offset = w.size;
+    candy_net_write_u8(&w, 0);
+
+    candy_net_sent_packet *sent = &connection->sent[sequence % NET_SEQUENCE_WINDOW];
+    sent->sequence = sequence;
+    sent->send_ns = now_ns;
+    sent->acked = false;
+    sent->message_count = 0;
+
+    // Oldest first, new ones and those unacked for longer than a round trip or so.
+    // The snapshot's room is kept free.
+    uint64_t resend_ns = (uint64_t)(std::max(connection->rtt_ms * 1.25f, 30.0f) * 1e6f);
+    uint32_t budget = w.capacity - 2 - connection->send_snapshot_size;
+    uint16_t id = connection->oldest_unacked_id;
+    for (; id != connection->send_message_id; ++id) {
+        candy_net_message *message = &connection->send_queue[id % NET_RELIABLE_WINDOW];
+        if (!message->used ||
+            (message->last_send_ns != 0 && now_ns - message->last_send_ns < resend_ns)) {
+            continue;
+        }
+        if (w.size + 4 + message->size > budget ||
+            sent->message_count == NET_PACKET_MESSAGES) {
+            break;
+        }
+        candy_net_write_u16(&w, message->id);
+        candy_net_write_u16(&w, message->size);
+        candy_net_write_bytes(&w, message->data, message->size);
+        message->last_send_ns = now_ns;
+        sent->message_ids[sent->message_count++] = message->id;
+    }
+    data[message_count_offset] =
+        (uint8_t)sent->message_count | (connection->received_any ? NET_HAS_ACK : 0);
+
+    candy_net_write_u16(&w, (uint16_t)connection->send_snapshot_size);
+    candy_net_write_bytes(&w, connection->send_snapshot, connection->send_snapshot_size);
+    connection->send_snapshot_size = 0;
+
+    sent->size = w.size;
+    connection->stats_sent_bytes += w.size + NET_UDP_OVERHEAD;
+    candy_net_send_packet(endpoint, connection->address, data, w.size, now_ns);
+}
+
+// One packet to every connection, then waits for the next send tick. Ticks keep to
+// the fixed rate; a late call does not move the ones after it.
+void candy_net_send(candy_net_endpoint *endpoint, uint64_t now_ns) {
+    for (uint32_t i = 0; i < endpoint->max_connections; ++i) {
+        if (endpoint->connections[i].connected) {
+            candy_net_send_connection(endpoint, &endpoint->connections[i], now_ns);
+        }
+    }
+
+    uint64_t interval_ns = (uint64_t)(1e9 / endpoint->send_rate);
+    endpoint->next_send_ns += interval_ns;
+    if (endpoint->next_send_ns <= now_ns) {
+        endpoint->next_send_ns = now_ns + interval_ns;
+    }
+    candy_net_flush_delayed(endpoint, now_ns);
+}
+
+// ============================================================================
+// LOOPBACK TEST
+// ============================================================================
+
+constexpr uint32_t NET_TEST_PLAYERS = 16;
+constexpr uint32_t NET_TEST_MESSAGE_EVERY = 10; // send ticks between reliable messages
+constexpr uint32_t NET_TEST_KILL_EVERY = 30;    // send ticks between kill count changes
+
+// What the server sent, shared with the clients since they run in the same thread.
+// Send times by tick give the one way latency; a snapshot older than the history
+// is counted against the wrong send.
+struct candy_net_test_server {
+    candy_entity_store store;
+    uint32_t kills[NET_TEST_PLAYERS];
+    uint64_t tick_send_ns[SNAPSHOT_HISTORY];
+    candy_snapshot_history history;
+};
+
+struct candy_net_test_client {
+    candy_net_endpoint endpoint;
+    candy_net_connection *server;
+    candy_snapshot_history *history;
+    bool decoded_any;
+    uint32_t decoded_tick; // newest, sent back as the ack
+    bool server_acked_any;
+    uint32_t server_acked_tick; // what the server last heard of it
+    uint64_t snapshot_bytes;
+    uint32_t snapshot_failures;
+
+    uint32_t messages_sent;
+    uint32_t messages_received;
+    uint32_t out_of_order;
+    uint32_t snapshots;
+    double latency_ms_total;
+    double latency_ms_max;
+};
+
+// Sends a counter each way over the reliable channel, checking it arrives in order
+static void candy_net_test_messages(candy_net_connection *connection,
+                                    uint32_t *received, uint32_t *out_of_order) {
+    uint32_t counter;
+    while (candy_net_receive_message(connection, &counter, sizeof(counter)) > 0) {
+        *out_of_order += counter != *received;
+        (*received)++;
+    }
+}
+
+static uint64_t candy_net_test_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Half the players walk up and down, the rest stand still
+static void candy_net_test_move(candy_net_test_server *state, uint32_t tick) {
+    for (uint32_t p = 0; p < NET_TEST_PLAYERS; ++p) {
+        state->store.px[p] = (float)p * 0.1f - 0.8f;
+        state->store.py[p] = p % 2 ? 0.0f : std::sin((float)(tick + p) * 0.05f) * 0.5f;
+    }
+    if (tick % NET_TEST_KILL_EVERY == 0) {
+        state->kills[tick / NET_TEST_KILL_EVERY % NET_TEST_PLAYERS]++;
+    }
+}
+
+// Runs a server and client_count clients over 127.0.0.1 in this thread, every
+// endpoint sending through the conditions. The server sends its players as snapshots
+// delta encoded against what each client acked. Prints per client link estimates,
+// bandwidth, snapshot size and latency and whether every reliable message arrived
+// in order.
+void candy_net_loopback_test(uint32_t client_count,
+                             const candy_net_conditions *conditions, float seconds) {
+    client_count = std::min(std::max(client_count, 1u), 64u);
+
+    candy_net_endpoint server;
+    if (!candy_net_open(&server, 0, client_count, true, 30.0f)) {
+        return;
+    }
+    server.conditions = *conditions;
+
+    std::cout << "[CANDY NET] Loopback test: " << client_count << " clients, "
+              << conditions->latency_ms << " ms latency, " << conditions->jitter_ms
+              << " ms jitter, " << conditions->loss * 100.0f << "% loss, for " << seconds
+              << " s" << std::endl;
+
+    candy_net_test_client *clients =
+        (candy_net_test_client *)calloc(client_count, sizeof(candy_net_test_client));
+    uint32_t *server_received = (uint32_t *)calloc(client_count * 3, sizeof(uint32_t));
+    uint32_t *server_out_of_order = server_received + client_count;
+    uint32_t *server_sent = server_received + client_count * 2;
+
+    candy_net_test_server *state = (candy_net_test_server *)aligned_alloc(
+        alignof(candy_net_test_server), sizeof(candy_net_test_server));
+    void *store_memory = aligned_alloc(64, candy_entity_store_bytes(NET_TEST_PLAYERS));
+    if (!clients || !server_received || !state || !store_memory) {
+        std::cerr << "[CANDY NET] Failed to allocate the loopback test" << std::endl;
+        candy_net_close(&server);
+        free(clients);
+        free(server_received);
+        free(state);
+        free(store_memory);
+        return;
+    }
+    candy_entity_store_init(&state->store, NET_TEST_PLAYERS, store_memory);
+    for (uint32_t p = 0; p < NET_TEST_PLAYERS; ++p) {
+        candy_entity_create(&state->store);
+    }
+    memset(state->kills, 0, sizeof(state->kills));
+    memset(state->history.valid, 0, sizeof(state->history.valid));
+
+    uint64_t start_ns = candy_net_test_now();
+    for (uint32_t i = 0; i < client_count; ++i) {
+        candy_net_test_client *client = &clients[i];
+        client->history =
+            (candy_snapshot_history *)calloc(1, sizeof(candy_snapshot_history));
+        if (!client->history || !candy_net_open(&client->endpoint, 0, 1, false, 30.0f)) {
+            free(client->history);
+            client_count = i;
+            break;
+        }
+        client->endpoint.conditions = *conditions;
+        client->endpoint.rng ^= i * 0x9e3779b9u;
+        client->server = candy_net_connect(
+            &client->endpoint, candy_net_loopback_address(server.port), start_ns);
+    }
+
+    uint64_t end_ns = start_ns + (uint64_t)(seconds * 1e9f);
+    uint32_t tick = 0;
+    for (uint64_t now = start_ns; now < end_ns; now = candy_net_test_now()) {
+        candy_net_receive(&server, now);
+        for (uint32_t i = 0; i < client_count; ++i) {
+            candy_net_test_client *client = &clients[i];
+            candy_net_receive(&client->endpoint, now);
+
+            candy_net_test_messages(client->server, &client->messages_received,
+                                    &client->out_of_order);
+            uint8_t data[NET_MAX_PACKET];
+            uint32_t size =
+                candy_net_receive_snapshot(client->server, data, sizeof(data));
+            if (size > 0) {
+                const candy_snapshot *snapshot =
+                    candy_snapshot_decode(data, size, client->history);
+                if (snapshot) {
+                    uint64_t send_ns =
+                        state->tick_send_ns[snapshot->tick % SNAPSHOT_HISTORY];
+                    double latency_ms = (double)(now - send_ns) / 1e6;
+                    client->latency_ms_total += latency_ms;
+                    client->latency_ms_max = std::max(client->latency_ms_max, latency_ms);
+                    client->snapshot_bytes += size;
+                    client->snapshots++;
+                    client->decoded_any = true;
+                    client->decoded_tick = snapshot->tick;
+                } else {
+                    client->snapshot_failures++;
+                }
+            }
+
+            if (candy_net_send_due(&client->endpoint, now)) {
+                if (tick % NET_TEST_MESSAGE_EVERY == i % NET_TEST_MESSAGE_EVERY &&
+                    candy_net_send_message(client->server, &client->messages_sent,
+                                           sizeof(uint32_t))) {
+                    client->messages_sent++;
+                }
+                if (client->decoded_any) {
+                    candy_net_set_snapshot(client->server, &client->decoded_tick,
+                                           sizeof(uint32_t));
+                }
+                candy_net_send(&client->endpoint, now);
+            }
+        }
+
+        // Connections are told apart by port, the clients bound theirs in order
+        for (uint32_t c = 0; c < server.max_connections; ++c) {
+            candy_net_connection *connection = &server.connections[c];
+            for (uint32_t i = 0; i < client_count && connection->connected; ++i) {
+                if (connection->address.port != clients[i].endpoint.port) {
+                    continue;
+                }
+                candy_net_test_messages(connection, &server_received[i],
+                                        &server_out_of_order[i]);
+                uint32_t acked_tick;
+                if (candy_net_receive_snapshot(connection, &acked_tick,
+                                               sizeof(acked_tick)) == sizeof(uint32_t)) {
+                    clients[i].server_acked_any = true;
+                    clients[i].server_acked_tick = acked_tick;
+                }
+            }
+        }
+
+        if (candy_net_send_due(&server, now)) {
+            candy_net_test_move(state, tick);
+            candy_snapshot *snapshot =
+                candy_snapshot_history_store(&state->history, tick);
+            candy_snapshot_capture(&state->store, state->kills, tick, snapshot);
+            state->tick_send_ns[tick % SNAPSHOT_HISTORY] = now;
+
+            for (uint32_t c = 0; c < server.max_connections; ++c) {
+                candy_net_connection *connection = &server.connections[c];
+                for (uint32_t i = 0; i < client_count && connection->connected; ++i) {
+                    if (connection->address.port != clients[i].endpoint.port) {
+                        continue;
+                    }
+                    if (tick % NET_TEST_MESSAGE_EVERY == 0 &&
+                        candy_net_send_message(connection, &server_sent[i],
+                                               sizeof(uint32_t))) {
+                        server_sent[i]++;
+                    }
+
+                    // Too old a baseline is dropped by the encoder, which then
+                    // sends in full
+                    const candy_snapshot *baseline =
+                        clients[i].server_acked_any
+                            ? candy_snapshot_history_find(&state->history,
+                                                          clients[i].server_acked_tick)
+                            : nullptr;
+                    uint8_t data[NET_MAX_PACKET];
+                    uint32_t size =
+                        candy_snapshot_encode(snapshot, baseline, data, sizeof(data));
+                    candy_net_set_snapshot(connection, data, size);
+                }
+            }
+            candy_net_send(&server, now);
+            tick++;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for (uint32_t i = 0; i < client_count; ++i) {
+        const candy_net_test_client *client = &clients[i];
+        const candy_net_connection *link = client->server;
+        uint32_t snapshots = std::max(client->snapshots, 1u);
+        std::cout << "[CANDY NET] Client " << i << ": rtt " << link->rtt_ms
+                  << " ms, loss " << link->loss * 100.0f << "%, up " << link->sent_kbps
+                  << " kbps, down " << link->received_kbps << " kbps" << std::endl;
+        std::cout << "[CANDY NET] Client " << i << ": " << client->snapshots
+                  << " snapshots, " << client->snapshot_bytes / snapshots
+                  << " B avg, latency " << client->latency_ms_total / snapshots
+                  << " ms avg " << client->latency_ms_max << " ms max, "
+                  << client->snapshot_failures << " failed to decode" << std::endl;
+        std::cout << "[CANDY NET] Client " << i << ": reliable down "
+                  << client->messages_received << "/" << server_sent[i] << ", up "
+                  << server_received[i] << "/" << client->messages_sent << ", "
+                  << client->out_of_order + server_out_of_order[i] << " out of order"
+                  << std::endl;
+    }
+    std::cout << "[CANDY NET] Conditioner dropped " << server.packets_dropped
+              << " server packets, " << server.packets_invalid << " invalid received"
+              << std::endl;
+
+    for (uint32_t i = 0; i < client_count; ++i) {
+        candy_net_close(&clients[i].endpoint);
+        free(clients[i].history);
+    }
+    candy_net_close(&server);
+    free(state);
+    free(store_memory);
+    free(server_received);
+    free(clients);
+}
+
+// ============================================================================
+// SELF TEST
+// ============================================================================
+
+// Waits up to a second for a packet on the socket, loopback is all but instant
+static bool candy_net_test_wait(const candy_net_endpoint *endpoint) {
+    pollfd fd = {.fd = endpoint->fd, .events = POLLIN, .revents = 0};
+    return poll(&fd, 1, 1000) == 1;
+}
+
+// Two peers over 127.0.0.1. The first reliable message is lost with the packet
+// carrying it, then the other peer sends its first packet, having heard nothing.
+// That packet must not ack anything, so the message stays queued until it is sent
+// again and a real ack comes back.
+bool candy_net_test_first_ack() {
+    candy_net_endpoint a;
+    candy_net_endpoint b;
+    if (!candy_net_open(&a, 0, 1, false, 30.0f)) {
+        return false;
+    }
+    if (!candy_net_open(&b, 0, 1, false, 30.0f)) {
+        candy_net_close(&a);
+        return false;
+    }
+
+    uint64_t now = candy_net_test_now();
+    candy_net_connection *ab =
+        candy_net_connect(&a, candy_net_loopback_address(b.port), now);
+    candy_net_connection *ba =
+        candy_net_connect(&b, candy_net_loopback_address(a.port), now);
+    uint32_t sent = 0xcafe;
+    candy_net_send_message(ab, &sent, sizeof(sent));
+    a.conditions.loss = 1.0f;
+    candy_net_send(&a, now);
+    a.conditions.loss = 0.0f;
+
+    candy_net_send(&b, now);
+    uint8_t data[NET_MAX_PACKET];
+    bool first_arrived = candy_net_test_wait(&a) &&
+                         recv(a.fd, data, sizeof(data), MSG_PEEK) >= NET_HEADER_SIZE;
+    bool first_has_ack = first_arrived && (data[NET_HEADER_SIZE - 1] & NET_HAS_ACK);
+    candy_net_receive(&a, now);
+    bool kept = ab->oldest_unacked_id == 0 && ab->send_queue[0].used;
+
+    // Past the resend time the message goes again, and the answer acks it
+    now += 100000000ull;
+    candy_net_send(&a, now);
+    candy_net_test_wait(&b);
+    candy_net_receive(&b, now);
+    uint32_t received = 0;
+    bool delivered = candy_net_receive_message(ba, &received, sizeof(received)) ==
+                         sizeof(received) &&
+                     received == sent;
+    candy_net_send(&b, now);
+    candy_net_test_wait(&a);
+    candy_net_receive(&a, now);
+    bool acked = ab->oldest_unacked_id == 1 && !ab->send_queue[0].used;
+
+    candy_net_close(&a);
+    candy_net_close(&b);
+
+    bool passed = first_arrived && !first_has_ack && kept && delivered && acked;
+    std::cout << "[CANDY TEST] First packet from a fresh peer "
+              << (first_has_ack ? "carries" : "carries no") << " ack, message "
+              << (kept ? "kept" : "dropped") << " before a real ack, "
+              << (delivered && acked ? "then delivered and acked" : "then never acked")
+              << ": " << (passed ? "passed" : "FAILED") << std::endl;
+    return passed;
+}
@@ -0,0 +1,156 @@
+#include "candy_pacer.h"
+#include "candy_profiler.h"
+
+#include <time.h>
+
+// ============================================================================
+// FRAME PACING
+// ============================================================================
+
+// Sleeps in the kernel until PACER_SPIN_NS before the deadline, which covers the
+// scheduler's wake up jitter, then spins the rest.
+void candy_sleep_until_ns(uint64_t deadline_ns) {
+    uint64_t now = candy_time_ns();
+    if (now >= deadline_ns) {
+        return;
+    }
+
+    if (deadline_ns - now > PACER_SPIN_NS) {
+        uint64_t sleep_ns = deadline_ns - now - PACER_SPIN_NS;
+        timespec ts = {
+            .tv_sec = (time_t)(sleep_ns / 1000000000ull),
+            .tv_nsec = (long)(sleep_ns % 1000000000ull),
+        };
+        nanosleep(&ts, nullptr);
+    }
+
+    while (candy_time_ns() < deadline_ns) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+int candy_present_mode_index(VkPresentModeKHR mode) {
+    switch (mode) {
+    case VK_PRESENT_MODE_FIFO_KHR:
+        return 0;
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return 1;
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+const char *candy_present_mode_name(VkPresentModeKHR mode) {
+    switch (mode) {
+    case VK_PRESENT_MODE_FIFO_KHR:
+        return "FIFO";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return "MAILBOX";
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return "IMMEDIATE";
+    default:
+        return "OTHER";
+    }
+}
+
+void candy_init_frame_pacer(candy_context *ctx) {
+    candy_frame_pacer *pacer = &ctx->pacer;
+
+    pacer->target_fps = ctx->config.target_fps;
+    pacer->late_latch = ctx->config.late_latch;
+    pacer->requested_present_mode = ctx->config.present_mode;
+    pacer->deadline_ns = 0;
+    pacer->predicted_work_ns = 0.0;
+}
+
+static uint64_t candy_pacer_interval_ns(candy_frame_pacer *pacer) {
+    if (pacer->target_fps <= 0.0f) {
+        return 0;
+    }
+    return (uint64_t)(1e9 / (double)pacer->target_fps);
+}
+
+// Called before input is sampled
+void candy_pacer_begin_frame(candy_context *ctx) {
+    candy_frame_pacer *pacer = &ctx->pacer;
+
+    uint64_t interval = candy_pacer_interval_ns(pacer);
+    if (interval > 0 && pacer->late_latch && pacer->deadline_ns > 0) {
+        CANDY_ZONE("Pacer Late Latch");
+        // Wake just early enough for the predicted work to finish at the deadline
+        uint64_t work = (uint64_t)pacer->predicted_work_ns;
+        if (pacer->deadline_ns > work) {
+            candy_sleep_until_ns(pacer->deadline_ns - work);
+        }
+    }
+
+    pacer->frame_begin_ns = candy_time_ns();
+    pacer->input_ns = pacer->frame_begin_ns;
+}
+
+void candy_pacer_input_sampled(candy_context *ctx) {
+    ctx->pacer.input_ns = candy_time_ns();
+}
+
+void candy_pacer_frame_submitted(candy_context *ctx, uint32_t frame) {
+    ctx->pacer.frame_input_ns[frame] = ctx->pacer.input_ns;
+}
+
+// Called right after the frame slot's fence wait. The fence is only observed here, so
+// the latency is an upper bound on when the GPU finished, and FIFO adds up to a few
+// vblanks of queueing on top that we cannot see without display timing.
+void candy_pacer_frame_retired(candy_context *ctx, uint32_t frame) {
+    candy_frame_pacer *pacer = &ctx->pacer;
+    if (pacer->frame_input_ns[frame] == 0) {
+        return;
+    }
+
+    pacer->latency_ms = (float)((double)(candy_time_ns() - pacer->frame_input_ns[frame]) /
+                                1e6);
+    pacer->frame_input_ns[frame] = 0;
+}
+
+// Called after present
+void candy_pacer_end_frame(candy_context *ctx) {
+    candy_frame_pacer *pacer = &ctx->pacer;
+
+    uint64_t now = candy_time_ns();
+    double work_ns = (double)(now - pacer->frame_begin_ns);
+
+    // Rise at once, decay slowly: a late frame costs more than an early wake up
+    if (work_ns > pacer->predicted_work_ns) {
+        pacer->predicted_work_ns = work_ns;
+    } else {
+        pacer->predicted_work_ns = pacer->predicted_work_ns * 0.95 + work_ns * 0.05;
+    }
+
+    pacer->cpu_ms = (float)((double)(now - pacer->frame_begin_ns) / 1e6);
+    pacer->gpu_ms = candy_gpu_scope_ms(ctx, CANDY_GPU_SCOPE_FRAME);
+
+    uint32_t head = pacer->history_head;
+    pacer->cpu_history[head] = pacer->cpu_ms;
+    pacer->gpu_history[head] = pacer->gpu_ms;
+    pacer->latency_history[head] = pacer->latency_ms;
+    pacer->history_head = (head + 1) % PACER_HISTORY;
+
+    uint64_t interval = candy_pacer_interval_ns(pacer);
+    if (interval == 0) {
+        pacer->deadline_ns = 0;
+        return;
+    }
+
+    // Fell behind by more than a frame: resync instead of rushing to catch up
+    if (pacer->deadline_ns == 0 || now > pacer->deadline_ns + interval) {
+        pacer->deadline_ns = now;
+    }
+
+    if (!pacer->late_latch) {
+        CANDY_ZONE("Pacer Wait");
+        candy_sleep_until_ns(pacer->deadline_ns);
+    }
+    pacer->deadline_ns += interval;
+}
@@ -0,0 +1,148 @@
+#include "candy_predict.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// ============================================================================
+// PREDICTION
+// ============================================================================
+
+// The player starts where candy_match_init puts it, at rest in the origin
+void candy_predict_init(candy_predict *predict, float dt) {
+    predict->next_tick = 0;
+    predict->acked_tick = MATCH_NO_TICK;
+    predict->motion = {};
+    predict->params = candy_match_integrate_params(dt);
+    predict->keep = candy_integrate_keep(&predict->params);
+    memset(predict->buttons, 0, sizeof(predict->buttons));
+    predict->replayed = 0;
+    predict->error = 0.0f;
+    predict->corrections = 0;
+}
+
+// Records one tick of buttons and moves the player by it. Returns its command tick.
+uint32_t candy_predict_command(candy_predict *predict, uint8_t buttons) {
+    uint32_t tick = predict->next_tick++;
+    predict->buttons[tick % PREDICT_HISTORY] = buttons;
+    candy_match_move(&predict->motion, buttons, &predict->params, predict->keep);
+    return tick;
+}
+
+// The newest commands, for the next input packet; acked_tick is left to the caller
+void candy_predict_fill_input(const candy_predict *predict, candy_match_input *input) {
+    input->count = std::min(predict->next_tick, MATCH_INPUT_COMMANDS);
+    input->first_tick = predict->next_tick - input->count;
+    for (uint32_t i = 0; i < input->count; ++i) {
+        input->buttons[i] = predict->buttons[(input->first_tick + i) % PREDICT_HISTORY];
+    }
+}
+
+// Takes the server's word for where the player was after command input_tick, then
+// replays every command after it. An ack older than one already taken is ignored;
+// commands too old for the history are lost, and only the newest are replayed.
+void candy_predict_reconcile(candy_predict *predict, uint32_t input_tick,
+                             const candy_match_motion *server) {
+    if (input_tick != MATCH_NO_TICK && predict->acked_tick != MATCH_NO_TICK &&
+        (int32_t)(input_tick - predict->acked_tick) < 0) {
+        return;
+    }
+    predict->acked_tick = input_tick;
+
+    // With none applied yet, the server's player has seen none of ours
+    uint32_t first = input_tick == MATCH_NO_TICK ? 0 : input_tick + 1;
+    uint32_t pending = predict->next_tick - first;
+    if (pending > PREDICT_HISTORY) {
+        first = predict->next_tick - PREDICT_HISTORY;
+        pending = PREDICT_HISTORY;
+    }
+
+    candy_match_motion predicted = predict->motion;
+    predict->motion = *server;
+    for (uint32_t i = 0; i < pending; ++i) {
+        uint8_t buttons = predict->buttons[(first + i) % PREDICT_HISTORY];
+        candy_match_move(&predict->motion, buttons, &predict->params, predict->keep);
+    }
+    predict->replayed = pending;
+
+    float dx = predict->motion.p[0] - predicted.p[0];
+    float dy = predict->motion.p[1] - predicted.p[1];
+    float dz = predict->motion.p[2] - predicted.p[2];
+    predict->error = std::sqrt(dx * dx + dy * dy + dz * dz);
+    predict->corrections += predict->error > 0.0f;
+}
+
+// ============================================================================
+// PREDICTION BENCHMARK
+// ============================================================================
+
+// Drives player 0 of a real match and a prediction with the same random buttons and
+// checks they stay equal bit for bit, then times reconciles that replay the whole
+// history, the worst case a client can hit
+void candy_predict_bench() {
+    using clock = std::chrono::steady_clock;
+    constexpr uint32_t TICKS = 600;
+    constexpr uint32_t REPEATS = 2000;
+    const float dt = 1.0f / 60.0f;
+
+    candy_match match_data;
+    candy_match *match = &match_data;
+    void *match_memory = aligned_alloc(64, candy_match_bytes(MATCH_MAX_PLAYERS));
+    candy_predict *predict = (candy_predict *)malloc(sizeof(candy_predict));
+    if (!match_memory || !predict) {
+        std::cerr << "[CANDY BENCH] Failed to allocate the prediction benchmark"
+                  << std::endl;
+        free(match_memory);
+        free(predict);
+        return;
+    }
+    candy_match_init(match, MATCH_MAX_PLAYERS, match_memory);
+    candy_predict_init(predict, dt);
+
+    uint32_t seed = 0x9e3779b9u;
+    uint32_t mismatches = 0;
+    uint8_t buttons[MATCH_MAX_PLAYERS] = {};
+    for (uint32_t t = 0; t < TICKS; ++t) {
+        // Held for a while, like a player would
+        if (t % 20 == 0) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            buttons[0] = (uint8_t)(seed & 0x1f);
+        }
+        candy_match_tick(match, buttons, dt);
+        candy_predict_command(predict, buttons[0]);
+
+        candy_match_motion actual;
+        candy_match_get_motion(match, 0, &actual);
+        mismatches += memcmp(&actual, &predict->motion, sizeof(actual)) != 0;
+    }
+
+    // Fill the history, then reconcile against the oldest command every time
+    for (uint32_t t = TICKS; t < PREDICT_HISTORY + 1; ++t) {
+        candy_predict_command(predict, (uint8_t)(t / 20 % 16));
+    }
+    candy_match_motion server = predict->motion;
+    uint32_t input_tick = predict->next_tick - PREDICT_HISTORY;
+
+    clock::time_point start = clock::now();
+    for (uint32_t r = 0; r < REPEATS; ++r) {
+        candy_predict_reconcile(predict, input_tick, &server);
+    }
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock::now() - start)
+                    .count();
+    uint64_t replayed = (uint64_t)REPEATS * predict->replayed;
+
+    std::cout << "[CANDY BENCH] Prediction: " << TICKS << " ticks, " << mismatches
+              << " differing from the match" << std::endl;
+    std::cout << "[CANDY BENCH] Replay: " << ns / replayed << " ns per tick, "
+              << predict->replayed << " ticks in " << ns / REPEATS / 1e3 << " us"
+              << std::endl;
+
+    free(predict);
+    free(match_memory);
+}
@@ -0,0 +1,272 @@
+#include "candy_profiler.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// ============================================================================
+// CPU ZONE PROFILER
+// ============================================================================
+
+// Zones are recorded from any thread, including ones that never see the
+// candy_context, so the rings live here rather than in the context.
+
+struct candy_zone_event {
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// Written only by its owning thread. head is published with release so a reader
+// that acquires it sees every event below it. A thread hands its ring back when it
+// exits and the next new thread takes it over; head keeps counting, so a trace being
+// written meanwhile still sees which events were overwritten.
+struct candy_zone_ring {
+    candy_zone_event events[ZONE_RING_SIZE];
+    std::atomic<uint64_t> head;
+    std::atomic<bool> in_use;
+    uint32_t thread_id;
+    char thread_name[32];
+};
+
+static candy_zone_ring *candy_zone_rings[MAX_ZONE_THREADS];
+static std::atomic<uint32_t> candy_zone_ring_count{0};
+static std::mutex candy_zone_registry_mutex;
+// Bumped by every shutdown, rings taken before it are gone
+static std::atomic<uint32_t> candy_zone_generation{0};
+static thread_local candy_zone_ring *candy_tls_zone_ring = nullptr;
+static thread_local uint32_t candy_tls_zone_generation = 0;
+static thread_local bool candy_tls_zone_overflow = false;
+
+// Tick to nanosecond conversion, calibrated against steady_clock
+static uint64_t candy_zone_origin_ticks;
+static std::chrono::steady_clock::time_point candy_zone_origin_time;
+
+// Capture state, only touched by the thread calling candy_profiler_frame_end
+static uint32_t candy_capture_requested;
+static uint32_t candy_capture_frames;
+static uint32_t candy_capture_remaining;
+static uint64_t candy_capture_start;
+static uint32_t candy_capture_index;
+static bool candy_capture_active;
+
+// Hands the thread's ring back, unless a shutdown freed it already
+static void candy_zone_release_thread() {
+    std::lock_guard<std::mutex> lock(candy_zone_registry_mutex);
+
+    candy_zone_ring *ring = candy_tls_zone_ring;
+    if (ring && candy_tls_zone_generation ==
+                    candy_zone_generation.load(std::memory_order_relaxed)) {
+        ring->in_use.store(false, std::memory_order_release);
+    }
+    candy_tls_zone_ring = nullptr;
+}
+
+// Destroyed when its thread exits, once the thread has recorded a zone
+struct candy_zone_thread_exit {
+    ~candy_zone_thread_exit() { candy_zone_release_thread(); }
+};
+
+static thread_local candy_zone_thread_exit candy_tls_zone_exit;
+
+static candy_zone_ring *candy_zone_register_thread() {
+    std::lock_guard<std::mutex> lock(candy_zone_registry_mutex);
+    (void)&candy_tls_zone_exit; // constructs it, so the ring goes back on exit
+
+    candy_tls_zone_generation = candy_zone_generation.load(std::memory_order_relaxed);
+    uint32_t count = candy_zone_ring_count.load(std::memory_order_relaxed);
+    candy_zone_ring *ring = nullptr;
+    for (uint32_t i = 0; i < count && !ring; ++i) {
+        if (!candy_zone_rings[i]->in_use.load(std::memory_order_acquire)) {
+            ring = candy_zone_rings[i];
+        }
+    }
+
+    if (!ring) {
+        if (count >= MAX_ZONE_THREADS) {
+            std::cerr << "[CANDY PROFILER] More than " << MAX_ZONE_THREADS
+                      << " threads at once, zones of this thread are dropped"
+                      << std::endl;
+            candy_tls_zone_overflow = true;
+            return nullptr;
+        }
+        ring = (candy_zone_ring *)calloc(1, sizeof(candy_zone_ring));
+        if (!ring) {
+            candy_tls_zone_overflow = true;
+            return nullptr;
+        }
+        ring->thread_id = count;
+        candy_zone_rings[count] = ring;
+        candy_zone_ring_count.store(count + 1, std::memory_order_release);
+    }
+
+    ring->in_use.store(true, std::memory_order_relaxed);
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %u", ring->thread_id);
+    return ring;
+}
+
+// The calling thread's ring, taken on its first zone and again after a shutdown
+// freed it. nullptr for a thread that found every ring taken.
+static candy_zone_ring *candy_zone_thread_ring() {
+    uint32_t generation = candy_zone_generation.load(std::memory_order_relaxed);
+    if (candy_tls_zone_generation != generation) {
+        candy_tls_zone_ring = nullptr;
+        candy_tls_zone_overflow = false;
+    }
+    if (!candy_tls_zone_ring && !candy_tls_zone_overflow) {
+        candy_tls_zone_ring = candy_zone_register_thread();
+    }
+    return candy_tls_zone_ring;
+}
+
+void candy_zone_emit(const char *name, uint64_t begin, uint64_t end) {
+    candy_zone_ring *ring = candy_zone_thread_ring();
+    if (!ring) {
+        return;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->events[head & (ZONE_RING_SIZE - 1)] = {name, begin, end};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void candy_zone_thread_name(const char *name) {
+    candy_zone_ring *ring = candy_zone_thread_ring();
+    if (ring) {
+        snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+    }
+}
+
+void candy_profiler_init() {
+    candy_zone_origin_ticks = candy_zone_now();
+    candy_zone_origin_time = std::chrono::steady_clock::now();
+    candy_zone_thread_name("main");
+}
+
+// Frees every ring. Threads that still run must not be recording zones meanwhile;
+// the generation tells them their ring is gone, so the next zone they record takes a
+// fresh one instead of writing into freed memory.
+void candy_profiler_shutdown() {
+    std::lock_guard<std::mutex> lock(candy_zone_registry_mutex);
+
+    uint32_t count = candy_zone_ring_count.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < count; ++i) {
+        free(candy_zone_rings[i]);
+        candy_zone_rings[i] = nullptr;
+    }
+    candy_zone_ring_count.store(0, std::memory_order_release);
+    candy_zone_generation.fetch_add(1, std::memory_order_relaxed);
+    candy_tls_zone_ring = nullptr;
+    candy_tls_zone_overflow = false;
+}
+
+static double candy_zone_ns_per_tick() {
+    uint64_t ticks = candy_zone_now() - candy_zone_origin_ticks;
+    std::chrono::steady_clock::duration elapsed =
+        std::chrono::steady_clock::now() - candy_zone_origin_time;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    return ticks > 0 ? ns / (double)ticks : 1.0;
+}
+
+// Copies the events in [start, end] out of every ring. Events overwritten by their
+// thread while being copied are detected from the head moving and dropped.
+static void candy_profiler_write_trace(const char *path, uint64_t start, uint64_t end) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        std::cerr << "[CANDY PROFILER] Failed to open " << path << std::endl;
+        return;
+    }
+
+    double ns_per_tick = candy_zone_ns_per_tick();
+    std::vector<candy_zone_event> events;
+    uint32_t event_count = 0;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first_line = true;
+
+    uint32_t ring_count = candy_zone_ring_count.load(std::memory_order_acquire);
+    for (uint32_t r = 0; r < ring_count; ++r) {
+        candy_zone_ring *ring = candy_zone_rings[r];
+
+        fprintf(file,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"name\":\"%s\"}}",
+                first_line ? "" : ",\n", ring->thread_id, ring->thread_name);
+        first_line = false;
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > ZONE_RING_SIZE ? head - ZONE_RING_SIZE : 0;
+
+        events.clear();
+        for (uint64_t i = first; i < head; ++i) {
+            events.push_back(ring->events[i & (ZONE_RING_SIZE - 1)]);
+        }
+
+        // The owner may be writing event head_after already, over the oldest one
+        uint64_t head_after = ring->head.load(std::memory_order_acquire);
+        uint64_t valid_from =
+            head_after >= ZONE_RING_SIZE ? head_after + 1 - ZONE_RING_SIZE : 0;
+
+        for (uint64_t i = first; i < head; ++i) {
+            candy_zone_event *event = &events[i - first];
+            if (i < valid_from || event->begin < start || event->end > end) {
+                continue;
+            }
+
+            double ts_us =
+                (double)(event->begin - candy_zone_origin_ticks) * ns_per_tick / 1000.0;
+            double dur_us = (double)(event->end - event->begin) * ns_per_tick / 1000.0;
+            fprintf(file,
+                    ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                    "\"dur\":%.3f}",
+                    event->name, ring->thread_id, ts_us, dur_us);
+            event_count++;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    std::cout << "[CANDY PROFILER] Wrote " << event_count << " zones over "
+              << candy_capture_frames << " frames to " << path << std::endl;
+}
+
+void candy_profiler_capture(uint32_t frame_count) {
+    if (frame_count == 0 || candy_capture_active) {
+        return;
+    }
+    candy_capture_requested = frame_count;
+}
+
+bool candy_profiler_capturing() {
+    return candy_capture_active || candy_capture_requested > 0;
+}
+
+void candy_profiler_frame_end() {
+    uint64_t now = candy_zone_now();
+
+    if (candy_capture_active) {
+        if (--candy_capture_remaining > 0) {
+            return;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "candy_trace_%u.json", candy_capture_index++);
+        candy_profiler_write_trace(path, candy_capture_start, now);
+        candy_capture_active = false;
+        return;
+    }
+
+    // Captures start on a frame boundary
+    if (candy_capture_requested > 0) {
+        candy_capture_frames = candy_capture_requested;
+        candy_capture_remaining = candy_capture_requested;
+        candy_capture_requested = 0;
+        candy_capture_start = now;
+        candy_capture_active = true;
+    }
+}
@@ -0,0 +1,265 @@
+#include "candy_record.h"
+#include "candy_culling.h"
+#include "candy_imgui.h"
+#include "candy_profiler.h"
+
+// ============================================================================
+// MULTI-THREADED RECORDING
+// ============================================================================
+
+static void candy_record_scene_slice(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                     uint32_t frame, uint32_t first_instance,
+                                     uint32_t instance_count) {
+    // Nothing is inherited from the primary besides the render pass
+    vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      ctx->pipeline.graphics_pipeline);
+
+    VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = (float)ctx->swapchain.extent.width,
+        .height = (float)ctx->swapchain.extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {
+        .offset = {0, 0},
+        .extent = ctx->swapchain.extent,
+    };
+    vkCmdSetScissor(cmd_buffer, 0, 1, &scissor);
+
+    VkBuffer vertex_buffers[] = {ctx->core.vertex_buffer, ctx->instances.buffers[frame]};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdBindVertexBuffers(cmd_buffer, 0, 2, vertex_buffers, offsets);
+
+    if (ctx->culling.enabled) {
+        candy_record_indirect_draws(ctx, cmd_buffer, frame, first_instance,
+                                    instance_count);
+    } else {
+        vkCmdDraw(cmd_buffer, 3, instance_count, 0, first_instance);
+    }
+}
+
+static void candy_record_task(candy_context *ctx, uint32_t index) {
+    candy_recorder *recorder = &ctx->recorder;
+    candy_record_thread *thread = &recorder->threads[index];
+    uint32_t frame = recorder->frame;
+
+    bool imgui_task = index >= recorder->scene_thread_count;
+    thread->recorded = false;
+    if (!imgui_task && index >= recorder->slice_count) {
+        return;
+    }
+
+    // The frame's fence has been waited on, nothing from this pool is in flight
+    vkResetCommandPool(ctx->core.logical_device, thread->command_pools[frame], 0);
+
+    VkCommandBufferInheritanceInfo inheritance = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = nullptr,
+        .renderPass = imgui_task ? ctx->imgui.render_pass : ctx->pipeline.render_pass,
+        .subpass = 0,
+        .framebuffer = ctx->swapchain.framebuffers[recorder->image_index],
+        .occlusionQueryEnable = VK_FALSE,
+        .queryFlags = 0,
+        .pipelineStatistics = 0,
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = nullptr,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                 VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = &inheritance,
+    };
+
+    VkCommandBuffer cmd_buffer = thread->command_buffers[frame];
+    VkResult result = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to begin secondary command buffer");
+
+    if (imgui_task) {
+        candy_imgui_record(ctx, cmd_buffer);
+    } else {
+        uint32_t count = ctx->instances.count;
+        uint32_t per_slice = (count + recorder->slice_count - 1) / recorder->slice_count;
+        uint32_t first = index * per_slice;
+        uint32_t end = std::min(first + per_slice, count);
+        if (first < end) {
+            candy_record_scene_slice(ctx, cmd_buffer, frame, first, end - first);
+        }
+    }
+
+    result = vkEndCommandBuffer(cmd_buffer);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to record secondary command buffer");
+    thread->recorded = true;
+}
+
+static void candy_record_worker(candy_context *ctx, uint32_t index) {
+    candy_recorder *recorder = &ctx->recorder;
+    uint64_t seen_generation = 0;
+
+    char name[16];
+    snprintf(name, sizeof(name), "record %u", index);
+    candy_zone_thread_name(name);
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(recorder->mutex);
+            recorder->work_cv.wait(lock, [&] {
+                return recorder->quit || recorder->generation != seen_generation;
+            });
+            if (recorder->quit) {
+                return;
+            }
+            seen_generation = recorder->generation;
+        }
+
+        {
+            CANDY_ZONE("Record Secondary");
+            candy_record_task(ctx, index);
+        }
+
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        if (--recorder->pending == 0) {
+            recorder->done_cv.notify_one();
+        }
+    }
+}
+
+void candy_init_recorder(candy_context *ctx) {
+    candy_recorder *recorder = &ctx->recorder;
+
+    // One core is left to the main thread, which records the primary meanwhile
+    uint32_t cores = std::thread::hardware_concurrency();
+    uint32_t thread_count = cores > 1 ? cores - 1 : 1;
+    thread_count = std::clamp(thread_count, 2u, MAX_RECORD_THREADS);
+
+    recorder->thread_count = thread_count;
+    recorder->scene_thread_count = ctx->config.headless ? thread_count : thread_count - 1;
+    recorder->generation = 0;
+    recorder->pending = 0;
+    recorder->quit = false;
+
+    for (uint32_t t = 0; t < thread_count; ++t) {
+        candy_record_thread *thread = &recorder->threads[t];
+
+        for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+            VkCommandPoolCreateInfo pool_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = ctx->core.graphics_queue_family,
+            };
+
+            VkResult result = vkCreateCommandPool(ctx->core.logical_device, &pool_info,
+                                                  nullptr, &thread->command_pools[i]);
+            CANDY_ASSERT(result == VK_SUCCESS, "Failed to create worker command pool");
+
+            VkCommandBufferAllocateInfo alloc_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .commandPool = thread->command_pools[i],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+
+            result = vkAllocateCommandBuffers(ctx->core.logical_device, &alloc_info,
+                                              &thread->command_buffers[i]);
+            CANDY_ASSERT(result == VK_SUCCESS, "Failed to allocate secondary buffer");
+        }
+
+        thread->recorded = false;
+        thread->thread = std::thread(candy_record_worker, ctx, t);
+    }
+
+    std::cout << "[CANDY] Recording on " << recorder->scene_thread_count
+              << " scene threads" << (ctx->config.headless ? "" : " + 1 ImGui thread")
+              << std::endl;
+}
+
+void candy_destroy_recorder(candy_context *ctx) {
+    candy_recorder *recorder = &ctx->recorder;
+
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->quit = true;
+    }
+    recorder->work_cv.notify_all();
+
+    for (uint32_t t = 0; t < recorder->thread_count; ++t) {
+        candy_record_thread *thread = &recorder->threads[t];
+        thread->thread.join();
+
+        // Destroying the pool frees its command buffers
+        for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+            vkDestroyCommandPool(ctx->core.logical_device, thread->command_pools[i],
+                                 nullptr);
+        }
+    }
+    recorder->thread_count = 0;
+}
+
+// Wakes the workers to record this frame's secondaries. Instance data and the ImGui
+// draw data must be final, and must not change until candy_record_secondaries_wait.
+void candy_record_secondaries_begin(candy_context *ctx, uint32_t frame,
+                                    uint32_t image_index) {
+    candy_recorder *recorder = &ctx->recorder;
+
+    // Small scenes stay on one thread, the wake up costs more than the recording.
+    // The count buffer path draws all visible objects with a single command.
+    uint32_t slice_count =
+        (ctx->instances.count + MIN_INSTANCES_PER_SLICE - 1) / MIN_INSTANCES_PER_SLICE;
+    if (ctx->culling.enabled && ctx->culling.cmd_draw_indexed_indirect_count) {
+        slice_count = 1;
+    }
+    slice_count = std::clamp(slice_count, 1u, recorder->scene_thread_count);
+
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->frame = frame;
+        recorder->image_index = image_index;
+        recorder->slice_count = slice_count;
+        recorder->pending = recorder->thread_count;
+        recorder->generation++;
+    }
+    recorder->work_cv.notify_all();
+}
+
+void candy_record_secondaries_wait(candy_context *ctx) {
+    CANDY_ZONE("Wait Secondaries");
+    candy_recorder *recorder = &ctx->recorder;
+
+    std::unique_lock<std::mutex> lock(recorder->mutex);
+    recorder->done_cv.wait(lock, [&] { return recorder->pending == 0; });
+}
+
+// Must be called inside the main render pass, begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+void candy_execute_scene_secondaries(candy_context *ctx, VkCommandBuffer cmd_buffer) {
+    candy_recorder *recorder = &ctx->recorder;
+
+    VkCommandBuffer secondaries[MAX_RECORD_THREADS];
+    uint32_t count = 0;
+    for (uint32_t t = 0; t < recorder->scene_thread_count; ++t) {
+        if (recorder->threads[t].recorded) {
+            secondaries[count++] = recorder->threads[t].command_buffers[recorder->frame];
+        }
+    }
+
+    if (count > 0) {
+        vkCmdExecuteCommands(cmd_buffer, count, secondaries);
+    }
+}
+
+// This frame's ImGui pass, or VK_NULL_HANDLE in headless mode
+VkCommandBuffer candy_imgui_secondary(candy_context *ctx) {
+    candy_recorder *recorder = &ctx->recorder;
+    candy_record_thread *thread = &recorder->threads[recorder->thread_count - 1];
+
+    if (recorder->scene_thread_count == recorder->thread_count || !thread->recorded) {
+        return VK_NULL_HANDLE;
+    }
+    return thread->command_buffers[recorder->frame];
+}
@@ -0,0 +1,254 @@
+#include "candy_reflect.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// ============================================================================
+// STATE MIGRATION
+// ============================================================================
+
+constexpr uint32_t LAYOUT_MAX_DEPTH = 8;
+
+static bool candy_validate_layout_depth(const candy_state_layout *layout,
+                                        uint32_t depth) {
+    if (depth > LAYOUT_MAX_DEPTH) {
+        std::cerr << "[CANDY RELOAD] State layout nested too deep" << std::endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < layout->field_count; ++i) {
+        const candy_state_field *field = &layout->fields[i];
+
+        uint64_t end = (uint64_t)field->offset + (uint64_t)field->size * field->count;
+        if (!field->name || field->size == 0 || end > layout->size) {
+            std::cerr << "[CANDY RELOAD] Field " << (field->name ? field->name : "?")
+                      << " lies outside its " << layout->size << " byte struct"
+                      << std::endl;
+            return false;
+        }
+
+        bool scalar = field->type == CANDY_FIELD_INT || field->type == CANDY_FIELD_UINT ||
+                      field->type == CANDY_FIELD_FLOAT || field->type == CANDY_FIELD_BOOL;
+        bool width_ok = field->type == CANDY_FIELD_FLOAT
+                            ? field->size == 4 || field->size == 8
+                            : field->size <= 8;
+        if (scalar && !width_ok) {
+            std::cerr << "[CANDY RELOAD] Scalar field " << field->name << " is "
+                      << field->size << " bytes" << std::endl;
+            return false;
+        }
+
+        if (field->type == CANDY_FIELD_STRUCT) {
+            if (!field->element || field->element->size != field->size ||
+                !candy_validate_layout_depth(field->element, depth + 1)) {
+                std::cerr << "[CANDY RELOAD] Bad element layout for " << field->name
+                          << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Checks what the engine relies on before any of the module's tables are used
+bool candy_validate_layout(const candy_state_layout *layout) {
+    return candy_validate_layout_depth(layout, 0);
+}
+
+static uint32_t candy_hash_bytes(uint32_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a over every name, offset, size, count and type. Equal hashes mean the state
+// can be kept as it is.
+uint32_t candy_layout_hash(const candy_state_layout *layout) {
+    uint32_t hash = 2166136261u;
+    hash = candy_hash_bytes(hash, &layout->size, sizeof(layout->size));
+
+    for (uint32_t i = 0; i < layout->field_count; ++i) {
+        const candy_state_field *field = &layout->fields[i];
+        hash = candy_hash_bytes(hash, field->name, strlen(field->name) + 1);
+        uint32_t shape[4] = {field->offset, field->size, field->count, field->type};
+        hash = candy_hash_bytes(hash, shape, sizeof(shape));
+
+        if (field->type == CANDY_FIELD_STRUCT) {
+            uint32_t element_hash = candy_layout_hash(field->element);
+            hash = candy_hash_bytes(hash, &element_hash, sizeof(element_hash));
+        }
+    }
+    return hash;
+}
+
+static const candy_state_field *candy_find_field(const candy_state_layout *layout,
+                                                 const char *name) {
+    for (uint32_t i = 0; i < layout->field_count; ++i) {
+        if (strcmp(layout->fields[i].name, name) == 0) {
+            return &layout->fields[i];
+        }
+    }
+    return nullptr;
+}
+
+static bool candy_field_is_numeric(candy_field_type type) {
+    return type == CANDY_FIELD_BOOL || type == CANDY_FIELD_INT ||
+           type == CANDY_FIELD_UINT || type == CANDY_FIELD_FLOAT;
+}
+
+static double candy_read_scalar(const uint8_t *src, candy_field_type type,
+                                uint32_t size) {
+    switch (type) {
+    case CANDY_FIELD_FLOAT:
+        return size == 4 ? (double)*(const float *)src : *(const double *)src;
+    case CANDY_FIELD_INT: {
+        int64_t value = 0;
+        memcpy(&value, src, size);
+        // Sign extend from the field's width
+        uint32_t shift = 64 - size * 8;
+        return (double)((value << shift) >> shift);
+    }
+    default: {
+        uint64_t value = 0;
+        memcpy(&value, src, size);
+        return (double)value;
+    }
+    }
+}
+
+static void candy_write_scalar(uint8_t *dst, candy_field_type type, uint32_t size,
+                               double value) {
+    switch (type) {
+    case CANDY_FIELD_FLOAT:
+        if (size == 4) {
+            *(float *)dst = (float)value;
+        } else {
+            *(double *)dst = value;
+        }
+        break;
+    case CANDY_FIELD_BOOL:
+        *dst = value != 0.0;
+        break;
+    case CANDY_FIELD_INT: {
+        int64_t converted = (int64_t)value;
+        memcpy(dst, &converted, size);
+        break;
+    }
+    default: {
+        uint64_t converted = value < 0.0 ? 0 : (uint64_t)value;
+        memcpy(dst, &converted, size);
+        break;
+    }
+    }
+}
+
+static void candy_migrate_fields(const candy_state_layout *old_layout,
+                                 const uint8_t *old_base,
+                                 const candy_state_layout *new_layout, uint8_t *new_base,
+                                 candy_migrate_stats *stats, bool log);
+
+// New fields and elements with nothing to take over from. The state was zeroed, so
+// only explicit defaults are written.
+static void candy_default_element(const candy_state_field *field, uint8_t *dst) {
+    if (field->default_value) {
+        memcpy(dst, field->default_value, field->size);
+    } else if (field->type == CANDY_FIELD_STRUCT) {
+        candy_migrate_fields(nullptr, nullptr, field->element, dst, nullptr, false);
+    }
+}
+
+static void candy_migrate_fields(const candy_state_layout *old_layout,
+                                 const uint8_t *old_base,
+                                 const candy_state_layout *new_layout, uint8_t *new_base,
+                                 candy_migrate_stats *stats, bool log) {
+    for (uint32_t i = 0; i < new_layout->field_count; ++i) {
+        const candy_state_field *field = &new_layout->fields[i];
+        uint8_t *dst = new_base + field->offset;
+
+        const candy_state_field *old_field =
+            old_layout ? candy_find_field(old_layout, field->name) : nullptr;
+
+        bool same = old_field && old_field->type == field->type &&
+                    old_field->size == field->size && field->type != CANDY_FIELD_STRUCT;
+        bool nested = old_field && old_field->type == CANDY_FIELD_STRUCT &&
+                      field->type == CANDY_FIELD_STRUCT;
+        bool numeric = old_field && candy_field_is_numeric(old_field->type) &&
+                       candy_field_is_numeric(field->type);
+
+        if (old_layout && !same && !nested && !numeric) {
+            if (stats) {
+                stats->defaulted++;
+            }
+            if (log) {
+                std::cout << "[CANDY RELOAD]   " << (old_field ? "~ " : "+ ")
+                          << field->name << (old_field ? " (incompatible)" : "")
+                          << " set to default" << std::endl;
+            }
+        } else if (stats && (same || numeric)) {
+            // Struct fields are counted through their members
+            if (same && old_field->count == field->count) {
+                stats->copied++;
+            } else {
+                stats->converted++;
+            }
+        }
+
+        uint32_t kept = old_field && (same || nested || numeric)
+                            ? std::min(old_field->count, field->count)
+                            : 0;
+        const uint8_t *src = old_field ? old_base + old_field->offset : nullptr;
+
+        if (same) {
+            memcpy(dst, src, (size_t)field->size * kept);
+        } else if (nested) {
+            for (uint32_t e = 0; e < kept; ++e) {
+                // Members are counted once, not once per element
+                candy_migrate_fields(old_field->element, src + e * old_field->size,
+                                     field->element, dst + e * field->size,
+                                     e == 0 ? stats : nullptr, false);
+            }
+        } else if (numeric) {
+            for (uint32_t e = 0; e < kept; ++e) {
+                double value = candy_read_scalar(src + e * old_field->size,
+                                                 old_field->type, old_field->size);
+                candy_write_scalar(dst + e * field->size, field->type, field->size,
+                                   value);
+            }
+        }
+
+        for (uint32_t e = kept; e < field->count; ++e) {
+            candy_default_element(field, dst + e * field->size);
+        }
+    }
+
+    if (!old_layout) {
+        return;
+    }
+    for (uint32_t i = 0; i < old_layout->field_count; ++i) {
+        const candy_state_field *old_field = &old_layout->fields[i];
+        if (!candy_find_field(new_layout, old_field->name)) {
+            if (stats) {
+                stats->dropped++;
+            }
+            if (log) {
+                std::cout << "[CANDY RELOAD]   - " << old_field->name << " dropped"
+                          << std::endl;
+            }
+        }
+    }
+}
+
+// Builds new_state from old_state by field name. Matching fields are copied, scalars
+// of another kind or width are converted, arrays keep their common prefix and struct
+// fields are migrated recursively. Everything else gets its default. new_state must
+// be zeroed and must not overlap old_state.
+void candy_migrate_state(const candy_state_layout *old_layout, const void *old_state,
+                         const candy_state_layout *new_layout, void *new_state,
+                         candy_migrate_stats *stats) {
+    *stats = {};
+    candy_migrate_fields(old_layout, (const uint8_t *)old_state, new_layout,
+                         (uint8_t *)new_state, stats, true);
+}
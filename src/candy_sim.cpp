@@ -0,0 +1,273 @@
+#include "candy_sim.h"
+#include "candy_arena.h"
+#include "candy_profiler.h"
+
+#include <time.h>
+
+constexpr uint64_t SIM_CLIENT_CHECK_TICKS = 120; // before warning of an idle client
+
+// ============================================================================
+// INPUT
+// ============================================================================
+
+// GLFW may only be asked from the main thread; the simulation reads this copy
+void candy_sample_input(candy_context *ctx) {
+    if (!ctx->core.window) {
+        return;
+    }
+
+    for (uint32_t word = 0; word < INPUT_KEY_WORDS; ++word) {
+        uint64_t bits = 0;
+        for (uint32_t bit = 0; bit < 64; ++bit) {
+            int key = (int)(word * 64 + bit);
+            if (key >= GLFW_KEY_SPACE && key <= GLFW_KEY_LAST &&
+                glfwGetKey(ctx->core.window, key) == GLFW_PRESS) {
+                bits |= 1ull << bit;
+            }
+        }
+        ctx->input.keys[word].store(bits, std::memory_order_relaxed);
+    }
+}
+
+// Safe from any thread, reflects the last candy_sample_input
+bool candy_key_down(candy_context *ctx, int key) {
+    if (key < 0 || key > GLFW_KEY_LAST) {
+        return false;
+    }
+    uint64_t bits = ctx->input.keys[key / 64].load(std::memory_order_relaxed);
+    return (bits >> (key % 64)) & 1;
+}
+
+// ============================================================================
+// SIMULATION THREAD
+// ============================================================================
+
+static uint64_t candy_sim_tick_ns(float tick_rate) {
+    return (uint64_t)(1e9 / std::clamp(tick_rate, 1.0f, 1000.0f));
+}
+
+// What render gets to read: the module's own publish, or a copy of the whole state
+static void candy_sim_fill_snapshot(candy_game_module *module, void *snapshot) {
+    if (module->api.publish) {
+        module->api.publish(module->game_state, snapshot);
+    } else {
+        memcpy(snapshot, module->game_state, module->arena.state_size);
+    }
+}
+
+// The client's newest snapshot, which the next decode may overwrite, for the render
+// thread. Only the positions of the ids in use, interpolation needs nothing else.
+static void candy_sim_fill_network(candy_context *ctx, candy_sim_snapshot *snapshot) {
+    const candy_snapshot *from = ctx->client.snapshot;
+    snapshot->has_network = snapshot->network && from;
+    if (!snapshot->has_network) {
+        return;
+    }
+
+    candy_snapshot *to = snapshot->network;
+    to->tick = from->tick;
+    to->count = from->count;
+    memcpy(to->present, from->present, from->count);
+    memcpy(to->x, from->x, from->count * sizeof(uint32_t));
+    memcpy(to->y, from->y, from->count * sizeof(uint32_t));
+    memcpy(to->z, from->z, from->count * sizeof(uint32_t));
+    snapshot->network_arrival_ns = ctx->client.snapshot_arrival_ns;
+}
+
+// Writes the live state into the back snapshot and swaps it into the mailbox. The
+// sim mutex must be held, so the state is neither ticked nor reloaded meanwhile.
+static void candy_sim_publish(candy_context *ctx, uint64_t tick_time_ns) {
+    CANDY_ZONE("Publish Snapshot");
+    candy_sim_clock *sim = &ctx->sim;
+
+    candy_sim_snapshot *snapshot = &sim->snapshots[sim->back];
+    candy_sim_fill_snapshot(&ctx->game_module, snapshot->state);
+    candy_sim_fill_network(ctx, snapshot);
+    snapshot->tick = sim->tick.load(std::memory_order_relaxed);
+    snapshot->tick_time_ns = tick_time_ns;
+
+    uint32_t previous = sim->mailbox.exchange(sim->back | SIM_SNAPSHOT_FRESH,
+                                              std::memory_order_acq_rel);
+    sim->back = previous & ~SIM_SNAPSHOT_FRESH;
+}
+
+static void candy_sim_sleep_until_ns(uint64_t deadline_ns) {
+    // steady_clock, and so candy_time_ns, is CLOCK_MONOTONIC on Linux
+    timespec ts = {
+        .tv_sec = (time_t)(deadline_ns / 1000000000ull),
+        .tv_nsec = (long)(deadline_ns % 1000000000ull),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
+
+// Runs every whole tick of wall time since the last batch, publishes the result and
+// sleeps until the next tick is due. Time is kept in integer nanoseconds, so the tick
+// count only depends on the elapsed time. A batch more than max_catchup_ticks behind
+// drops the rest instead of spiralling.
+static void candy_sim_thread(candy_context *ctx) {
+    candy_sim_clock *sim = &ctx->sim;
+    candy_game_module *module = &ctx->game_module;
+    candy_zone_thread_name("simulation");
+    bool client_checked = !ctx->client.active;
+
+    while (!sim->quit.load(std::memory_order_acquire)) {
+        uint64_t tick_ns = sim->tick_ns.load(std::memory_order_relaxed);
+        float dt = (float)tick_ns * 1e-9f;
+
+        uint64_t now = candy_time_ns();
+        sim->accumulator_ns += now - sim->last_ns;
+        sim->last_ns = now;
+
+        uint64_t ticks = sim->accumulator_ns / tick_ns;
+        if (ticks > sim->max_catchup_ticks) {
+            uint64_t dropped = ticks - sim->max_catchup_ticks;
+            sim->dropped_ticks.fetch_add(dropped, std::memory_order_relaxed);
+            sim->accumulator_ns -= dropped * tick_ns;
+            ticks = sim->max_catchup_ticks;
+        }
+
+        if (ticks > 0) {
+            std::lock_guard<std::mutex> lock(sim->mutex);
+            for (uint64_t i = 0; i < ticks; ++i) {
+                CANDY_ZONE("Game Tick");
+                module->api.update(ctx, module->game_state, dt);
+                sim->accumulator_ns -= tick_ns;
+                sim->tick.fetch_add(1, std::memory_order_relaxed);
+            }
+            candy_sim_publish(ctx, now - sim->accumulator_ns);
+            sim->batch_ticks.store((uint32_t)ticks, std::memory_order_relaxed);
+
+            // Only a game module calling candy_client_tick plays online, quant.cpp
+            // does not
+            if (!client_checked && sim->tick.load(std::memory_order_relaxed) >=
+                                       SIM_CLIENT_CHECK_TICKS) {
+                client_checked = true;
+                if (ctx->client.predict.next_tick == 0) {
+                    std::cerr << "[CANDY] Connected, but the game module never ticks "
+                                 "the client; build it from src/game.cpp"
+                              << std::endl;
+                }
+            }
+        }
+
+        candy_sim_sleep_until_ns(now - sim->accumulator_ns + tick_ns);
+    }
+}
+
+// Publishes the live state into every snapshot, after init or a reload. Snapshots
+// of an older layout must never reach the new module's game_render. The sim mutex
+// must be held once the thread runs.
+void candy_sim_reset_snapshots(candy_context *ctx) {
+    candy_sim_clock *sim = &ctx->sim;
+    size_t size = ctx->game_module.api.snapshot_size;
+
+    for (uint32_t i = 0; i < SIM_SNAPSHOT_COUNT; ++i) {
+        candy_sim_snapshot *snapshot = &sim->snapshots[i];
+        bool committed = candy_arena_commit(ctx, snapshot->state, size);
+        CANDY_ASSERT(committed, "Failed to commit snapshot memory");
+
+        candy_sim_fill_snapshot(&ctx->game_module, snapshot->state);
+        candy_sim_fill_network(ctx, snapshot);
+        snapshot->tick = sim->tick.load(std::memory_order_relaxed);
+        snapshot->tick_time_ns = candy_time_ns();
+    }
+    sim->front = 0;
+    sim->mailbox.store(1, std::memory_order_release);
+    sim->back = 2;
+}
+
+// Call right before the first frame. Without a game module there is nothing to run.
+void candy_start_sim_thread(candy_context *ctx) {
+    candy_sim_clock *sim = &ctx->sim;
+
+    sim->tick_rate = ctx->config.tick_rate > 0.0f ? ctx->config.tick_rate : 60.0f;
+    sim->max_catchup_ticks = std::max(ctx->config.max_catchup_ticks, 1u);
+    sim->tick_ns.store(candy_sim_tick_ns(sim->tick_rate));
+    sim->tick.store(0);
+    sim->dropped_ticks.store(0);
+    sim->batch_ticks.store(0);
+    sim->alpha = 0.0f;
+    sim->running = false;
+
+    if (!ctx->game_module.game_state || !ctx->game_module.api.update) {
+        return;
+    }
+
+    // Snapshots live in the arena too, grown in place on reload like the state
+    for (uint32_t i = 0; i < SIM_SNAPSHOT_COUNT; ++i) {
+        sim->snapshots[i].state = candy_arena_reserve(ctx, ARENA_STATE_CAPACITY);
+        CANDY_ASSERT(sim->snapshots[i].state, "Failed to reserve a snapshot");
+        if (ctx->client.active) {
+            sim->snapshots[i].network = (candy_snapshot *)aligned_alloc(
+                alignof(candy_snapshot), sizeof(candy_snapshot));
+            CANDY_ASSERT(sim->snapshots[i].network, "Failed to allocate a snapshot");
+        }
+    }
+    candy_interp_init(&ctx->interp, sim->tick_ns.load());
+    candy_sim_reset_snapshots(ctx);
+
+    sim->last_ns = candy_time_ns();
+    sim->accumulator_ns = 0;
+    sim->quit.store(false);
+    sim->thread = std::thread(candy_sim_thread, ctx);
+    sim->running = true;
+
+    std::cout << "[CANDY] Simulation thread at " << sim->tick_rate << " ticks/s"
+              << std::endl;
+}
+
+void candy_stop_sim_thread(candy_context *ctx) {
+    candy_sim_clock *sim = &ctx->sim;
+    if (!sim->running) {
+        return;
+    }
+
+    sim->quit.store(true, std::memory_order_release);
+    sim->thread.join();
+    sim->running = false;
+
+    for (uint32_t i = 0; i < SIM_SNAPSHOT_COUNT; ++i) {
+        free(sim->snapshots[i].network);
+        sim->snapshots[i].network = nullptr;
+        sim->snapshots[i].has_network = false;
+    }
+    candy_interp_destroy(&ctx->interp);
+}
+
+// Called once per frame on the render thread: picks up the newest snapshot, hands its
+// network snapshot to the interpolation buffer and works out how far the frame is
+// past its tick. Returns the state to draw.
+void *candy_sim_acquire_snapshot(candy_context *ctx) {
+    candy_sim_clock *sim = &ctx->sim;
+    if (!sim->running) {
+        return ctx->game_module.game_state;
+    }
+
+    // Menu changes to the rate reach the sim thread from here
+    uint64_t tick_ns = candy_sim_tick_ns(sim->tick_rate);
+    sim->tick_ns.store(tick_ns, std::memory_order_relaxed);
+
+    if (sim->mailbox.load(std::memory_order_relaxed) & SIM_SNAPSHOT_FRESH) {
+        uint32_t latest = sim->mailbox.exchange(sim->front, std::memory_order_acq_rel);
+        sim->front = latest & ~SIM_SNAPSHOT_FRESH;
+    }
+
+    candy_sim_snapshot *snapshot = &sim->snapshots[sim->front];
+
+    // A change of rate starts over, old ticks would land at the wrong times. Pushing
+    // a snapshot already held does nothing.
+    if (ctx->interp.tick_ns != tick_ns) {
+        candy_interp_destroy(&ctx->interp);
+        candy_interp_init(&ctx->interp, tick_ns);
+    }
+    if (snapshot->has_network) {
+        candy_interp_push(&ctx->interp, snapshot->network, snapshot->network_arrival_ns);
+    }
+
+    uint64_t now = candy_time_ns();
+    uint64_t since = now > snapshot->tick_time_ns ? now - snapshot->tick_time_ns : 0;
+    sim->alpha = std::min((float)((double)since / (double)tick_ns), 1.0f);
+
+    return snapshot->state;
+}
@@ -0,0 +1,514 @@
+#include "candy_snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// ============================================================================
+// BIT PACKING
+// ============================================================================
+
+// Bits are packed from the least significant end and stored little endian, 32 at a
+// time. Overflow is sticky and checked once at the end.
+struct candy_bit_writer {
+    uint8_t *data;
+    uint32_t capacity;
+    uint32_t bytes;
+    uint64_t scratch;
+    uint32_t bits;
+    bool overflow;
+};
+
+struct candy_bit_reader {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t bytes;
+    uint64_t scratch;
+    uint32_t bits;
+    bool overflow;
+};
+
+static void candy_bits_emit(candy_bit_writer *w, uint32_t byte_count) {
+    if (w->bytes + byte_count > w->capacity) {
+        w->overflow = true;
+        return;
+    }
+    for (uint32_t i = 0; i < byte_count; ++i) {
+        w->data[w->bytes++] = (uint8_t)(w->scratch >> (i * 8));
+    }
+}
+
+static void candy_bits_write(candy_bit_writer *w, uint32_t value, uint32_t count) {
+    w->scratch |= (uint64_t)(value & (uint32_t)((1ull << count) - 1)) << w->bits;
+    w->bits += count;
+    if (w->bits >= 32) {
+        candy_bits_emit(w, 4);
+        w->scratch >>= 32;
+        w->bits -= 32;
+    }
+}
+
+// Returns the packed size in bytes, 0 if it did not fit
+static uint32_t candy_bits_finish(candy_bit_writer *w) {
+    candy_bits_emit(w, (w->bits + 7) / 8);
+    w->scratch = 0;
+    w->bits = 0;
+    return w->overflow ? 0 : w->bytes;
+}
+
+// Refills 32 bits at a time, byte by byte only near the end
+static uint32_t candy_bits_read(candy_bit_reader *r, uint32_t count) {
+    if (r->bits < count && r->size - r->bytes >= 4) {
+        const uint8_t *p = r->data + r->bytes;
+        uint32_t word = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+                        (uint32_t)p[3] << 24;
+        r->scratch |= (uint64_t)word << r->bits;
+        r->bits += 32;
+        r->bytes += 4;
+    }
+    while (r->bits < count) {
+        if (r->bytes == r->size) {
+            r->overflow = true;
+            return 0;
+        }
+        r->scratch |= (uint64_t)r->data[r->bytes++] << r->bits;
+        r->bits += 8;
+    }
+    uint32_t value = (uint32_t)(r->scratch & ((1ull << count) - 1));
+    r->scratch >>= count;
+    r->bits -= count;
+    return value;
+}
+
+static uint32_t candy_zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t candy_unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// 4 bits at a time behind a continuation bit, small counts stay small
+static void candy_bits_write_varint(candy_bit_writer *w, uint32_t value) {
+    while (value >= 16) {
+        candy_bits_write(w, (value & 15) | 16, 5);
+        value >>= 4;
+    }
+    candy_bits_write(w, value, 5);
+}
+
+static uint32_t candy_bits_read_varint(candy_bit_reader *r) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0; shift < 32 && !r->overflow; shift += 4) {
+        uint32_t group = candy_bits_read(r, 5);
+        value |= (group & 15) << shift;
+        if (!(group & 16)) {
+            break;
+        }
+    }
+    return value;
+}
+
+// ============================================================================
+// SNAPSHOTS
+// ============================================================================
+
+constexpr float SNAPSHOT_POSITION_SCALE =
+    (float)(1u << SNAPSHOT_POSITION_BITS) / (2.0f * SNAPSHOT_POSITION_RANGE);
+constexpr uint32_t SNAPSHOT_POSITION_MAX = (1u << SNAPSHOT_POSITION_BITS) - 1;
+
+// Prefix codes, their lengths picked for entities moving a little every tick:
+// an axis is 0 (same), 10 + 7 bits, 110 + 13 bits of zigzag delta, or 111 + the full
+// value. A run of unchanged entities is 0 (none), 10 + 4 bits (1 to 16),
+// 110 + 8 bits (17 to 272), or 111 + the full count.
+constexpr uint32_t SNAPSHOT_SMALL_DELTA_BITS = 7;
+constexpr uint32_t SNAPSHOT_MEDIUM_DELTA_BITS = 13;
+constexpr uint32_t SNAPSHOT_SHORT_RUN_BITS = 4;
+constexpr uint32_t SNAPSHOT_MEDIUM_RUN_BITS = 8;
+constexpr uint32_t SNAPSHOT_SHORT_RUNS = 1u << SNAPSHOT_SHORT_RUN_BITS;
+
+static_assert(SNAPSHOT_HISTORY < 256, "baseline age is sent in 8 bits");
+
+uint32_t candy_snapshot_quantize(float v) {
+    float scaled = (v + SNAPSHOT_POSITION_RANGE) * SNAPSHOT_POSITION_SCALE + 0.5f;
+    return (uint32_t)std::clamp(scaled, 0.0f, (float)SNAPSHOT_POSITION_MAX);
+}
+
+float candy_snapshot_dequantize(uint32_t q) {
+    return (float)q / SNAPSHOT_POSITION_SCALE - SNAPSHOT_POSITION_RANGE;
+}
+
+// Takes the networked fields of every live entity. kills is by dense index like the
+// store's columns, and may be null.
+void candy_snapshot_capture(const candy_entity_store *store, const uint32_t *kills,
+                            uint32_t tick, candy_snapshot *out) {
+    out->tick = tick;
+    out->count = std::min(store->slot_count, SNAPSHOT_MAX_ENTITIES);
+    memset(out->present, 0, out->count);
+
+    for (uint32_t i = 0; i < store->count; ++i) {
+        uint32_t id = store->dense_slot[i];
+        if (id >= SNAPSHOT_MAX_ENTITIES) {
+            continue;
+        }
+        out->present[id] = 1;
+        out->x[id] = candy_snapshot_quantize(store->px[i]);
+        out->y[id] = candy_snapshot_quantize(store->py[i]);
+        out->z[id] = candy_snapshot_quantize(store->pz[i]);
+        out->kills[id] = kills ? kills[i] : 0;
+    }
+}
+
+candy_snapshot *candy_snapshot_history_store(candy_snapshot_history *history,
+                                             uint32_t tick) {
+    uint32_t slot = tick % SNAPSHOT_HISTORY;
+    history->valid[slot] = true;
+    history->snapshots[slot].tick = tick;
+    return &history->snapshots[slot];
+}
+
+// Null once the tick was overwritten by a newer one
+const candy_snapshot *candy_snapshot_history_find(const candy_snapshot_history *history,
+                                                  uint32_t tick) {
+    uint32_t slot = tick % SNAPSHOT_HISTORY;
+    if (!history->valid[slot] || history->snapshots[slot].tick != tick) {
+        return nullptr;
+    }
+    return &history->snapshots[slot];
+}
+
+static bool candy_snapshot_changed(const candy_snapshot *s, const candy_snapshot *base,
+                                   uint32_t id) {
+    bool base_present = base && id < base->count && base->present[id];
+    if (!s->present[id] || !base_present) {
+        return s->present[id] != base_present;
+    }
+    return s->x[id] != base->x[id] || s->y[id] != base->y[id] ||
+           s->z[id] != base->z[id] || s->kills[id] != base->kills[id];
+}
+
+static void candy_snapshot_write_axis(candy_bit_writer *w, uint32_t value,
+                                      uint32_t base) {
+    uint32_t delta = candy_zigzag((int32_t)(value - base));
+    if (delta == 0) {
+        candy_bits_write(w, 0, 1);
+    } else if (delta < (1u << SNAPSHOT_SMALL_DELTA_BITS)) {
+        candy_bits_write(w, 0b01, 2);
+        candy_bits_write(w, delta, SNAPSHOT_SMALL_DELTA_BITS);
+    } else if (delta < (1u << SNAPSHOT_MEDIUM_DELTA_BITS)) {
+        candy_bits_write(w, 0b011, 3);
+        candy_bits_write(w, delta, SNAPSHOT_MEDIUM_DELTA_BITS);
+    } else {
+        candy_bits_write(w, 0b111, 3);
+        candy_bits_write(w, value, SNAPSHOT_POSITION_BITS);
+    }
+}
+
+static uint32_t candy_snapshot_read_axis(candy_bit_reader *r, uint32_t base) {
+    if (!candy_bits_read(r, 1)) {
+        return base;
+    }
+    if (!candy_bits_read(r, 1)) {
+        uint32_t delta = candy_bits_read(r, SNAPSHOT_SMALL_DELTA_BITS);
+        return base + (uint32_t)candy_unzigzag(delta);
+    }
+    if (!candy_bits_read(r, 1)) {
+        uint32_t delta = candy_bits_read(r, SNAPSHOT_MEDIUM_DELTA_BITS);
+        return base + (uint32_t)candy_unzigzag(delta);
+    }
+    return candy_bits_read(r, SNAPSHOT_POSITION_BITS);
+}
+
+static void candy_snapshot_write_run(candy_bit_writer *w, uint32_t run) {
+    if (run == 0) {
+        candy_bits_write(w, 0, 1);
+    } else if (run <= SNAPSHOT_SHORT_RUNS) {
+        candy_bits_write(w, 0b01, 2);
+        candy_bits_write(w, run - 1, SNAPSHOT_SHORT_RUN_BITS);
+    } else if (run <= SNAPSHOT_SHORT_RUNS + (1u << SNAPSHOT_MEDIUM_RUN_BITS)) {
+        candy_bits_write(w, 0b011, 3);
+        candy_bits_write(w, run - 1 - SNAPSHOT_SHORT_RUNS, SNAPSHOT_MEDIUM_RUN_BITS);
+    } else {
+        candy_bits_write(w, 0b111, 3);
+        candy_bits_write(w, run, SNAPSHOT_COUNT_BITS);
+    }
+}
+
+static uint32_t candy_snapshot_read_run(candy_bit_reader *r) {
+    if (!candy_bits_read(r, 1)) {
+        return 0;
+    }
+    if (!candy_bits_read(r, 1)) {
+        return candy_bits_read(r, SNAPSHOT_SHORT_RUN_BITS) + 1;
+    }
+    if (!candy_bits_read(r, 1)) {
+        return candy_bits_read(r, SNAPSHOT_MEDIUM_RUN_BITS) + 1 + SNAPSHOT_SHORT_RUNS;
+    }
+    return candy_bits_read(r, SNAPSHOT_COUNT_BITS);
+}
+
+// Packs snapshot as a delta against baseline, or in full when there is none. Runs
+// of unchanged entities cost a few bits; changed ones send what moved. Returns the
+// size in bytes, 0 if it did not fit in capacity.
+uint32_t candy_snapshot_encode(const candy_snapshot *snapshot,
+                               const candy_snapshot *baseline, uint8_t *out,
+                               uint32_t capacity) {
+    candy_bit_writer w = {
+        .data = out,
+        .capacity = capacity,
+        .bytes = 0,
+        .scratch = 0,
+        .bits = 0,
+        .overflow = false,
+    };
+
+    uint32_t age = baseline ? snapshot->tick - baseline->tick : 0;
+    if (age == 0 || age >= SNAPSHOT_HISTORY) {
+        baseline = nullptr;
+        age = 0;
+    }
+    candy_bits_write(&w, snapshot->tick, 32);
+    candy_bits_write(&w, age, 8);
+    candy_bits_write(&w, snapshot->count, SNAPSHOT_COUNT_BITS);
+
+    uint32_t next = 0;
+    for (uint32_t id = 0; id < snapshot->count && !w.overflow; ++id) {
+        if (!candy_snapshot_changed(snapshot, baseline, id)) {
+            continue;
+        }
+        candy_snapshot_write_run(&w, id - next);
+        next = id + 1;
+
+        candy_bits_write(&w, snapshot->present[id], 1);
+        if (!snapshot->present[id]) {
+            continue;
+        }
+
+        // A new entity is a delta against zero, which ends up sending it in full
+        bool base_present = baseline && id < baseline->count && baseline->present[id];
+        uint32_t base_x = base_present ? baseline->x[id] : 0;
+        uint32_t base_y = base_present ? baseline->y[id] : 0;
+        uint32_t base_z = base_present ? baseline->z[id] : 0;
+        uint32_t base_kills = base_present ? baseline->kills[id] : 0;
+
+        candy_snapshot_write_axis(&w, snapshot->x[id], base_x);
+        candy_snapshot_write_axis(&w, snapshot->y[id], base_y);
+        candy_snapshot_write_axis(&w, snapshot->z[id], base_z);
+        if (snapshot->kills[id] == base_kills) {
+            candy_bits_write(&w, 0, 1);
+        } else {
+            candy_bits_write(&w, 1, 1);
+            int32_t delta = (int32_t)(snapshot->kills[id] - base_kills);
+            candy_bits_write_varint(&w, candy_zigzag(delta));
+        }
+    }
+    candy_snapshot_write_run(&w, snapshot->count - next);
+
+    return candy_bits_finish(&w);
+}
+
+// Unpacks into history, against the baseline found there, and returns the snapshot.
+// Null on malformed data or a baseline no longer there; history is left as it was.
+const candy_snapshot *candy_snapshot_decode(const uint8_t *data, uint32_t size,
+                                            candy_snapshot_history *history) {
+    candy_bit_reader r = {
+        .data = data,
+        .size = size,
+        .bytes = 0,
+        .scratch = 0,
+        .bits = 0,
+        .overflow = false,
+    };
+
+    uint32_t tick = candy_bits_read(&r, 32);
+    uint32_t age = candy_bits_read(&r, 8);
+    uint32_t count = candy_bits_read(&r, SNAPSHOT_COUNT_BITS);
+    if (r.overflow || count > SNAPSHOT_MAX_ENTITIES || age >= SNAPSHOT_HISTORY) {
+        return nullptr;
+    }
+
+    const candy_snapshot *baseline = nullptr;
+    if (age > 0) {
+        baseline = candy_snapshot_history_find(history, tick - age);
+        if (!baseline) {
+            return nullptr;
+        }
+    }
+
+    // Starts from the baseline, so only what changed needs reading. The baseline is
+    // younger than the history, so it never shares the slot.
+    uint32_t slot = tick % SNAPSHOT_HISTORY;
+    candy_snapshot *out = &history->snapshots[slot];
+    history->valid[slot] = false;
+
+    uint32_t kept = baseline ? std::min(baseline->count, count) : 0;
+    if (baseline) {
+        memcpy(out->present, baseline->present, kept);
+        memcpy(out->x, baseline->x, kept * sizeof(uint32_t));
+        memcpy(out->y, baseline->y, kept * sizeof(uint32_t));
+        memcpy(out->z, baseline->z, kept * sizeof(uint32_t));
+        memcpy(out->kills, baseline->kills, kept * sizeof(uint32_t));
+    }
+    memset(out->present + kept, 0, count - kept);
+    out->tick = tick;
+    out->count = count;
+
+    uint32_t id = candy_snapshot_read_run(&r);
+    while (id < count && !r.overflow) {
+        out->present[id] = (uint8_t)candy_bits_read(&r, 1);
+        if (out->present[id]) {
+            bool base_present = id < kept && baseline->present[id];
+            uint32_t base_x = base_present ? baseline->x[id] : 0;
+            uint32_t base_y = base_present ? baseline->y[id] : 0;
+            uint32_t base_z = base_present ? baseline->z[id] : 0;
+            uint32_t base_kills = base_present ? baseline->kills[id] : 0;
+
+            out->x[id] = candy_snapshot_read_axis(&r, base_x) & SNAPSHOT_POSITION_MAX;
+            out->y[id] = candy_snapshot_read_axis(&r, base_y) & SNAPSHOT_POSITION_MAX;
+            out->z[id] = candy_snapshot_read_axis(&r, base_z) & SNAPSHOT_POSITION_MAX;
+            out->kills[id] = base_kills;
+            if (candy_bits_read(&r, 1)) {
+                out->kills[id] += (uint32_t)candy_unzigzag(candy_bits_read_varint(&r));
+            }
+        }
+        id += 1 + candy_snapshot_read_run(&r);
+    }
+
+    if (r.overflow || id != count) {
+        return nullptr;
+    }
+    history->valid[slot] = true;
+    return out;
+}
+
+// ============================================================================
+// SNAPSHOT BENCHMARK
+// ============================================================================
+
+static bool candy_snapshot_equal(const candy_snapshot *a, const candy_snapshot *b) {
+    if (a->tick != b->tick || a->count != b->count) {
+        return false;
+    }
+    for (uint32_t id = 0; id < a->count; ++id) {
+        if (candy_snapshot_changed(a, b, id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Moves count entities for a while, half of them standing still, and serializes
+// every tick against the snapshot from 6 ticks before, about what a client 100 ms
+// away at 60 ticks/s has acked. Checks every decode against the original.
+static void candy_snapshot_bench_count(uint32_t count) {
+    using clock = std::chrono::steady_clock;
+
+    candy_entity_store store_data;
+    candy_entity_store *store = &store_data;
+    void *store_memory = aligned_alloc(64, candy_entity_store_bytes(count));
+    candy_snapshot_history *sent = (candy_snapshot_history *)aligned_alloc(
+        alignof(candy_snapshot_history), sizeof(candy_snapshot_history));
+    candy_snapshot_history *received = (candy_snapshot_history *)aligned_alloc(
+        alignof(candy_snapshot_history), sizeof(candy_snapshot_history));
+    uint32_t *kills = (uint32_t *)calloc(count, sizeof(uint32_t));
+    uint8_t *packet = (uint8_t *)malloc(SNAPSHOT_MAX_ENTITIES * 64);
+    if (!store_memory || !sent || !received || !kills || !packet) {
+        std::cerr << "[CANDY BENCH] Failed to allocate the snapshot benchmark"
+                  << std::endl;
+        free(store_memory);
+        free(sent);
+        free(received);
+        free(kills);
+        free(packet);
+        return;
+    }
+    // Touched up front, so page faults stay out of the timings
+    memset(sent, 0, sizeof(candy_snapshot_history));
+    memset(received, 0, sizeof(candy_snapshot_history));
+
+    uint32_t seed = 0x9e3779b9u;
+    auto next = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+    auto unit = [&next]() { return (float)(next() & 0xffffff) / (float)0x800000 - 1.0f; };
+
+    candy_entity_store_init(store, count, store_memory);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t index = candy_entity_index(store, candy_entity_create(store));
+        store->px[index] = unit();
+        store->py[index] = unit();
+        store->vx[index] = i % 2 ? unit() : 0.0f;
+        store->vy[index] = i % 2 ? unit() : 0.0f;
+    }
+    const candy_integrate_params params = {
+        .dt = 1.0f / 60.0f,
+        .damping = 0.0f,
+        .bounds_min = {-SNAPSHOT_POSITION_RANGE, -SNAPSHOT_POSITION_RANGE, 0.0f},
+        .bounds_max = {SNAPSHOT_POSITION_RANGE, SNAPSHOT_POSITION_RANGE, 0.0f},
+    };
+
+    constexpr uint32_t ticks = 256;
+    constexpr uint32_t baseline_age = 6;
+    uint64_t full_bytes = 0;
+    uint64_t delta_bytes = 0;
+    uint64_t encode_ns = 0;
+    uint64_t decode_ns = 0;
+    uint32_t mismatches = 0;
+
+    for (uint32_t tick = 1; tick <= ticks; ++tick) {
+        candy_entity_integrate(store, &params);
+        kills[next() % count]++;
+
+        candy_snapshot *snapshot = candy_snapshot_history_store(sent, tick);
+        candy_snapshot_capture(store, kills, tick, snapshot);
+        const candy_snapshot *baseline =
+            tick > baseline_age ? candy_snapshot_history_find(sent, tick - baseline_age)
+                                : nullptr;
+
+        full_bytes += candy_snapshot_encode(snapshot, nullptr, packet,
+                                            SNAPSHOT_MAX_ENTITIES * 64);
+
+        clock::time_point start = clock::now();
+        uint32_t size =
+            candy_snapshot_encode(snapshot, baseline, packet, SNAPSHOT_MAX_ENTITIES * 64);
+        clock::time_point encoded = clock::now();
+        const candy_snapshot *decoded = candy_snapshot_decode(packet, size, received);
+        clock::time_point end = clock::now();
+
+        delta_bytes += size;
+        encode_ns += (uint64_t)std::chrono::nanoseconds(encoded - start).count();
+        decode_ns += (uint64_t)std::chrono::nanoseconds(end - encoded).count();
+        mismatches += !decoded || !candy_snapshot_equal(snapshot, decoded);
+    }
+
+    double per_entity = (double)ticks * count;
+    std::cout << "[CANDY BENCH] " << count << " entities: raw " << count * 16
+              << " B, full " << full_bytes / ticks << " B, delta " << delta_bytes / ticks
+              << " B per snapshot, encode " << encode_ns / per_entity
+              << " ns/entity, decode " << decode_ns / per_entity << " ns/entity"
+              << std::endl;
+    if (mismatches > 0) {
+        std::cerr << "[CANDY BENCH] " << mismatches << " snapshots decoded wrong"
+                  << std::endl;
+    }
+
+    free(store_memory);
+    free(sent);
+    free(received);
+    free(kills);
+    free(packet);
+}
+
+// Raw is position and kill count as plain floats and integers, 16 bytes an entity
+void candy_snapshot_bench() {
+    std::cout << "[CANDY BENCH] Snapshots, delta against 6 ticks back, half moving"
+              << std::endl;
+    for (uint32_t count : {16u, 256u, 4096u}) {
+        candy_snapshot_bench_count(count);
+    }
+}
@@ -0,0 +1,209 @@
+#include "candy_tick.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+// ============================================================================
+// CLOCKS AND SLEEP
+// ============================================================================
+
+uint64_t candy_tick_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Only counts while this thread runs, so sleeping and spinning between ticks are
+// left out as long as the caller measures around the work
+uint64_t candy_tick_thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Absolute, so time spent getting here is not slept again
+void candy_tick_sleep_until_ns(uint64_t deadline_ns, uint64_t spin_ns) {
+    uint64_t now = candy_tick_now_ns();
+    if (now + spin_ns < deadline_ns) {
+        uint64_t wake_ns = deadline_ns - spin_ns;
+        timespec ts = {
+            .tv_sec = (time_t)(wake_ns / 1000000000ull),
+            .tv_nsec = (long)(wake_ns % 1000000000ull),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+    }
+
+    while (candy_tick_now_ns() < deadline_ns) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+// ============================================================================
+// CORE PINNING
+// ============================================================================
+
+// Keeps the calling thread on the given cores, so it neither migrates nor shares
+// a core with another match the host was told to keep apart
+bool candy_tick_pin_thread(const uint32_t *cores, uint32_t count) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (cores[i] >= CPU_SETSIZE) {
+            std::cerr << "[CANDY TICK] No core " << cores[i] << std::endl;
+            return false;
+        }
+        CPU_SET(cores[i], &set);
+    }
+
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (result != 0) {
+        std::cerr << "[CANDY TICK] Failed to pin to the given cores (error " << result
+                  << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Reads a list like "2,3,8-11". Returns how many cores it named, 0 if malformed.
+uint32_t candy_tick_parse_cores(const char *list, uint32_t *cores, uint32_t max_cores) {
+    uint32_t count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        unsigned long first = strtoul(p, &end, 10);
+        if (end == p) {
+            return 0;
+        }
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtoul(p + 1, &end, 10);
+            if (end == p + 1 || last < first) {
+                return 0;
+            }
+            p = end;
+        }
+        for (unsigned long core = first; core <= last; ++core) {
+            if (count == max_cores) {
+                return 0;
+            }
+            cores[count++] = (uint32_t)core;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return 0;
+        }
+    }
+    return count;
+}
+
+// ============================================================================
+// TICK SCHEDULER
+// ============================================================================
+
+// The first tick is due right away. Call from the thread that will tick.
+void candy_tick_init(candy_tick_scheduler *scheduler, float tick_rate, uint64_t spin_ns) {
+    // Timer slack defaults to 50 us, which every sleep would overshoot by
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+    scheduler->tick_ns = (uint64_t)(1e9 / std::clamp(tick_rate, 1.0f, 1000.0f));
+    scheduler->spin_ns = spin_ns;
+    scheduler->tick = 0;
+    scheduler->deadline_ns = candy_tick_now_ns();
+    scheduler->tick_cpu_ns = 0;
+    scheduler->report_start_ns = scheduler->deadline_ns;
+    scheduler->stats.count = 0;
+    scheduler->stats.skipped = 0;
+}
+
+// Waits for the next tick and returns its number. More than TICK_MAX_CATCHUP ticks
+// behind, the missed ones are skipped instead of run back to back.
+uint64_t candy_tick_begin(candy_tick_scheduler *scheduler) {
+    candy_tick_sleep_until_ns(scheduler->deadline_ns, scheduler->spin_ns);
+
+    uint64_t now = candy_tick_now_ns();
+    uint64_t late = now - scheduler->deadline_ns;
+    if (late > TICK_MAX_CATCHUP * scheduler->tick_ns) {
+        uint64_t skipped = late / scheduler->tick_ns;
+        scheduler->deadline_ns += skipped * scheduler->tick_ns;
+        scheduler->tick += skipped;
+        scheduler->stats.skipped += skipped;
+        late -= skipped * scheduler->tick_ns;
+    }
+
+    candy_tick_stats *stats = &scheduler->stats;
+    if (stats->count < TICK_STATS_CAPACITY) {
+        stats->late_ns[stats->count] = late;
+    }
+    scheduler->tick_cpu_ns = candy_tick_thread_cpu_ns();
+    return scheduler->tick;
+}
+
+void candy_tick_end(candy_tick_scheduler *scheduler) {
+    candy_tick_stats *stats = &scheduler->stats;
+    if (stats->count < TICK_STATS_CAPACITY) {
+        uint64_t cpu_ns = candy_tick_thread_cpu_ns() - scheduler->tick_cpu_ns;
+        stats->cpu_ns[stats->count++] = cpu_ns;
+    }
+    scheduler->deadline_ns += scheduler->tick_ns;
+    scheduler->tick++;
+}
+
+struct candy_tick_summary {
+    double avg_us;
+    double p99_us;
+    double max_us;
+};
+
+// Sorts the samples in place, they are dropped right after
+static candy_tick_summary candy_tick_summarize(uint64_t *samples, uint32_t count) {
+    if (count == 0) {
+        return {};
+    }
+    std::sort(samples, samples + count);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        total += samples[i];
+    }
+    return {
+        .avg_us = (double)total / count / 1e3,
+        .p99_us = (double)samples[(uint64_t)(count - 1) * 99 / 100] / 1e3,
+        .max_us = (double)samples[count - 1] / 1e3,
+    };
+}
+
+// Prints CPU time and start lateness per tick since the last report, then starts
+// over. How many matches fit a core is judged by the p99 CPU time, as a tick that
+// runs over delays every match sharing the core.
+void candy_tick_report(candy_tick_scheduler *scheduler) {
+    candy_tick_stats *stats = &scheduler->stats;
+    candy_tick_summary cpu = candy_tick_summarize(stats->cpu_ns, stats->count);
+    candy_tick_summary late = candy_tick_summarize(stats->late_ns, stats->count);
+    double tick_us = (double)scheduler->tick_ns / 1e3;
+
+    std::cout << "[CANDY TICK] " << stats->count << " ticks: cpu " << cpu.avg_us
+              << " us avg, " << cpu.p99_us << " us p99, " << cpu.max_us << " us max ("
+              << cpu.avg_us / tick_us * 100.0 << "% of a " << tick_us
+              << " us tick); late " << late.avg_us << " us avg, " << late.p99_us
+              << " us p99, " << late.max_us << " us max; " << stats->skipped
+              << " skipped" << std::endl;
+    if (cpu.p99_us > 0.0) {
+        std::cout << "[CANDY TICK] Room for about " << (uint64_t)(tick_us / cpu.p99_us)
+                  << " matches like this one per core" << std::endl;
+    }
+
+    stats->count = 0;
+    stats->skipped = 0;
+    scheduler->report_start_ns = candy_tick_now_ns();
+}
@@ -0,0 +1,193 @@
+#include "candy_upload.h"
+
+// ============================================================================
+// STAGING RING
+// ============================================================================
+
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void candy_create_staging_ring(candy_context *ctx, VkDeviceSize size) {
+    candy_create_buffer(ctx, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        &ctx->staging.buffer, &ctx->staging.alloc);
+
+    ctx->staging.mapped = (uint8_t *)ctx->staging.alloc.mapped;
+    ctx->staging.size = size;
+    ctx->staging.head = 0;
+    ctx->staging.tail = 0;
+    ctx->staging.pending_count = 0;
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        ctx->staging.frame_end[i] = 0;
+    }
+}
+
+void candy_destroy_staging_ring(candy_context *ctx) {
+    candy_destroy_buffer(ctx, ctx->staging.buffer, &ctx->staging.alloc);
+    ctx->staging = {};
+}
+
+// Everything recorded by this frame slot has finished once its fence signalled.
+// Frames complete in submission order, so the tail can move up to its end mark.
+void candy_staging_retire_frame(candy_context *ctx, uint32_t frame) {
+    if (ctx->staging.frame_end[frame] > ctx->staging.tail) {
+        ctx->staging.tail = ctx->staging.frame_end[frame];
+    }
+}
+
+void candy_record_staging_uploads(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                  uint32_t frame) {
+    ctx->staging.frame_end[frame] = ctx->staging.head;
+
+    if (ctx->staging.pending_count == 0) {
+        return;
+    }
+
+    // Earlier frames may still be reading the destinations (dynamic geometry), so
+    // the copies wait for vertex input of previously submitted work.
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0,
+                         nullptr);
+
+    // Batch consecutive copies into the same destination into one command
+    uint32_t first = 0;
+    for (uint32_t i = 1; i <= ctx->staging.pending_count; ++i) {
+        if (i == ctx->staging.pending_count ||
+            ctx->staging.pending[i].dst != ctx->staging.pending[first].dst) {
+            VkBufferCopy regions[MAX_STAGING_COPIES];
+            for (uint32_t j = first; j < i; ++j) {
+                regions[j - first] = ctx->staging.pending[j].region;
+            }
+            vkCmdCopyBuffer(cmd_buffer, ctx->staging.buffer,
+                            ctx->staging.pending[first].dst, i - first, regions);
+            first = i;
+        }
+    }
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr,
+                         0, nullptr);
+
+    ctx->staging.pending_count = 0;
+}
+
+// Slow path for when the ring or the copy list is full: submit the pending copies
+// on a one-off command buffer and wait for the queue, which frees the whole ring.
+void candy_flush_staging_now(candy_context *ctx) {
+    if (ctx->staging.pending_count == 0) {
+        // Only frames in flight hold the ring, wait for them
+        vkQueueWaitIdle(ctx->core.graphics_queue);
+        ctx->staging.tail = ctx->staging.head;
+        return;
+    }
+
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = nullptr,
+        .commandPool = ctx->frame_data.command_pools[ctx->frame_data.current_frame],
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer cmd_buffer;
+    VkResult result =
+        vkAllocateCommandBuffers(ctx->core.logical_device, &alloc_info, &cmd_buffer);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to allocate staging command buffer");
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = nullptr,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = nullptr,
+    };
+    vkBeginCommandBuffer(cmd_buffer, &begin_info);
+
+    // The frame_end mark written here is overwritten by the next real frame
+    uint64_t frame_end = ctx->staging.frame_end[ctx->frame_data.current_frame];
+    candy_record_staging_uploads(ctx, cmd_buffer, ctx->frame_data.current_frame);
+    ctx->staging.frame_end[ctx->frame_data.current_frame] = frame_end;
+
+    vkEndCommandBuffer(cmd_buffer);
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = nullptr,
+        .pWaitDstStageMask = nullptr,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd_buffer,
+        .signalSemaphoreCount = 0,
+        .pSignalSemaphores = nullptr,
+    };
+    result = vkQueueSubmit(ctx->core.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to submit staging copies");
+    vkQueueWaitIdle(ctx->core.graphics_queue);
+
+    vkFreeCommandBuffers(ctx->core.logical_device, alloc_info.commandPool, 1,
+                         &cmd_buffer);
+
+    ctx->staging.tail = ctx->staging.head;
+}
+
+// Reserves `size` contiguous bytes at the head of the ring. Returns UINT64_MAX if the
+// space is still owned by frames in flight.
+static uint64_t candy_staging_alloc(candy_staging_ring *ring, VkDeviceSize size) {
+    uint64_t head = (ring->head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+    // Never split an allocation across the end of the ring
+    uint64_t physical = head % ring->size;
+    if (physical + size > ring->size) {
+        head += ring->size - physical;
+    }
+
+    if (head + size - ring->tail > ring->size) {
+        return UINT64_MAX;
+    }
+
+    ring->head = head + size;
+    return head % ring->size;
+}
+
+void candy_upload_buffer(candy_context *ctx, VkBuffer dst, VkDeviceSize dst_offset,
+                         const void *data, VkDeviceSize size) {
+    const uint8_t *src = (const uint8_t *)data;
+
+    // Large uploads are streamed through the ring in chunks
+    while (size > 0) {
+        VkDeviceSize chunk = std::min(size, ctx->staging.size / 2);
+
+        if (ctx->staging.pending_count == MAX_STAGING_COPIES) {
+            candy_flush_staging_now(ctx);
+        }
+
+        uint64_t offset = candy_staging_alloc(&ctx->staging, chunk);
+        if (offset == UINT64_MAX) {
+            candy_flush_staging_now(ctx);
+            offset = candy_staging_alloc(&ctx->staging, chunk);
+            CANDY_ASSERT(offset != UINT64_MAX, "Staging ring allocation failed");
+        }
+
+        memcpy(ctx->staging.mapped + offset, src, chunk);
+
+        ctx->staging.pending[ctx->staging.pending_count++] = {
+            .dst = dst,
+            .region =
+                {
+                    .srcOffset = offset,
+                    .dstOffset = dst_offset,
+                    .size = chunk,
+                },
+        };
+
+        src += chunk;
+        dst_offset += chunk;
+        size -= chunk;
+    }
+}
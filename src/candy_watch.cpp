@@ -0,0 +1,346 @@
+#include "candy_watch.h"
+#include "candy_profiler.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+// ============================================================================
+// MODULE PRELOAD
+// ============================================================================
+
+static bool candy_copy_file(const char *src_path, const char *dst_path) {
+    FILE *src = fopen(src_path, "rb");
+    if (!src) {
+        return false;
+    }
+    FILE *dst = fopen(dst_path, "wb");
+    if (!dst) {
+        fclose(src);
+        return false;
+    }
+
+    char buffer[64 * 1024];
+    size_t bytes;
+    bool ok = true;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        if (fwrite(buffer, 1, bytes, dst) != bytes) {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && !ferror(src);
+
+    fclose(src);
+    ok = fclose(dst) == 0 && ok;
+    return ok;
+}
+
+// dlopens a module and resolves every symbol of the game API. RTLD_NOW, so a module
+// calling an engine function the executable does not export fails here, not mid-game.
+bool candy_open_module(const char *path, uint32_t version, candy_loaded_module *out) {
+    *out = {};
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        const char *error = dlerror();
+        std::cerr << "[CANDY ERROR] Failed to load game module: " << path << std::endl;
+        std::cerr << "              dlopen error: " << (error ? error : "unknown")
+                  << std::endl;
+        return false;
+    }
+
+    candy_game_api api = {};
+    api.init = (void (*)(candy_context *, void *))dlsym(handle, "game_init");
+    api.update = (void (*)(candy_context *, void *, float))dlsym(handle, "game_update");
+    api.render = (void (*)(candy_context *, void *, float))dlsym(handle, "game_render");
+    api.cleanup = (void (*)(candy_context *, void *))dlsym(handle, "game_cleanup");
+    api.on_reload = (bool (*)(void *, void *))dlsym(handle, "game_on_reload");
+
+    size_t *state_size_ptr = (size_t *)dlsym(handle, "game_state_size");
+
+    // cleanup and on_reload are optional
+    if (!api.init || !api.update || !api.render || !state_size_ptr) {
+        std::cerr << "[CANDY ERROR] Game module v" << version
+                  << " is missing required symbols (game_init, game_update, game_render,"
+                  << " game_state_size)" << std::endl;
+        dlclose(handle);
+        return false;
+    }
+    api.state_size = *state_size_ptr;
+
+    // Without a layout the state can only be carried over by on_reload
+    api.layout = (const candy_state_layout *)dlsym(handle, "game_state_layout");
+    if (api.layout &&
+        (api.layout->size != api.state_size || !candy_validate_layout(api.layout))) {
+        std::cerr << "[CANDY ERROR] Game module v" << version
+                  << " exports a game_state_layout that does not match its state"
+                  << std::endl;
+        dlclose(handle);
+        return false;
+    }
+
+    // Both or neither: render takes what publish writes instead of the state
+    api.publish = (void (*)(const void *, void *))dlsym(handle, "game_publish");
+    size_t *snapshot_size_ptr = (size_t *)dlsym(handle, "game_snapshot_size");
+    if (!api.publish != !snapshot_size_ptr) {
+        std::cerr << "[CANDY ERROR] Game module v" << version
+                  << " exports one of game_publish and game_snapshot_size" << std::endl;
+        dlclose(handle);
+        return false;
+    }
+    api.snapshot_size = api.publish ? *snapshot_size_ptr : api.state_size;
+
+    out->dll_handle = handle;
+    out->api = api;
+    out->version = version;
+    return true;
+}
+
+// Loads GAME_MODULE_PATH through a copy at a versioned path: dlopen hands back the
+// already loaded module for a path it has seen, and the build must be free to
+// overwrite the original while the copy is mapped. Safe to call off the main thread,
+// nothing of the running module is touched.
+bool candy_preload_module(uint32_t version, candy_loaded_module *out) {
+    *out = {};
+
+    if (mkdir(GAME_MODULE_COPY_DIR, 0755) != 0 && errno != EEXIST) {
+        std::cerr << "[CANDY ERROR] Cannot create " << GAME_MODULE_COPY_DIR << ": "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+
+    char copy_path[256];
+    snprintf(copy_path, sizeof(copy_path), "%s/libgame.%u.so", GAME_MODULE_COPY_DIR,
+             version);
+    if (!candy_copy_file(GAME_MODULE_PATH, copy_path)) {
+        std::cerr << "[CANDY ERROR] Failed to copy " << GAME_MODULE_PATH << " to "
+                  << copy_path << std::endl;
+        unlink(copy_path);
+        return false;
+    }
+
+    bool opened = candy_open_module(copy_path, version, out);
+    // The mapping keeps the file alive, the copy is not needed any more
+    unlink(copy_path);
+    return opened;
+}
+
+// Hands this frame's preloaded module to the main thread, if there is one
+bool candy_take_staged_module(candy_context *ctx, candy_loaded_module *out) {
+    candy_module_watcher *watcher = &ctx->game_module.watcher;
+    if (!watcher->staged_ready.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    *out = watcher->staged;
+    watcher->staged = {};
+    watcher->staged_ready.store(false, std::memory_order_release);
+
+    // Wakes a watcher waiting to stage the next build. Non blocking: a full pipe
+    // already holds a wake up.
+    char byte = 1;
+    ssize_t written = write(watcher->taken_pipe[1], &byte, 1);
+    (void)written;
+    return true;
+}
+
+// ============================================================================
+// MODULE WATCHER
+// ============================================================================
+
+// Tracks the build's progress from directory events. A module write only counts once
+// the lock file is gone and either the marker was touched or the directory stayed
+// quiet for MODULE_SETTLE_MS, for builds that do not write the marker.
+struct candy_watch_state {
+    bool locked;
+    bool pending; // module changed since the last ready
+    bool ready;   // build finished, preload on this iteration
+};
+
+static void candy_watch_handle_event(candy_context *ctx, candy_watch_state *state,
+                                     const inotify_event *event) {
+    if (event->len == 0) {
+        return;
+    }
+
+    const char *name = event->name;
+    if (strcmp(name, GAME_MODULE_NAME) == 0) {
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            state->pending = true;
+        }
+    } else if (strcmp(name, GAME_MODULE_LOCK) == 0) {
+        if (event->mask & IN_CREATE) {
+            state->locked = true;
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            state->locked = false;
+        }
+    } else if (strcmp(name, GAME_MODULE_MARKER) == 0) {
+        if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)) &&
+            state->pending && !state->locked) {
+            state->pending = false;
+            state->ready = true;
+        }
+    }
+}
+
+static void candy_watch_thread(candy_context *ctx) {
+    candy_module_watcher *watcher = &ctx->game_module.watcher;
+    candy_zone_thread_name("module watcher");
+
+    char lock_path[256];
+    snprintf(lock_path, sizeof(lock_path), "%s/%s", GAME_MODULE_DIR, GAME_MODULE_LOCK);
+
+    candy_watch_state state = {
+        .locked = access(lock_path, F_OK) == 0,
+        .pending = false,
+        .ready = false,
+    };
+
+    // inotify_event is variable length, the buffer must be aligned for it
+    alignas(inotify_event) char buffer[4096];
+
+    for (;;) {
+        pollfd fds[2] = {
+            {.fd = watcher->inotify_fd, .events = POLLIN, .revents = 0},
+            {.fd = watcher->wake_pipe[0], .events = POLLIN, .revents = 0},
+        };
+
+        int timeout = state.pending && !state.locked ? MODULE_SETTLE_MS : -1;
+        int poll_result = poll(fds, 2, timeout);
+        if (poll_result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "[CANDY ERROR] Module watcher poll failed: " << strerror(errno)
+                      << std::endl;
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+
+        if (poll_result == 0) {
+            // Quiet long enough with no marker: trust the module as it is
+            state.pending = false;
+            state.ready = true;
+        } else if (fds[0].revents & POLLIN) {
+            ssize_t length = read(watcher->inotify_fd, buffer, sizeof(buffer));
+            for (char *ptr = buffer; length > 0 && ptr < buffer + length;) {
+                const inotify_event *event = (const inotify_event *)ptr;
+                candy_watch_handle_event(ctx, &state, event);
+                ptr += sizeof(inotify_event) + event->len;
+            }
+        }
+
+        if (!state.ready) {
+            continue;
+        }
+        state.ready = false;
+
+        // The main thread has not swapped the last module in yet, it does so at the
+        // start of its next frame. Sleeps until it says it took it, or until
+        // candy_stop_module_watcher. A wake up left over from an earlier take only
+        // costs another look at staged_ready.
+        while (watcher->staged_ready.load(std::memory_order_acquire)) {
+            pollfd wait[2] = {
+                {.fd = watcher->wake_pipe[0], .events = POLLIN, .revents = 0},
+                {.fd = watcher->taken_pipe[0], .events = POLLIN, .revents = 0},
+            };
+            if (poll(wait, 2, -1) < 0 && errno != EINTR) {
+                std::cerr << "[CANDY ERROR] Module watcher poll failed: "
+                          << strerror(errno) << std::endl;
+                return;
+            }
+            if (wait[0].revents & POLLIN) {
+                return;
+            }
+            char drain[64];
+            while (read(watcher->taken_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        CANDY_ZONE("Module Preload");
+        candy_loaded_module module;
+        if (candy_preload_module(watcher->next_version, &module)) {
+            watcher->next_version++;
+            watcher->staged = module;
+            watcher->staged_ready.store(true, std::memory_order_release);
+        } else {
+            std::cerr << "[CANDY] Hot reload skipped, keeping the running module"
+                      << std::endl;
+        }
+    }
+}
+
+void candy_start_module_watcher(candy_context *ctx) {
+    candy_module_watcher *watcher = &ctx->game_module.watcher;
+    watcher->staged = {};
+    watcher->staged_ready.store(false);
+    watcher->next_version = ctx->game_module.version + 1;
+    watcher->running = false;
+
+    watcher->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (watcher->inotify_fd < 0) {
+        std::cerr << "[CANDY ERROR] inotify_init1 failed, hot reload disabled: "
+                  << strerror(errno) << std::endl;
+        return;
+    }
+
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE |
+                    IN_ATTRIB;
+    if (inotify_add_watch(watcher->inotify_fd, GAME_MODULE_DIR, mask) < 0) {
+        std::cerr << "[CANDY ERROR] Cannot watch " << GAME_MODULE_DIR
+                  << ", hot reload disabled: " << strerror(errno) << std::endl;
+        close(watcher->inotify_fd);
+        return;
+    }
+
+    if (pipe2(watcher->wake_pipe, O_CLOEXEC) != 0) {
+        std::cerr << "[CANDY ERROR] pipe2 failed, hot reload disabled: "
+                  << strerror(errno) << std::endl;
+        close(watcher->inotify_fd);
+        return;
+    }
+    // Neither side may block on it: the main thread mid frame, the watcher draining
+    if (pipe2(watcher->taken_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        std::cerr << "[CANDY ERROR] pipe2 failed, hot reload disabled: "
+                  << strerror(errno) << std::endl;
+        close(watcher->wake_pipe[0]);
+        close(watcher->wake_pipe[1]);
+        close(watcher->inotify_fd);
+        return;
+    }
+
+    watcher->thread = std::thread(candy_watch_thread, ctx);
+    watcher->running = true;
+    std::cout << "[CANDY] Watching " << GAME_MODULE_DIR << " for module changes"
+              << std::endl;
+}
+
+void candy_stop_module_watcher(candy_context *ctx) {
+    candy_module_watcher *watcher = &ctx->game_module.watcher;
+    if (!watcher->running) {
+        return;
+    }
+
+    char byte = 1;
+    ssize_t written = write(watcher->wake_pipe[1], &byte, 1);
+    (void)written;
+    watcher->thread.join();
+
+    // Preloaded but never swapped in
+    if (watcher->staged_ready.load()) {
+        dlclose(watcher->staged.dll_handle);
+        watcher->staged_ready.store(false);
+    }
+
+    close(watcher->wake_pipe[0]);
+    close(watcher->wake_pipe[1]);
+    close(watcher->taken_pipe[0]);
+    close(watcher->taken_pipe[1]);
+    close(watcher->inotify_fd);
+    watcher->running = false;
+}
@@ -1,96 +1,258 @@
 #include "core.h"
+#include "candy_arena.h"
+#include <cmath>
 #include <cstring>
 
-#define MAX_PLAYERS 16
+#define NEAR_RADIUS 0.3f
 
-struct player {
-    struct position {
-        float x;
-        float y;
-        float z;
-    } position;
-
-    uint32_t kill_count;
-};
+// Rows the match is made with, as many entities as a snapshot can carry
+constexpr uint32_t GAME_MAX_ENTITIES = SNAPSHOT_MAX_ENTITIES;
 
+// The rules live in candy_match, which the dedicated server runs too. Online, the
+// other players are drawn from ctx->interp instead, some way behind the newest
+// snapshot; the render thread keeps it, so it is neither in the state nor copied.
+// The match's columns live in an arena region of their own, the state only holds
+// pointers to them and a count.
 struct game_state {
-    player players[MAX_PLAYERS];
+    candy_match match;
     time_t curr_time;
+
+    bool online;
+    uint32_t local_player; // predicted, MATCH_MAX_PLAYERS until the server says
 };
 
+// What game_render draws from, published after every batch of ticks. Only the rows
+// of live entities are written, the state itself is never copied whole.
+struct game_view {
+    uint32_t count;
+    bool online;
+    uint32_t local_player;
+    uint32_t near_player; // entities near player 0, not counting itself
+    uint32_t player_index[MATCH_MAX_PLAYERS]; // ENTITY_INVALID once gone
+    uint32_t player_id[MATCH_MAX_PLAYERS];    // network id, its slot
+    uint32_t kills[MATCH_MAX_PLAYERS];
+
+    alignas(64) float x[GAME_MAX_ENTITIES];
+    alignas(64) float y[GAME_MAX_ENTITIES];
+    alignas(64) float z[GAME_MAX_ENTITIES];
+    alignas(64) float prev_x[GAME_MAX_ENTITIES];
+    alignas(64) float prev_y[GAME_MAX_ENTITIES];
+    alignas(64) float prev_z[GAME_MAX_ENTITIES];
+};
+
+// Lets the engine carry the state over field by field when the layout changes
+static const candy_state_field game_state_fields[] = {
+    CANDY_FIELD_STRUCT(game_state, match, candy_match_layout),
+    CANDY_FIELD(game_state, curr_time),
+    CANDY_FIELD(game_state, online),
+    CANDY_FIELD(game_state, local_player),
+};
+
+// The engine looks every entry point up by its C name
 extern "C" {
 
 size_t game_state_size = sizeof(game_state);
-}
+size_t game_snapshot_size = sizeof(game_view);
+extern const candy_state_layout game_state_layout =
+    CANDY_LAYOUT(game_state, game_state_fields);
 
 void game_init(candy_context *ctx, void *state) {
 
-    (void)ctx;
-
     game_state *game = (game_state *)state;
 
-    for (uint32_t i = 0; i < MAX_PLAYERS; ++i) {
-        game->players[i].position = {
-            .x = 0.0f,
-            .y = 0.0f,
-            .z = 0.0f,
-        };
-        game->players[i].kill_count = 0;
-    }
+    // Reserved once per init; a reload migrates the pointers and keeps the region
+    size_t bytes = candy_match_bytes(GAME_MAX_ENTITIES);
+    void *memory = candy_arena_reserve(ctx, bytes);
+    bool committed = memory && candy_arena_commit(ctx, memory, bytes);
+    CANDY_ASSERT(committed, "Failed to allocate the match");
+    candy_match_init(&game->match, GAME_MAX_ENTITIES, memory);
+    game->online = false;
+    game->local_player = MATCH_MAX_PLAYERS;
 
     return;
 }
 
-void game_update(candy_context *ctx, void *state, uint32_t delta_time) {
+// Online the match only mirrors the server: everyone as of the newest snapshot, but
+// our own player where its prediction has it, ahead of the server by the round trip
+static void game_apply_server(game_state *game, const candy_client *client) {
+    candy_match *match = &game->match;
+    candy_entity_store *entities = &match->entities;
+    const candy_snapshot *snapshot = client->snapshot;
 
-    game_state *game = (game_state *)state;
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        uint32_t index = candy_entity_index(entities, match->players[i]);
+        if (index == ENTITY_INVALID) {
+            continue;
+        }
+        entities->prev_x[index] = entities->px[index];
+        entities->prev_y[index] = entities->py[index];
+        entities->prev_z[index] = entities->pz[index];
 
-    if (glfwGetKey(ctx->core.window, GLFW_KEY_W) == GLFW_PRESS) {
-        game->players[0].position.y += 0.001f * delta_time;
-    }
-    if (glfwGetKey(ctx->core.window, GLFW_KEY_S) == GLFW_PRESS) {
-        game->players[0].position.y -= 0.001f * delta_time;
-    }
-    if (glfwGetKey(ctx->core.window, GLFW_KEY_A) == GLFW_PRESS) {
-        game->players[0].position.x -= 0.001f * delta_time;
+        // Ids are slots, and both sides create the players in the same order
+        uint32_t id = match->players[i].slot;
+        if (snapshot && id < snapshot->count && snapshot->present[id]) {
+            entities->px[index] = candy_snapshot_dequantize(snapshot->x[id]);
+            entities->py[index] = candy_snapshot_dequantize(snapshot->y[id]);
+            entities->pz[index] = candy_snapshot_dequantize(snapshot->z[id]);
+            match->kill_count[index] = snapshot->kills[id];
+        }
+        if ((int32_t)i == client->player) {
+            const candy_match_motion *motion = &client->predict.motion;
+            entities->px[index] = motion->p[0];
+            entities->py[index] = motion->p[1];
+            entities->pz[index] = motion->p[2];
+            entities->vx[index] = motion->v[0];
+            entities->vy[index] = motion->v[1];
+            entities->vz[index] = motion->v[2];
+        }
     }
-    if (glfwGetKey(ctx->core.window, GLFW_KEY_D) == GLFW_PRESS) {
-        game->players[0].position.x += 0.001f * delta_time;
+    match->tick = snapshot ? snapshot->tick : 0;
+    candy_grid_build(&match->grid, entities, MATCH_GRID_CELL_SIZE);
+}
+
+void game_update(candy_context *ctx, void *state, float dt) {
+
+    game_state *game = (game_state *)state;
+
+    // Sampled by the engine on the main thread, this runs on the simulation thread.
+    // Only player 0 is driven locally, or whichever the server gave us.
+    uint8_t buttons[MATCH_MAX_PLAYERS] = {};
+    buttons[0] |= candy_key_down(ctx, GLFW_KEY_W) ? MATCH_BUTTON_UP : 0;
+    buttons[0] |= candy_key_down(ctx, GLFW_KEY_S) ? MATCH_BUTTON_DOWN : 0;
+    buttons[0] |= candy_key_down(ctx, GLFW_KEY_A) ? MATCH_BUTTON_LEFT : 0;
+    buttons[0] |= candy_key_down(ctx, GLFW_KEY_D) ? MATCH_BUTTON_RIGHT : 0;
+    buttons[0] |= candy_key_down(ctx, GLFW_KEY_SPACE) ? MATCH_BUTTON_FIRE : 0;
+
+    if (ctx->client.active) {
+        uint64_t now = candy_time_ns();
+        candy_client_tick(&ctx->client, buttons[0], dt, now);
+        game_apply_server(game, &ctx->client);
+        game->online = true;
+        game->local_player =
+            ctx->client.player >= 0 ? (uint32_t)ctx->client.player : MATCH_MAX_PLAYERS;
+    } else {
+        candy_match_tick(&game->match, buttons, dt);
     }
 
     return;
 }
 
-void game_render(candy_context *ctx, void *state) {
+// Runs on the simulation thread with the state locked: copies the live rows and
+// whatever else the frame needs out, render never sees the state
+void game_publish(const void *state, void *snapshot) {
 
-    game_state *game = (game_state *)state;
+    const game_state *game = (const game_state *)state;
+    game_view *view = (game_view *)snapshot;
+    const candy_match *match = &game->match;
+    const candy_entity_store *entities = &match->entities;
 
-    if (ctx->imgui.show_menu) {
-        ImGui::Begin("Game State idiot");
-        for (uint32_t i = 0; i < MAX_PLAYERS; ++i) {
+    uint32_t count = entities->count;
+    view->count = count;
+    memcpy(view->x, entities->px, count * sizeof(float));
+    memcpy(view->y, entities->py, count * sizeof(float));
+    memcpy(view->z, entities->pz, count * sizeof(float));
+    memcpy(view->prev_x, entities->prev_x, count * sizeof(float));
+    memcpy(view->prev_y, entities->prev_y, count * sizeof(float));
+    memcpy(view->prev_z, entities->prev_z, count * sizeof(float));
 
-            ImGui::Text("Player[%i] Position: (%.2f, %.2f)", i,
-                        game->players[i].position.x, game->players[i].position.y);
+    view->online = game->online;
+    view->local_player = game->local_player;
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        uint32_t index = candy_entity_index(entities, match->players[i]);
+        view->player_index[i] = index;
+        view->player_id[i] = match->players[i].slot;
+        view->kills[i] = index != ENTITY_INVALID ? match->kill_count[index] : 0;
+    }
 
-            ImGui::Text("Kills for player: %i: %d", i, game->players[i].kill_count);
-        }
-        ImGui::End();
+    view->near_player = 0;
+    uint32_t player = view->player_index[0];
+    if (player != ENTITY_INVALID) {
+        uint32_t near =
+            candy_grid_query_radius(&match->grid, entities, entities->px[player],
+                                    entities->py[player], NEAR_RADIUS, nullptr, 0);
+        view->near_player = near > 0 ? near - 1 : 0; // not itself
     }
 
     return;
 }
 
-void game_on_reload(void *old_state, void *new_state) {
+// Everyone but our own player, where the server had them a little while ago. The
+// delay covers the jitter, so there is nearly always a snapshot on each side.
+static void game_render_remote(const candy_interp *interp, const game_view *view,
+                               candy_instance *instances) {
+    candy_interp_time time = candy_interp_locate(interp, candy_time_ns());
+    if (!time.valid) {
+        return;
+    }
+    float x[MATCH_MAX_PLAYERS];
+    float y[MATCH_MAX_PLAYERS];
+    float z[MATCH_MAX_PLAYERS];
+    candy_interp_sample(interp, &time, MATCH_MAX_PLAYERS, x, y, z);
 
-    game_state *old_game = (game_state *)old_state;
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        uint32_t index = view->player_index[i];
+        uint32_t id = view->player_id[i]; // the players take the first slots
+        if (i == view->local_player || index == ENTITY_INVALID ||
+            id >= MATCH_MAX_PLAYERS || !candy_interp_present(interp, &time, id)) {
+            continue;
+        }
+        instances[index].offset = {x[id], y[id], z[id]};
+    }
+}
+
+void game_render(candy_context *ctx, void *snapshot, float alpha) {
 
-    game_state *new_game = (game_state *)new_state;
+    const game_view *view = (const game_view *)snapshot;
 
-    memcpy(new_game, old_game, sizeof(game_state));
+    // One instance per entity, all drawn in a single instanced draw call. Drawn
+    // between the last two ticks, so motion stays smooth at any rate.
+    candy_instance *instances = candy_reserve_instances(ctx, view->count);
+    if (instances) {
+        const float *px = view->x;
+        const float *py = view->y;
+        const float *pz = view->z;
+        const float *prev_x = view->prev_x;
+        const float *prev_y = view->prev_y;
+        const float *prev_z = view->prev_z;
 
-    uint32_t version = 8;
-    std::cout << "Game version: " << version << std::endl;
-    std::cout.flush();
+        for (uint32_t i = 0; i < view->count; ++i) {
+            instances[i] = {
+                .offset = {prev_x[i] + (px[i] - prev_x[i]) * alpha,
+                           prev_y[i] + (py[i] - prev_y[i]) * alpha,
+                           prev_z[i] + (pz[i] - prev_z[i]) * alpha},
+                .scale = 0.1f,
+            };
+        }
+        if (view->online) {
+            game_render_remote(&ctx->interp, view, instances);
+        }
+    }
+
+    if (ctx->imgui.show_menu) {
+        ImGui::Begin("Game State idiot");
+        ImGui::Text("Entities: %u", view->count);
+        if (view->online) {
+            const candy_interp *interp = &ctx->interp;
+            ImGui::Text("Interpolation delay: %.1f ms, jitter %.1f ms",
+                        interp->delay_ns / 1e6, interp->jitter_ns / 1e6);
+        }
+
+        if (view->player_index[0] != ENTITY_INVALID) {
+            ImGui::Text("Near player 0: %u", view->near_player);
+        }
+        for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+            uint32_t index = view->player_index[i];
+            if (index == ENTITY_INVALID) {
+                continue;
+            }
+
+            ImGui::Text("Player[%i] Position: (%.2f, %.2f)", i, view->x[index],
+                        view->y[index]);
+
+            ImGui::Text("Kills for player: %i: %d", i, view->kills[i]);
+        }
+        ImGui::End();
+    }
 
     return;
 }
@@ -102,3 +264,4 @@ void game_cleanup(candy_context *ctx, void *state) {
 
     return;
 }
+}
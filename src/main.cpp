@@ -1,7 +1,19 @@
+#include "candy_alloc.h"
+#include "candy_arena.h"
+#include "candy_culling.h"
+#include "candy_gpu_profiler.h"
 #include "candy_imgui.h"
+#include "candy_jobs.h"
+#include "candy_pacer.h"
+#include "candy_profiler.h"
+#include "candy_record.h"
+#include "candy_sim.h"
+#include "candy_upload.h"
+#include "candy_watch.h"
 #include "core.h"
 
 #include <GLFW/glfw3.h>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
@@ -103,16 +115,21 @@ bool candy_check_validation_layers() {
 // ============================================================================
 
 void candy_get_required_extensions(const char **out_extensions, uint32_t *out_count,
-                                   bool enable_validation) {
-    uint32_t glfw_count = 0;
-    const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_count);
+                                   const candy_config *config) {
+    *out_count = 0;
 
-    for (uint32_t i = 0; i < glfw_count; ++i) {
-        out_extensions[i] = glfw_extensions[i];
+    // Headless runs never create a surface, so GLFW (and a display) is not needed
+    if (!config->headless) {
+        uint32_t glfw_count = 0;
+        const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_count);
+
+        for (uint32_t i = 0; i < glfw_count; ++i) {
+            out_extensions[i] = glfw_extensions[i];
+        }
+        *out_count = glfw_count;
     }
-    *out_count = glfw_count;
 
-    if (enable_validation) {
+    if (config->enable_validation) {
         out_extensions[(*out_count)++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
     }
 }
@@ -121,85 +138,97 @@ void candy_get_required_extensions(const char **out_extensions, uint32_t *out_co
 // HOT RELOADING
 // ============================================================================
 
-void candy_reload_code(candy_context *ctx) {
+// Moves the running game over to a module preloaded by the watcher. Called at the
+// start of a frame, so neither the old nor the new code is on the stack. The state
+// stays where it is in the arena. When both modules export a layout and it changed,
+// the old bytes are copied aside and migrated field by field; without layouts a size
+// change hands the copy to on_reload. The old module stays in place, and next is
+// closed, if the new code rejects the state.
+bool candy_swap_game_module(candy_context *ctx, candy_loaded_module *next) {
 #ifdef _WIN32
     CANDY_ASSERT(false, "Win is not implemented");
 #endif // _WIN32
 
-    if (ctx->game_module.dll_handle) {
-        int dl_result = dlclose(ctx->game_module.dll_handle);
-        CANDY_ASSERT(dl_result == 0, "Failed to close dll handle");
-        ctx->game_module.dll_handle = nullptr;
+    candy_game_module *module = &ctx->game_module;
+    size_t old_size = module->arena.state_size;
+    size_t new_size = next->api.state_size;
+
+    const candy_state_layout *old_layout = module->api.layout;
+    const candy_state_layout *new_layout = next->api.layout;
+    bool migrate = old_layout && new_layout;
+    bool in_place = migrate
+                        ? candy_layout_hash(old_layout) == candy_layout_hash(new_layout)
+                        : new_size == old_size;
+
+    // Large enough for either layout, so a module can read its own size from it
+    void *old_copy = nullptr;
+    if (!in_place && (migrate || next->api.on_reload)) {
+        old_copy = calloc(1, std::max(old_size, new_size));
+        if (!old_copy) {
+            std::cerr << "[CANDY ERROR] Failed to allocate state copy" << std::endl;
+            dlclose(next->dll_handle);
+            return false;
+        }
+        memcpy(old_copy, module->game_state, old_size);
     }
 
-    // TODO: Implement lock file syste, for this instead time buffer
-    usleep(100000); // 100ms
-
-    const char *dll_path = "output/libgame.so";
-
-    struct stat file_stat;
-    if (stat(dll_path, &file_stat) != 0) {
-        std::cerr << "[CANDY ERROR] Cannot access file for reload: " << dll_path
-                  << std::endl;
-        std::cerr << "              errno: " << strerror(errno) << std::endl;
-        return;
+    void *state = candy_arena_resize_state(ctx, new_size);
+    if (!state) {
+        free(old_copy);
+        dlclose(next->dll_handle);
+        return false;
     }
 
-    ctx->game_module.dll_handle = dlopen(dll_path, RTLD_NOW | RTLD_LOCAL);
-
-    if (ctx->game_module.dll_handle == nullptr) {
-        const char *error = dlerror();
-        std::cerr << "[CANDY ERROR] Failed to reload game module: " << dll_path
-                  << std::endl;
-        std::cerr << "              dlopen error: " << (error ? error : "unknown")
-                  << std::endl;
-        return;
+    if (migrate && !in_place) {
+        char hashes[64];
+        snprintf(hashes, sizeof(hashes), "%08x -> %08x", candy_layout_hash(old_layout),
+                 candy_layout_hash(new_layout));
+        std::cout << "[CANDY RELOAD] State layout " << hashes << std::endl;
+
+        memset(state, 0, new_size);
+        candy_migrate_stats stats;
+        candy_migrate_state(old_layout, old_copy, new_layout, state, &stats);
+        std::cout << "[CANDY RELOAD] " << stats.copied << " copied, " << stats.converted
+                  << " converted, " << stats.defaulted << " defaulted, " << stats.dropped
+                  << " dropped" << std::endl;
     }
 
-    dlerror();
-
-    ctx->game_module.api.init = (void (*)(candy_context *, void *))dlsym(
-        ctx->game_module.dll_handle, "game_init");
-    ctx->game_module.api.update = (void (*)(candy_context *, void *, uint32_t))dlsym(
-        ctx->game_module.dll_handle, "game_update");
-    ctx->game_module.api.render = (void (*)(candy_context *, void *))dlsym(
-        ctx->game_module.dll_handle, "game_render");
-    ctx->game_module.api.cleanup = (void (*)(candy_context *, void *))dlsym(
-        ctx->game_module.dll_handle, "game_cleanup");
-    ctx->game_module.api.on_reload =
-        (void (*)(void *, void *))dlsym(ctx->game_module.dll_handle, "game_on_reload");
-
-    size_t *state_size_ptr =
-        (size_t *)dlsym(ctx->game_module.dll_handle, "game_state_size");
-    if (state_size_ptr) {
-        ctx->game_module.api.state_size = *state_size_ptr;
+    bool accepted = true;
+    if (next->api.on_reload) {
+        accepted = next->api.on_reload(old_copy ? old_copy : state, state);
+    } else if (!migrate) {
+        // Nothing carries the old state over, so the module starts over on zeroed
+        // memory, as on its first load
+        memset(state, 0, new_size);
+        next->api.init(ctx, state);
     }
 
-    const char *dlsym_error = dlerror();
-    if (dlsym_error != nullptr) {
-        std::cerr << "[CANDY ERROR] Failed to load dll symbols: " << dlsym_error
+    if (!accepted) {
+        std::cerr << "[CANDY ERROR] Game module v" << next->version
+                  << " rejected the running state, rolling back to v" << module->version
                   << std::endl;
-        return;
+        candy_arena_resize_state(ctx, old_size);
+        if (old_copy) {
+            memcpy(state, old_copy, old_size);
+        }
+        free(old_copy);
+        dlclose(next->dll_handle);
+        return false;
     }
+    free(old_copy);
 
-    void *new_state = malloc(ctx->game_module.api.state_size);
-    if (!new_state) {
-        std::cerr << "[CANDY ERROR] Failed to allocate new game state" << std::endl;
-        return;
-    }
+    void *old_handle = module->dll_handle;
 
-    if (ctx->game_module.api.on_reload && ctx->game_module.game_state) {
-        ctx->game_module.api.on_reload(ctx->game_module.game_state, new_state);
-    } else if (ctx->game_module.api.init) {
-        ctx->game_module.api.init(ctx, new_state);
-    }
+    module->dll_handle = next->dll_handle;
+    module->api = next->api;
+    module->version = next->version;
 
-    if (ctx->game_module.game_state) {
-        free(ctx->game_module.game_state);
+    // Nothing points into the old code any more, the old layout included
+    if (old_handle) {
+        int dl_result = dlclose(old_handle);
+        CANDY_ASSERT(dl_result == 0, "Failed to close dll handle");
     }
-    ctx->game_module.game_state = new_state;
-
-    return;
+    return true;
 }
 
 void candy_check_hot_reload(candy_context *ctx) {
@@ -207,31 +236,28 @@ void candy_check_hot_reload(candy_context *ctx) {
         return;
     }
 
-    struct stat file_stat;
-    const char *dll_path = "output/libgame.so";
-
-    if (stat(dll_path, &file_stat) != 0) {
-        // File doesn't exist or can't be accessed
+    candy_loaded_module next;
+    if (!candy_take_staged_module(ctx, &next)) {
         return;
     }
 
-    if (file_stat.st_mtime > ctx->game_module.last_write_time) {
-        std::cout << "[CANDY] Detected game module change, reloading..." << std::endl;
-        ctx->game_module.last_write_time = file_stat.st_mtime;
-
-        candy_reload_code(ctx);
+    CANDY_ZONE("Module Swap");
+    std::cout << "[CANDY] Swapping in game module v" << next.version << std::endl;
 
-        // Only increment if reload succeeded
-        if (ctx->game_module.dll_handle) {
-            ctx->game_module.reload_count++;
-            std::cout << "[CANDY] Hot reload complete (reload #"
-                      << ctx->game_module.reload_count << ")" << std::endl;
-        } else {
-            std::cerr << "[CANDY] Hot reload failed!" << std::endl;
+    // Waits out the simulation's current batch, it must not tick during the swap,
+    // and for every job, which may still run the old module's code
+    std::lock_guard<std::mutex> lock(ctx->sim.mutex);
+    candy_jobs_drain(ctx);
+    if (candy_swap_game_module(ctx, &next)) {
+        if (ctx->sim.running) {
+            candy_sim_reset_snapshots(ctx);
         }
+        ctx->game_module.reload_count++;
+        std::cout << "[CANDY] Hot reload complete (reload #"
+                  << ctx->game_module.reload_count << ")" << std::endl;
+    } else {
+        std::cerr << "[CANDY] Hot reload failed!" << std::endl;
     }
-
-    return;
 }
 
 void candy_cleanup_hot_reloading(candy_context *ctx) {
@@ -240,84 +266,162 @@ void candy_cleanup_hot_reloading(candy_context *ctx) {
         ctx->game_module.api.cleanup(ctx, ctx->game_module.game_state);
     }
 
-    if (ctx->game_module.game_state) {
-        free(ctx->game_module.game_state);
-    }
-
     if (ctx->game_module.dll_handle) {
         dlclose(ctx->game_module.dll_handle);
     }
 
+    // The state and every region the module reserved go with the arena
+    candy_destroy_arena(ctx);
+    ctx->game_module.game_state = nullptr;
+
     return;
 }
 
+// Loads a built module the way a reload does and runs it without Vulkan or a window:
+// init, a second of ticks, a publish, cleanup. Catches modules that do not load, for
+// a missing export or an engine function the executable does not provide, before
+// anyone plays.
+bool candy_check_module(candy_context *ctx, const char *path) {
+    candy_loaded_module loaded;
+    if (!candy_open_module(path, 0, &loaded)) {
+        return false;
+    }
+    candy_game_module *module = &ctx->game_module;
+    module->dll_handle = loaded.dll_handle;
+    module->api = loaded.api;
+    module->version = loaded.version;
+
+    candy_init_jobs(ctx);
+    candy_init_arena(ctx);
+    module->game_state = candy_arena_resize_state(ctx, loaded.api.state_size);
+    if (!module->game_state) {
+        candy_destroy_jobs(ctx);
+        dlclose(module->dll_handle);
+        return false;
+    }
+
+    uint32_t ticks = (uint32_t)ctx->config.tick_rate;
+    ctx->sim.tick_ns.store((uint64_t)(1e9 / ctx->config.tick_rate));
+    module->api.init(ctx, module->game_state);
+    for (uint32_t i = 0; i < ticks; ++i) {
+        module->api.update(ctx, module->game_state, 1.0f / ctx->config.tick_rate);
+    }
+    if (module->api.publish) {
+        void *snapshot = calloc(1, module->api.snapshot_size);
+        if (snapshot) {
+            module->api.publish(module->game_state, snapshot);
+        }
+        free(snapshot);
+    }
+
+    candy_jobs_drain(ctx);
+    candy_cleanup_hot_reloading(ctx);
+    candy_destroy_jobs(ctx);
+    std::cout << "[CANDY] " << path << ": " << loaded.api.state_size << " byte state, "
+              << loaded.api.snapshot_size << " byte snapshot, init and " << ticks
+              << " ticks ran" << std::endl;
+    return true;
+}
+
+// What the module of candy_test_reload_init found when its init ran
+static size_t candy_test_reload_size;
+static bool candy_test_reload_zeroed;
+
+static void candy_test_reload_module_init(candy_context *ctx, void *state) {
+    (void)ctx;
+    const uint8_t *bytes = (const uint8_t *)state;
+    candy_test_reload_zeroed = true;
+    for (size_t i = 0; i < candy_test_reload_size; ++i) {
+        candy_test_reload_zeroed &= bytes[i] == 0;
+    }
+    // Dirty again for the next reload
+    memset(state, 0xcd, candy_test_reload_size);
+}
+
+// Reloads a module with neither on_reload nor a layout over a dirty state, at the
+// same, a larger and a smaller size. Its init must find the state zeroed every time,
+// as on the first load.
+bool candy_test_reload_init(candy_context *ctx) {
+    const size_t sizes[] = {256, 4096, 64};
+    candy_game_module *module = &ctx->game_module;
+
+    candy_game_api api = {};
+    api.init = candy_test_reload_module_init;
+    api.state_size = sizes[0];
+
+    candy_init_arena(ctx);
+    module->dll_handle = nullptr;
+    module->api = api;
+    module->version = 0;
+    module->game_state = candy_arena_resize_state(ctx, sizes[0]);
+    if (!module->game_state) {
+        return false;
+    }
+    memset(module->game_state, 0xcd, sizes[0]);
+
+    bool passed = true;
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        api.state_size = sizes[i];
+        candy_loaded_module next = {
+            .dll_handle = nullptr,
+            .api = api,
+            .version = i + 1,
+        };
+        candy_test_reload_size = sizes[i];
+        candy_test_reload_zeroed = false;
+        bool swapped = candy_swap_game_module(ctx, &next);
+        if (!swapped || !candy_test_reload_zeroed) {
+            std::cerr << "[CANDY TEST] Reload to " << sizes[i] << " bytes "
+                      << (swapped ? "ran init on a dirty state" : "failed") << std::endl;
+            passed = false;
+        }
+    }
+
+    candy_destroy_arena(ctx);
+    module->game_state = nullptr;
+    std::cout << "[CANDY TEST] Reload without on_reload or layout: "
+              << (passed ? "passed" : "FAILED") << std::endl;
+    return passed;
+}
+
 void candy_init_game_module(candy_context *ctx) {
     if (!ctx->config.enable_hot_reloading) {
         std::cout << "[CANDY] Hot reloading disabled, skipping game module" << std::endl;
         return;
     }
-    const char *dll_path = "output/libgame.so";
+    const char *dll_path = GAME_MODULE_PATH;
     struct stat file_stat;
-    if (stat(dll_path, &file_stat) == 0) {
-        ctx->game_module.last_write_time = file_stat.st_mtime;
-    } else {
+    if (stat(dll_path, &file_stat) != 0) {
         std::cerr << "[CANDY ERROR] Cannot stat file: " << dll_path << std::endl;
         std::cerr << "              errno: " << strerror(errno) << std::endl;
-    }
-    ctx->game_module.dll_handle = dlopen(dll_path, RTLD_NOW);
-    if (ctx->game_module.dll_handle == nullptr) {
-        const char *error = dlerror();
-        std::cerr << "[CANDY ERROR] Failed to load game module: " << dll_path
-                  << std::endl;
-        std::cerr << "              dlopen error: " << (error ? error : "unknown")
-                  << std::endl;
         std::cerr << "              Current working directory: ";
         char cwd[1024];
         if (getcwd(cwd, sizeof(cwd)) != nullptr) {
             std::cerr << cwd << std::endl;
         }
     }
-    CANDY_ASSERT(ctx->game_module.dll_handle != nullptr, "Failed to load game module");
-    dlerror();
-
-    ctx->game_module.api.init = (void (*)(candy_context *, void *))dlsym(
-        ctx->game_module.dll_handle, "game_init");
-    ctx->game_module.api.update = (void (*)(candy_context *, void *, uint32_t))dlsym(
-        ctx->game_module.dll_handle, "game_update");
-    ctx->game_module.api.render = (void (*)(candy_context *, void *))dlsym(
-        ctx->game_module.dll_handle, "game_render");
-    ctx->game_module.api.cleanup = (void (*)(candy_context *, void *))dlsym(
-        ctx->game_module.dll_handle, "game_cleanup");
-    ctx->game_module.api.on_reload =
-        (void (*)(void *, void *))dlsym(ctx->game_module.dll_handle, "game_on_reload");
-
-    size_t *state_size_ptr =
-        (size_t *)dlsym(ctx->game_module.dll_handle, "game_state_size");
-    if (state_size_ptr) {
-        ctx->game_module.api.state_size = *state_size_ptr;
-    } else {
-        std::cerr << "[CANDY ERROR] Failed to load game_state_size symbol" << std::endl;
-        ctx->game_module.api.state_size = 0;
-    }
 
-    const char *dlsym_error = dlerror();
-    if (dlsym_error != nullptr) {
-        std::cerr << "[CANDY ERROR] Failed to load dll symbols: " << dlsym_error
-                  << std::endl;
-        return;
-    }
+    // Loaded through a copy like every reload, so the build can replace the module
+    candy_loaded_module loaded;
+    bool preloaded = candy_preload_module(0, &loaded);
+    CANDY_ASSERT(preloaded, "Failed to load game module");
+
+    ctx->game_module.dll_handle = loaded.dll_handle;
+    ctx->game_module.api = loaded.api;
+    ctx->game_module.version = loaded.version;
 
     std::cout << "[CANDY] Game state size: " << ctx->game_module.api.state_size
               << " bytes" << std::endl;
 
-    ctx->game_module.game_state = malloc(ctx->game_module.api.state_size);
+    candy_init_arena(ctx);
+    ctx->game_module.game_state = candy_arena_resize_state(ctx, loaded.api.state_size);
     CANDY_ASSERT(ctx->game_module.game_state != nullptr, "Failed to allocate game state");
 
-    if (ctx->game_module.api.init) {
-        ctx->game_module.api.init(ctx, ctx->game_module.game_state);
-    }
+    ctx->game_module.api.init(ctx, ctx->game_module.game_state);
     ctx->game_module.reload_count = 0;
     std::cout << "[CANDY] Game module loaded successfully" << std::endl;
+
+    candy_start_module_watcher(ctx);
 }
 
 // ============================================================================
@@ -351,9 +455,14 @@ candy_queue_family_indices candy_find_queue_families(VkPhysicalDevice device,
             indices.graphics_family = i;
         }
 
-        // Check for presentation support
+        // Check for presentation support. Without a surface (headless) nothing is
+        // presented, so the graphics family stands in for the present family.
         VkBool32 present_support = VK_FALSE;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+        } else {
+            present_support = (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        }
         if (present_support) {
             indices.present_family = i;
         }
@@ -440,6 +549,68 @@ void candy_create_command_buffers(candy_context *ctx) {
     return;
 }
 
+// Copies a finished offscreen image into its region of the readback buffer.
+// The render pass leaves the image in COLOR_ATTACHMENT_OPTIMAL and starts from
+// UNDEFINED next time, so no transition back is needed.
+void candy_record_offscreen_readback(candy_context *ctx, VkCommandBuffer cmd_buffer,
+                                     uint32_t image_index) {
+    VkImageMemoryBarrier to_transfer = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = ctx->swapchain.images[image_index],
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &to_transfer);
+
+    VkBufferImageCopy region = {
+        .bufferOffset = ctx->offscreen.readback_frame_size * image_index,
+        .bufferRowLength = 0, // tightly packed
+        .bufferImageHeight = 0,
+        .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = {ctx->swapchain.extent.width, ctx->swapchain.extent.height, 1},
+    };
+    vkCmdCopyImageToBuffer(cmd_buffer, ctx->swapchain.images[image_index],
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           ctx->offscreen.readback_buffer, 1, &region);
+
+    VkBufferMemoryBarrier to_host = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = ctx->offscreen.readback_buffer,
+        .offset = region.bufferOffset,
+        .size = ctx->offscreen.readback_frame_size,
+    };
+    vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &to_host, 0,
+                         nullptr);
+}
+
 void candy_record_command_buffer(candy_context *ctx, uint32_t image_index,
                                  uint32_t cmd_buf_indx) {
 
@@ -454,6 +625,39 @@ void candy_record_command_buffer(candy_context *ctx, uint32_t image_index,
         vkBeginCommandBuffer(ctx->frame_data.command_buffers[cmd_buf_indx], &begin_info);
     CANDY_ASSERT(result == VK_SUCCESS, "Failed to being record command buffer");
 
+    candy_gpu_profiler_begin_frame(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                                   cmd_buf_indx);
+
+    // Without any instances from the game, draw the mesh once at the origin
+    if (ctx->instances.count == 0) {
+        ctx->instances.mapped[cmd_buf_indx][0] = {.offset = {0.0f, 0.0f, 0.0f},
+                                                  .scale = 1.0f};
+        ctx->instances.count = 1;
+    }
+
+    if (!ctx->config.headless) {
+        candy_imgui_prepare(ctx);
+    }
+
+    // Workers record the scene slices and the ImGui pass while this thread records
+    // the uploads and the culling dispatch into the primary
+    candy_record_secondaries_begin(ctx, cmd_buf_indx, image_index);
+
+    candy_record_staging_uploads(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                                 cmd_buf_indx);
+
+    // Culling must run outside the render pass
+    if (ctx->culling.enabled) {
+        candy_gpu_scope_begin(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                              cmd_buf_indx, CANDY_GPU_SCOPE_CULLING);
+        candy_record_gpu_culling(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                                 cmd_buf_indx);
+        candy_gpu_scope_end(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                            cmd_buf_indx, CANDY_GPU_SCOPE_CULLING);
+    }
+
+    candy_record_secondaries_wait(ctx);
+
     VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
     VkRenderPassBeginInfo render_pass_info = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -466,43 +670,151 @@ void candy_record_command_buffer(candy_context *ctx, uint32_t image_index,
         .pClearValues = &clear_color,
     };
 
+    candy_gpu_scope_begin(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                          cmd_buf_indx, CANDY_GPU_SCOPE_SCENE);
     vkCmdBeginRenderPass(ctx->frame_data.command_buffers[cmd_buf_indx], &render_pass_info,
-                         VK_SUBPASS_CONTENTS_INLINE);
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    candy_execute_scene_secondaries(ctx, ctx->frame_data.command_buffers[cmd_buf_indx]);
+    vkCmdEndRenderPass(ctx->frame_data.command_buffers[cmd_buf_indx]);
+    candy_gpu_scope_end(ctx, ctx->frame_data.command_buffers[cmd_buf_indx], cmd_buf_indx,
+                        CANDY_GPU_SCOPE_SCENE);
 
-    vkCmdBindPipeline(ctx->frame_data.command_buffers[cmd_buf_indx],
-                      VK_PIPELINE_BIND_POINT_GRAPHICS, ctx->pipeline.graphics_pipeline);
+    if (ctx->config.headless) {
+        if (ctx->config.headless_readback) {
+            candy_record_offscreen_readback(
+                ctx, ctx->frame_data.command_buffers[cmd_buf_indx], image_index);
+        }
+    } else {
+        candy_gpu_scope_begin(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                              cmd_buf_indx, CANDY_GPU_SCOPE_IMGUI);
+        candy_imgui_render(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                           image_index, candy_imgui_secondary(ctx));
+        candy_gpu_scope_end(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                            cmd_buf_indx, CANDY_GPU_SCOPE_IMGUI);
+    }
 
-    VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = (float)ctx->swapchain.extent.width,
-        .height = (float)ctx->swapchain.extent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
-    vkCmdSetViewport(ctx->frame_data.command_buffers[cmd_buf_indx], 0, 1, &viewport);
+    candy_gpu_profiler_end_frame(ctx, ctx->frame_data.command_buffers[cmd_buf_indx],
+                                 cmd_buf_indx);
 
-    VkRect2D scissor = {
-        .offset = {0, 0},
-        .extent = ctx->swapchain.extent,
+    VkResult result_end_cmd_buf =
+        vkEndCommandBuffer(ctx->frame_data.command_buffers[cmd_buf_indx]);
+    CANDY_ASSERT(result_end_cmd_buf == VK_SUCCESS, "Failed to record command buffer");
+
+    return;
+}
+
+// ============================================================================
+// PIPELINE CACHE
+// ============================================================================
+
+uint64_t candy_time_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// A cache blob is only usable on the exact driver/device that wrote it. Drivers are
+// supposed to reject foreign blobs themselves, but not all of them do it gracefully.
+static bool candy_validate_pipeline_cache(const std::vector<char> &blob,
+                                          const VkPhysicalDeviceProperties &props) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (blob.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, blob.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props.vendorID && header.deviceID == props.deviceID &&
+           memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void candy_create_pipeline_cache(candy_context *ctx) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(ctx->core.physical_device, &props);
+
+    std::vector<char> blob;
+    std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        blob.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read(blob.data(), blob.size());
+        file.close();
+
+        if (!candy_validate_pipeline_cache(blob, props)) {
+            std::cout << "[CANDY] Pipeline cache does not match this device, ignoring"
+                      << std::endl;
+            blob.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .initialDataSize = blob.size(),
+        .pInitialData = blob.empty() ? nullptr : blob.data(),
     };
-    vkCmdSetScissor(ctx->frame_data.command_buffers[cmd_buf_indx], 0, 1, &scissor);
 
-    VkBuffer vertex_buffers[] = {ctx->core.vertex_buffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(ctx->frame_data.command_buffers[cmd_buf_indx], 0, 1,
-                           vertex_buffers, offsets);
+    VkResult result = vkCreatePipelineCache(ctx->core.logical_device, &cache_info,
+                                            nullptr, &ctx->pipeline.cache);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create pipeline cache");
 
-    vkCmdDraw(ctx->frame_data.command_buffers[cmd_buf_indx], 3, 1, 0, 0);
-    vkCmdEndRenderPass(ctx->frame_data.command_buffers[cmd_buf_indx]);
+    ctx->pipeline.cache_loaded_bytes = blob.size();
+    if (blob.empty()) {
+        std::cout << "[CANDY] Pipeline cache: cold start" << std::endl;
+    } else {
+        std::cout << "[CANDY] Pipeline cache: warm start, " << blob.size()
+                  << " bytes loaded" << std::endl;
+    }
+}
 
-    candy_imgui_render(ctx, ctx->frame_data.command_buffers[cmd_buf_indx], image_index);
+void candy_save_pipeline_cache(candy_context *ctx) {
+    size_t size = 0;
+    VkResult result = vkGetPipelineCacheData(ctx->core.logical_device,
+                                             ctx->pipeline.cache, &size, nullptr);
+    if (result != VK_SUCCESS || size == 0) {
+        return;
+    }
 
-    VkResult result_end_cmd_buf =
-        vkEndCommandBuffer(ctx->frame_data.command_buffers[cmd_buf_indx]);
-    CANDY_ASSERT(result_end_cmd_buf == VK_SUCCESS, "Failed to record command buffer");
+    std::vector<char> blob(size);
+    result = vkGetPipelineCacheData(ctx->core.logical_device, ctx->pipeline.cache, &size,
+                                    blob.data());
+    if (result != VK_SUCCESS) {
+        return;
+    }
 
-    return;
+    // Write to a temp file first so a crash mid-write never leaves a torn cache
+    std::string tmp_path = std::string(PIPELINE_CACHE_PATH) + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "[CANDY ERROR] Cannot write pipeline cache: " << tmp_path
+                  << std::endl;
+        return;
+    }
+    file.write(blob.data(), size);
+    file.close();
+
+    if (rename(tmp_path.c_str(), PIPELINE_CACHE_PATH) != 0) {
+        std::cerr << "[CANDY ERROR] Cannot replace pipeline cache: " << strerror(errno)
+                  << std::endl;
+        return;
+    }
+    std::cout << "[CANDY] Pipeline cache saved (" << size << " bytes)" << std::endl;
+}
+
+// Logs the time from candy_init to the first submitted frame once, so cold and warm
+// pipeline cache starts can be compared.
+static void candy_log_first_frame(candy_context *ctx) {
+    if (ctx->frame_data.first_frame_logged) {
+        return;
+    }
+    ctx->frame_data.first_frame_logged = true;
+
+    double ms = (double)(candy_time_ns() - ctx->frame_data.init_start_ns) / 1e6;
+    std::cout << "[CANDY] Time to first frame: " << ms << " ms ("
+              << (ctx->pipeline.cache_loaded_bytes ? "warm" : "cold")
+              << " pipeline cache)" << std::endl;
 }
 
 // ============================================================================
@@ -545,19 +857,46 @@ void candy_create_sync_objs(candy_context *ctx) {
     return;
 }
 
+// Waits until the current frame slot is free again. Called before the game updates
+// so it can write this frame's instance data straight into mapped memory.
+void candy_begin_frame(candy_context *ctx) {
+    {
+        CANDY_ZONE("Fence Wait");
+        vkWaitForFences(ctx->core.logical_device, 1,
+                        &ctx->frame_data.in_flight_fences[ctx->frame_data.current_frame],
+                        VK_TRUE,
+                        UINT32_MAX); // For DoD we need to make arra of fences and
+                                     // use that instead of 1 here
+    }
+    candy_pacer_frame_retired(ctx, ctx->frame_data.current_frame);
+    candy_staging_retire_frame(ctx, ctx->frame_data.current_frame);
+    candy_gpu_profiler_collect(ctx, ctx->frame_data.current_frame);
+    ctx->instances.count = 0;
+}
+
+candy_instance *candy_reserve_instances(candy_context *ctx, uint32_t count) {
+    if (ctx->instances.count + count > MAX_INSTANCES) {
+        return nullptr;
+    }
+
+    candy_instance *instances =
+        ctx->instances.mapped[ctx->frame_data.current_frame] + ctx->instances.count;
+    ctx->instances.count += count;
+    return instances;
+}
+
 void candy_draw_frame(candy_context *ctx) {
-    vkWaitForFences(ctx->core.logical_device, 1,
-                    &ctx->frame_data.in_flight_fences[ctx->frame_data.current_frame],
-                    VK_TRUE,
-                    UINT32_MAX); // For DoD we need to make arra of fences and
-                                 // use that instead of 1 here
     uint32_t image_index;
 
-    VkResult result_acq_img = vkAcquireNextImageKHR(
-        ctx->core.logical_device, ctx->swapchain.handle, UINT64_MAX,
-        ctx->frame_data.image_available_semaphores[ctx->frame_data.current_frame],
-        VK_NULL_HANDLE,
-        &image_index); // dont know if this is correct
+    VkResult result_acq_img;
+    {
+        CANDY_ZONE("Acquire");
+        result_acq_img = vkAcquireNextImageKHR(
+            ctx->core.logical_device, ctx->swapchain.handle, UINT64_MAX,
+            ctx->frame_data.image_available_semaphores[ctx->frame_data.current_frame],
+            VK_NULL_HANDLE,
+            &image_index); // dont know if this is correct
+    }
 
     if (result_acq_img == VK_ERROR_OUT_OF_DATE_KHR) {
         ctx->swapchain.has_framebuffer_resized = true;
@@ -580,7 +919,10 @@ void candy_draw_frame(candy_context *ctx) {
 
     vkResetCommandBuffer(ctx->frame_data.command_buffers[ctx->frame_data.current_frame],
                          0);
-    candy_record_command_buffer(ctx, image_index, ctx->frame_data.current_frame);
+    {
+        CANDY_ZONE("Record");
+        candy_record_command_buffer(ctx, image_index, ctx->frame_data.current_frame);
+    }
 
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -595,10 +937,15 @@ void candy_draw_frame(candy_context *ctx) {
         .pSignalSemaphores = signal_semaphores,
     };
 
-    VkResult result =
-        vkQueueSubmit(ctx->core.graphics_queue, 1, &submit_info,
-                      ctx->frame_data.in_flight_fences[ctx->frame_data.current_frame]);
+    VkFence fence = ctx->frame_data.in_flight_fences[ctx->frame_data.current_frame];
+    VkResult result;
+    {
+        CANDY_ZONE("Submit");
+        result = vkQueueSubmit(ctx->core.graphics_queue, 1, &submit_info, fence);
+    }
     CANDY_ASSERT(result == VK_SUCCESS, "Failed to submit draw command buffer");
+    candy_pacer_frame_submitted(ctx, ctx->frame_data.current_frame);
+    candy_log_first_frame(ctx);
 
     VkSwapchainKHR swapchains = {ctx->swapchain.handle};
 
@@ -613,7 +960,11 @@ void candy_draw_frame(candy_context *ctx) {
         .pResults = nullptr, // WARNING: we only have a single swapchain for now
     };
 
-    VkResult result_q_pres = vkQueuePresentKHR(ctx->core.present_queue, &present_info);
+    VkResult result_q_pres;
+    {
+        CANDY_ZONE("Present");
+        result_q_pres = vkQueuePresentKHR(ctx->core.present_queue, &present_info);
+    }
     if (result_q_pres == VK_ERROR_OUT_OF_DATE_KHR) {
         candy_recreate_swapchain(ctx);
         return;
@@ -633,8 +984,7 @@ void candy_draw_frame(candy_context *ctx) {
 
 uint32_t candy_find_memory_type(candy_context *ctx, uint32_t type_filter,
                                 VkMemoryPropertyFlags props) {
-    VkPhysicalDeviceMemoryProperties mem_props;
-    vkGetPhysicalDeviceMemoryProperties(ctx->core.physical_device, &mem_props);
+    const VkPhysicalDeviceMemoryProperties &mem_props = ctx->allocator.mem_props;
 
     for (uint32_t i = 0; i < mem_props.memoryTypeCount; ++i) {
         if (type_filter & (1 << i) &&
@@ -709,7 +1059,7 @@ void candy_create_render_pass(candy_context *ctx) {
     return;
 }
 
-static std::vector<char> candy_read_shader_file(const std::string &filename) {
+std::vector<char> candy_read_shader_file(const std::string &filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
     CANDY_ASSERT(file.is_open(), "Failed to open shader file");
@@ -743,53 +1093,88 @@ VkShaderModule candy_create_shader_module(const std::vector<char> &shader_code,
     return shader_module;
 }
 
-void candy_create_vertex_buffer(candy_context *ctx) {
-
+void candy_create_buffer(candy_context *ctx, VkDeviceSize size, VkBufferUsageFlags usage,
+                         VkMemoryPropertyFlags props, VkBuffer *buffer,
+                         candy_allocation *allocation) {
     VkBufferCreateInfo buffer_info = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
-        .size = sizeof(vertices[0]) * vertices.size(),
-        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .size = size,
+        .usage = usage,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 0,
         .pQueueFamilyIndices = nullptr,
     };
 
-    VkResult result = vkCreateBuffer(ctx->core.logical_device, &buffer_info, nullptr,
-                                     &ctx->core.vertex_buffer);
-    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create vertex buffer");
+    VkResult result =
+        vkCreateBuffer(ctx->core.logical_device, &buffer_info, nullptr, buffer);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to create buffer");
 
     VkMemoryRequirements mem_reqs;
-    vkGetBufferMemoryRequirements(ctx->core.logical_device, ctx->core.vertex_buffer,
-                                  &mem_reqs);
+    vkGetBufferMemoryRequirements(ctx->core.logical_device, *buffer, &mem_reqs);
 
-    VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .pNext = nullptr,
-        .allocationSize = mem_reqs.size,
-        .memoryTypeIndex = candy_find_memory_type(
-            ctx, mem_reqs.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-    };
+    *allocation = candy_alloc_memory(ctx, mem_reqs, props, false);
+
+    vkBindBufferMemory(ctx->core.logical_device, *buffer, allocation->memory,
+                       allocation->offset);
+}
 
-    VkResult result_alloc_mem = vkAllocateMemory(
-        ctx->core.logical_device, &alloc_info, nullptr, &ctx->core.vertex_buffer_memory);
+void candy_destroy_buffer(candy_context *ctx, VkBuffer buffer,
+                          candy_allocation *allocation) {
+    vkDestroyBuffer(ctx->core.logical_device, buffer, nullptr);
+    candy_free_memory(ctx, allocation);
+}
+
+// The mesh lives in DEVICE_LOCAL memory; its contents go through the staging ring and
+// are copied on the GPU at the start of the next recorded frame.
+void candy_create_vertex_buffer(candy_context *ctx) {
+    VkDeviceSize size = sizeof(vertices[0]) * vertices.size();
+
+    candy_create_buffer(
+        ctx, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &ctx->core.vertex_buffer,
+        &ctx->core.vertex_buffer_alloc);
+
+    candy_upload_buffer(ctx, ctx->core.vertex_buffer, 0, vertices.data(), size);
+
+    return;
+}
 
-    CANDY_ASSERT(result_alloc_mem == VK_SUCCESS, "Failed to allocate memory");
+void candy_create_index_buffer(candy_context *ctx) {
+    VkDeviceSize size = sizeof(indices[0]) * indices.size();
 
-    vkBindBufferMemory(ctx->core.logical_device, ctx->core.vertex_buffer,
-                       ctx->core.vertex_buffer_memory, 0);
+    candy_create_buffer(
+        ctx, size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &ctx->core.index_buffer,
+        &ctx->core.index_buffer_alloc);
 
-    void *data;
-    vkMapMemory(ctx->core.logical_device, ctx->core.vertex_buffer_memory, 0,
-                buffer_info.size, 0, &data);
-    memcpy(data, vertices.data(), buffer_info.size);
-    vkUnmapMemory(ctx->core.logical_device, ctx->core.vertex_buffer_memory);
+    candy_upload_buffer(ctx, ctx->core.index_buffer, 0, indices.data(), size);
 
     return;
 }
 
+// Instance data changes every frame, so it is written directly into host visible
+// memory instead of going through the staging ring.
+void candy_create_instance_buffers(candy_context *ctx) {
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        candy_create_buffer(ctx, sizeof(candy_instance) * MAX_INSTANCES,
+                            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                            &ctx->instances.buffers[i], &ctx->instances.allocs[i]);
+        ctx->instances.mapped[i] = (candy_instance *)ctx->instances.allocs[i].mapped;
+    }
+    ctx->instances.count = 0;
+}
+
+void candy_destroy_instance_buffers(candy_context *ctx) {
+    for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
+        candy_destroy_buffer(ctx, ctx->instances.buffers[i], &ctx->instances.allocs[i]);
+    }
+}
+
 void candy_create_graphics_pipeline(candy_context *candy) {
     std::vector<char> vert_shader_code =
         candy_read_shader_file("../src/shaders/simple_shader.vert.spv");
@@ -859,8 +1244,9 @@ void candy_create_graphics_pipeline(candy_context *candy) {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bindings_description,
+        .vertexBindingDescriptionCount =
+            static_cast<uint32_t>(bindings_description.size()),
+        .pVertexBindingDescriptions = bindings_description.data(),
         .vertexAttributeDescriptionCount =
             static_cast<uint32_t>(attribute_description.size()),
         .pVertexAttributeDescriptions = attribute_description.data(),
@@ -1001,7 +1387,7 @@ void candy_create_graphics_pipeline(candy_context *candy) {
     };
 
     VkResult result_pipelines = vkCreateGraphicsPipelines(
-        candy->core.logical_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr,
+        candy->core.logical_device, candy->pipeline.cache, 1, &pipeline_info, nullptr,
         &candy->pipeline.graphics_pipeline);
     CANDY_ASSERT(result_pipelines == VK_SUCCESS, "Failed to create pipeline layout");
 
@@ -1094,12 +1480,12 @@ void candy_choose_swap_surface_format(VkSurfaceFormatKHR *surface_fmt,
 }
 
 void candy_choose_swap_present_mode(VkPresentModeKHR *present_mode,
+                                    VkPresentModeKHR requested_mode,
                                     const VkPresentModeKHR *available_present_modes,
                                     uint32_t present_mode_count) {
     for (uint32_t i = 0; i < present_mode_count; ++i) {
-        if (available_present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-            *present_mode =
-                VK_PRESENT_MODE_MAILBOX_KHR; // Probably best, the triple buffer solution
+        if (available_present_modes[i] == requested_mode) {
+            *present_mode = requested_mode;
             return;
         }
     }
@@ -1138,9 +1524,26 @@ void candy_create_swapchain(candy_context *ctx) {
                                      swapchain_details.format_count);
 
     VkPresentModeKHR present_mode = {};
-    candy_choose_swap_present_mode(&present_mode, swapchain_details.present_modes,
+    candy_choose_swap_present_mode(&present_mode, ctx->pacer.requested_present_mode,
+                                   swapchain_details.present_modes,
                                    swapchain_details.present_mode_count);
 
+    for (uint32_t i = 0; i < swapchain_details.present_mode_count; ++i) {
+        int index = candy_present_mode_index(swapchain_details.present_modes[i]);
+        if (index >= 0) {
+            ctx->pacer.present_mode_available[index] = true;
+        }
+    }
+    if (present_mode != ctx->pacer.requested_present_mode) {
+        std::cout << "[CANDY] Present mode "
+                  << candy_present_mode_name(ctx->pacer.requested_present_mode)
+                  << " not supported, using " << candy_present_mode_name(present_mode)
+                  << std::endl;
+    }
+    // Unsupported requests fall back, so they must not keep triggering recreation
+    ctx->pacer.present_mode = present_mode;
+    ctx->pacer.requested_present_mode = present_mode;
+
     VkExtent2D extent = {};
     candy_choose_swap_extent(&extent, swapchain_details.capabilities,
                              (GLFWwindow *)ctx->core.window);
@@ -1219,6 +1622,155 @@ void candy_recreate_swapchain(candy_context *ctx) {
     candy_create_framebuffers(ctx);
 }
 
+// ============================================================================
+// HEADLESS
+// ============================================================================
+
+// Creates one offscreen color target per frame in flight. They take the place of the
+// swapchain images, so image_index == current_frame and no acquire/present semaphores
+// are needed; the in-flight fences alone protect the images and readback regions.
+void candy_create_offscreen_targets(candy_context *ctx) {
+    ctx->swapchain.handle = VK_NULL_HANDLE;
+    ctx->swapchain.image_format = VK_FORMAT_R8G8B8A8_UNORM;
+    ctx->swapchain.extent = {ctx->config.width, ctx->config.height};
+    ctx->swapchain.image_count = MAX_FRAME_IN_FLIGHT;
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if (ctx->config.headless_readback) {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
+    for (uint32_t i = 0; i < ctx->swapchain.image_count; ++i) {
+        VkImageCreateInfo image_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = ctx->swapchain.image_format,
+            .extent = {ctx->swapchain.extent.width, ctx->swapchain.extent.height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 0,
+            .pQueueFamilyIndices = nullptr,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+
+        VkResult result = vkCreateImage(ctx->core.logical_device, &image_info, nullptr,
+                                        &ctx->swapchain.images[i]);
+        CANDY_ASSERT(result == VK_SUCCESS, "Failed to create offscreen image");
+
+        VkMemoryRequirements mem_reqs;
+        vkGetImageMemoryRequirements(ctx->core.logical_device, ctx->swapchain.images[i],
+                                     &mem_reqs);
+
+        ctx->offscreen.image_allocs[i] =
+            candy_alloc_memory(ctx, mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+
+        vkBindImageMemory(ctx->core.logical_device, ctx->swapchain.images[i],
+                          ctx->offscreen.image_allocs[i].memory,
+                          ctx->offscreen.image_allocs[i].offset);
+    }
+
+    candy_create_image_views(ctx);
+
+    if (!ctx->config.headless_readback) {
+        return;
+    }
+
+    ctx->offscreen.readback_frame_size =
+        (VkDeviceSize)ctx->swapchain.extent.width * ctx->swapchain.extent.height * 4;
+
+    candy_create_buffer(
+        ctx, ctx->offscreen.readback_frame_size * MAX_FRAME_IN_FLIGHT,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &ctx->offscreen.readback_buffer, &ctx->offscreen.readback_alloc);
+    ctx->offscreen.readback_data = ctx->offscreen.readback_alloc.mapped;
+}
+
+void candy_destroy_offscreen_targets(candy_context *ctx) {
+    for (uint32_t i = 0; i < ctx->swapchain.image_count; ++i) {
+        vkDestroyFramebuffer(ctx->core.logical_device, ctx->swapchain.framebuffers[i],
+                             nullptr);
+        vkDestroyImageView(ctx->core.logical_device, ctx->swapchain.image_views[i],
+                           nullptr);
+        vkDestroyImage(ctx->core.logical_device, ctx->swapchain.images[i], nullptr);
+        candy_free_memory(ctx, &ctx->offscreen.image_allocs[i]);
+    }
+
+    if (ctx->offscreen.readback_buffer != VK_NULL_HANDLE) {
+        candy_destroy_buffer(ctx, ctx->offscreen.readback_buffer,
+                             &ctx->offscreen.readback_alloc);
+        ctx->offscreen.readback_data = nullptr;
+    }
+}
+
+// Same frame as candy_draw_frame minus acquire and present: record into the slot's
+// own offscreen image and submit. candy_begin_frame has already waited on its fence.
+void candy_draw_frame_headless(candy_context *ctx) {
+    uint32_t frame = ctx->frame_data.current_frame;
+
+    vkResetFences(ctx->core.logical_device, 1, &ctx->frame_data.in_flight_fences[frame]);
+
+    vkResetCommandBuffer(ctx->frame_data.command_buffers[frame], 0);
+    {
+        CANDY_ZONE("Record");
+        candy_record_command_buffer(ctx, frame, frame);
+    }
+
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = nullptr,
+        .pWaitDstStageMask = nullptr,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &ctx->frame_data.command_buffers[frame],
+        .signalSemaphoreCount = 0,
+        .pSignalSemaphores = nullptr,
+    };
+
+    VkResult result = vkQueueSubmit(ctx->core.graphics_queue, 1, &submit_info,
+                                    ctx->frame_data.in_flight_fences[frame]);
+    CANDY_ASSERT(result == VK_SUCCESS, "Failed to submit headless command buffer");
+    candy_pacer_frame_submitted(ctx, frame);
+    candy_log_first_frame(ctx);
+
+    ctx->frame_data.current_frame = (frame + 1) % MAX_FRAME_IN_FLIGHT;
+}
+
+// Writes the most recently submitted frame as a binary PPM. Call after the device is
+// idle so the readback region is complete.
+bool candy_write_offscreen_ppm(candy_context *ctx, const char *path) {
+    if (!ctx->config.headless_readback || ctx->offscreen.readback_data == nullptr) {
+        return false;
+    }
+
+    uint32_t last_frame =
+        (ctx->frame_data.current_frame + MAX_FRAME_IN_FLIGHT - 1) % MAX_FRAME_IN_FLIGHT;
+    const uint8_t *pixels = (const uint8_t *)ctx->offscreen.readback_data +
+                            ctx->offscreen.readback_frame_size * last_frame;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "[CANDY ERROR] Cannot open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    uint32_t width = ctx->swapchain.extent.width;
+    uint32_t height = ctx->swapchain.extent.height;
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for (uint32_t i = 0; i < width * height; ++i) {
+        file.write((const char *)&pixels[i * 4], 3); // drop alpha
+    }
+
+    return true;
+}
+
 // ============================================================================
 // DEVICE SELECTION
 // ============================================================================
@@ -1256,6 +1808,25 @@ bool candy_check_device_extension_support(VkPhysicalDevice device) {
     return true;
 }
 
+bool candy_has_device_extension(VkPhysicalDevice device, const char *name) {
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
+
+    if (extension_count > 256)
+        extension_count = 256;
+
+    VkExtensionProperties available_extensions[256];
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                         available_extensions);
+
+    for (uint32_t i = 0; i < extension_count; ++i) {
+        if (strcmp(name, available_extensions[i].extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void candy_find_physical_devices(VkInstance instance, VkSurfaceKHR surface,
                                  candy_device_list *devices) {
     devices->count = 0;
@@ -1285,6 +1856,11 @@ bool candy_is_device_suitable(VkPhysicalDevice device, uint32_t graphics_family,
     bool has_queue_families = (graphics_family != INVALID_QUEUE_FAMILY &&
                                present_family != INVALID_QUEUE_FAMILY);
 
+    // Headless: no swapchain, so only a graphics queue is required
+    if (surface == VK_NULL_HANDLE) {
+        return has_queue_families;
+    }
+
     // Check if device supports required extensions
     bool extensions_supported = candy_check_device_extension_support(device);
 
@@ -1351,8 +1927,7 @@ void candy_init_vulkan_instance(candy_core *vk_instance, const candy_config *con
 
     const char *extensions[32];
     uint32_t extension_count = 0;
-    candy_get_required_extensions(extensions, &extension_count,
-                                  config->enable_validation);
+    candy_get_required_extensions(extensions, &extension_count, config);
 
     VkDebugUtilsMessengerCreateInfoEXT debug_info = candy_make_debug_messenger_info();
 
@@ -1427,7 +2002,36 @@ void candy_init_logical_device(candy_context *ctx) {
         };
     }
 
+    // Optional features for GPU driven drawing
+    VkPhysicalDeviceFeatures supported_features;
+    vkGetPhysicalDeviceFeatures(ctx->core.physical_device, &supported_features);
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(ctx->core.physical_device, &device_props);
+
     VkPhysicalDeviceFeatures device_features = {};
+    device_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+    device_features.drawIndirectFirstInstance =
+        supported_features.drawIndirectFirstInstance;
+
+    ctx->core.has_multi_draw_indirect = supported_features.multiDrawIndirect;
+    ctx->core.has_draw_indirect_first_instance =
+        supported_features.drawIndirectFirstInstance;
+    ctx->core.max_draw_indirect_count =
+        supported_features.multiDrawIndirect ? device_props.limits.maxDrawIndirectCount
+                                             : 1;
+
+    const char *extensions[DEVICE_EXTENSION_COUNT + 1];
+    uint32_t extension_count = 0;
+    if (!ctx->config.headless) {
+        for (size_t i = 0; i < DEVICE_EXTENSION_COUNT; ++i) {
+            extensions[extension_count++] = DEVICE_EXTENSIONS[i];
+        }
+    }
+    ctx->core.has_draw_indirect_count = candy_has_device_extension(
+        ctx->core.physical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (ctx->core.has_draw_indirect_count) {
+        extensions[extension_count++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+    }
 
     VkDeviceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
@@ -1439,8 +2043,8 @@ void candy_init_logical_device(candy_context *ctx) {
             ctx->config.enable_validation ? (uint32_t)VALIDATION_LAYER_COUNT : 0u,
         .ppEnabledLayerNames =
             ctx->config.enable_validation ? VALIDATION_LAYERS : nullptr,
-        .enabledExtensionCount = DEVICE_EXTENSION_COUNT,
-        .ppEnabledExtensionNames = DEVICE_EXTENSIONS,
+        .enabledExtensionCount = extension_count,
+        .ppEnabledExtensionNames = extension_count ? extensions : nullptr,
         .pEnabledFeatures = &device_features,
     };
 
@@ -1459,7 +2063,98 @@ void candy_init_logical_device(candy_context *ctx) {
 // PUBLIC API
 // ============================================================================
 
-void candy_init(candy_context *ctx) {
+void candy_parse_args(candy_config *config, int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            config->headless = true;
+        } else if (strcmp(argv[i], "--readback") == 0) {
+            config->headless_readback = true;
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            config->target_fps = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            config->tick_rate = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--late-latch") == 0) {
+            config->late_latch = true;
+        } else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "fifo") == 0) {
+                config->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+            } else if (strcmp(mode, "immediate") == 0) {
+                config->present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            } else {
+                config->present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+            }
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            config->trace_frames = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            config->headless_frame_count = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--no-gpu-culling") == 0) {
+            config->enable_gpu_culling = false;
+        } else if (strcmp(argv[i], "--bench-integrate") == 0 && i + 1 < argc) {
+            config->bench_integrate_count = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--bench-snapshot") == 0) {
+            config->bench_snapshot = true;
+        } else if (strcmp(argv[i], "--net-loopback") == 0 && i + 1 < argc) {
+            config->net_loopback_clients = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--net-seconds") == 0 && i + 1 < argc) {
+            config->net_loopback_seconds = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--net-conditions") == 0 && i + 3 < argc) {
+            config->net_conditions.latency_ms = strtof(argv[++i], nullptr);
+            config->net_conditions.jitter_ms = strtof(argv[++i], nullptr);
+            config->net_conditions.loss = strtof(argv[++i], nullptr) / 100.0f;
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            config->connect =
+                candy_net_parse_address(argv[++i], &config->connect_address);
+            if (!config->connect) {
+                std::cerr << "[CANDY] Bad server address, expected ip:port: " << argv[i]
+                          << std::endl;
+            }
+        } else if (strcmp(argv[i], "--bench-predict") == 0) {
+            config->bench_predict = true;
+        } else if (strcmp(argv[i], "--check-module") == 0 && i + 1 < argc) {
+            config->check_module = argv[++i];
+        } else if (strcmp(argv[i], "--test") == 0 && i + 1 < argc) {
+            config->test = argv[++i];
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            config->bench_instance_count = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+            config->width = (uint32_t)strtoul(argv[++i], nullptr, 10);
+            config->height = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "[CANDY] Ignoring unknown argument: " << argv[i] << std::endl;
+        }
+    }
+}
+
+void candy_init_headless(candy_context *ctx) {
+    candy_init_vulkan_instance(&ctx->core, &ctx->config);
+    ctx->core.surface = VK_NULL_HANDLE;
+    candy_init_physical_device(&ctx->core);
+    candy_init_logical_device(ctx);
+    candy_init_allocator(ctx);
+    candy_create_pipeline_cache(ctx);
+    candy_create_offscreen_targets(ctx);
+    candy_create_render_pass(ctx);
+    candy_create_graphics_pipeline(ctx);
+    candy_create_framebuffers(ctx);
+    candy_create_command_pools(ctx);
+    candy_create_staging_ring(ctx, STAGING_RING_SIZE);
+    candy_create_vertex_buffer(ctx);
+    candy_create_index_buffer(ctx);
+    candy_create_instance_buffers(ctx);
+    candy_init_gpu_culling(ctx);
+    candy_create_command_buffers(ctx);
+    candy_init_recorder(ctx);
+    candy_init_gpu_profiler(ctx);
+    candy_create_sync_objs(ctx);
+
+    candy_init_game_module(ctx);
+
+    std::cout << "[CANDY] Headless init complete (" << ctx->swapchain.extent.width << "x"
+              << ctx->swapchain.extent.height << ")\n";
+}
+
+void candy_init(candy_context *ctx, int argc, char **argv) {
     ctx->config = {
         .width = 1920,
         .height = 1080,
@@ -1467,7 +2162,54 @@ void candy_init(candy_context *ctx) {
         .enable_hot_reloading = true,
         .app_name = "Candy Renderer",
         .window_title = "Candy Window",
+        .headless = false,
+        .headless_readback = false,
+        .headless_frame_count = 1000,
+        .enable_gpu_culling = true,
+        .bench_instance_count = 0,
+        .target_fps = 0.0f,
+        .late_latch = false,
+        .present_mode = VK_PRESENT_MODE_MAILBOX_KHR,
+        .trace_frames = 0,
+        .tick_rate = 60.0f,
+        .max_catchup_ticks = 8,
+        .bench_integrate_count = 0,
+        .bench_snapshot = false,
+        .net_loopback_clients = 0,
+        .net_loopback_seconds = 5.0f,
+        .net_conditions = {},
+        .connect = false,
+        .connect_address = {},
+        .bench_predict = false,
+        .check_module = nullptr,
+        .test = nullptr,
     };
+    candy_parse_args(&ctx->config, argc, argv);
+
+    // CPU only, nothing else is started
+    if (ctx->config.bench_integrate_count > 0 || ctx->config.bench_snapshot ||
+        ctx->config.bench_predict || ctx->config.net_loopback_clients > 0 ||
+        ctx->config.check_module || ctx->config.test) {
+        return;
+    }
+    ctx->frame_data.init_start_ns = candy_time_ns();
+
+    candy_profiler_init();
+    candy_profiler_capture(ctx->config.trace_frames);
+    candy_init_frame_pacer(ctx);
+    candy_init_jobs(ctx);
+
+    // Before the sim thread starts, which is the only one to touch it from then on
+    if (ctx->config.connect &&
+        candy_client_connect(&ctx->client, ctx->config.connect_address,
+                             ctx->config.tick_rate, candy_time_ns())) {
+        ctx->client.endpoint.conditions = ctx->config.net_conditions;
+    }
+
+    if (ctx->config.headless) {
+        candy_init_headless(ctx);
+        return;
+    }
 
     // Init GLFW
     glfwInit();
@@ -1486,6 +2228,8 @@ void candy_init(candy_context *ctx) {
     candy_init_surface(&ctx->core);
     candy_init_physical_device(&ctx->core);
     candy_init_logical_device(ctx);
+    candy_init_allocator(ctx);
+    candy_create_pipeline_cache(ctx);
     candy_create_swapchain(ctx);
     candy_init_imgui(ctx);
     candy_create_image_views(ctx);
@@ -1493,29 +2237,55 @@ void candy_init(candy_context *ctx) {
     candy_create_graphics_pipeline(ctx);
     candy_create_framebuffers(ctx);
     candy_create_command_pools(ctx);
+    candy_create_staging_ring(ctx, STAGING_RING_SIZE);
     candy_create_vertex_buffer(ctx);
+    candy_create_index_buffer(ctx);
+    candy_create_instance_buffers(ctx);
+    candy_init_gpu_culling(ctx);
     candy_create_command_buffers(ctx);
+    candy_init_recorder(ctx);
+    candy_init_gpu_profiler(ctx);
     candy_create_sync_objs(ctx);
 
     candy_init_game_module(ctx);
 
+    candy_alloc_dump_stats(ctx);
     std::cout << "[CANDY] Init complete\n";
 }
 
 void candy_cleanup(candy_context *ctx) {
     vkDeviceWaitIdle(ctx->core.logical_device);
 
-    candy_destroy_swapchain(ctx);
+    // The game goes first, its cleanup may still use the engine
+    candy_stop_sim_thread(ctx);
+    candy_client_close(&ctx->client);
+    candy_destroy_jobs(ctx);
+    candy_stop_module_watcher(ctx);
+    if (ctx->config.enable_hot_reloading) {
+        candy_cleanup_hot_reloading(ctx);
+    }
+
+    if (ctx->config.headless) {
+        candy_destroy_offscreen_targets(ctx);
+    } else {
+        candy_destroy_swapchain(ctx);
+    }
 
     candy_cleanup_imgui(ctx);
 
+    candy_save_pipeline_cache(ctx);
+    vkDestroyPipelineCache(ctx->core.logical_device, ctx->pipeline.cache, nullptr);
+
     vkDestroyPipeline(ctx->core.logical_device, ctx->pipeline.graphics_pipeline, nullptr);
     vkDestroyPipelineLayout(ctx->core.logical_device, ctx->pipeline.pipeline_layout,
                             nullptr);
     vkDestroyRenderPass(ctx->core.logical_device, ctx->pipeline.render_pass, nullptr);
 
-    vkDestroyBuffer(ctx->core.logical_device, ctx->core.vertex_buffer, nullptr);
-    vkFreeMemory(ctx->core.logical_device, ctx->core.vertex_buffer_memory, nullptr);
+    candy_destroy_gpu_culling(ctx);
+    candy_destroy_buffer(ctx, ctx->core.vertex_buffer, &ctx->core.vertex_buffer_alloc);
+    candy_destroy_buffer(ctx, ctx->core.index_buffer, &ctx->core.index_buffer_alloc);
+    candy_destroy_instance_buffers(ctx);
+    candy_destroy_staging_ring(ctx);
 
     for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
         vkDestroySemaphore(ctx->core.logical_device,
@@ -1526,51 +2296,190 @@ void candy_cleanup(candy_context *ctx) {
                        nullptr);
     }
 
+    candy_destroy_gpu_profiler(ctx);
+    candy_destroy_recorder(ctx);
     for (uint32_t i = 0; i < MAX_FRAME_IN_FLIGHT; ++i) {
         vkDestroyCommandPool(ctx->core.logical_device, ctx->frame_data.command_pools[i],
                              nullptr);
     }
 
+    candy_alloc_dump_stats(ctx);
+    candy_destroy_allocator(ctx);
+
     vkDestroyDevice(ctx->core.logical_device, nullptr);
 
     if (ctx->config.enable_validation) {
         candy_destroy_debug_messenger(ctx->core.instance, ctx->core.debug_messenger);
     }
-    vkDestroySurfaceKHR(ctx->core.instance, ctx->core.surface, nullptr);
+    if (ctx->core.surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(ctx->core.instance, ctx->core.surface, nullptr);
+    }
 
     vkDestroyInstance(ctx->core.instance, nullptr);
 
-    glfwDestroyWindow(ctx->core.window);
-    glfwTerminate();
+    if (ctx->core.window) {
+        glfwDestroyWindow(ctx->core.window);
+        glfwTerminate();
+    }
 
+    candy_profiler_shutdown();
     std::cout << "[CANDY] Cleanup complete\n";
 }
 
 void candy_loop(candy_context *ctx) {
 
-    double last_time = glfwGetTime();
+    bool trace_key_down = false;
+    candy_start_sim_thread(ctx);
 
     while (!glfwWindowShouldClose(ctx->core.window)) {
-        glfwPollEvents();
+        if (ctx->pacer.requested_present_mode != ctx->pacer.present_mode) {
+            candy_recreate_swapchain(ctx);
+        }
 
-        candy_check_hot_reload(ctx);
-        double curr_time = glfwGetTime();
-        double delta_time = (curr_time - last_time) * 1000.0;
-        last_time = curr_time;
+        candy_pacer_begin_frame(ctx);
+        {
+            CANDY_ZONE("Frame");
+            {
+                CANDY_ZONE("Poll Events");
+                glfwPollEvents();
+                candy_sample_input(ctx);
+            }
+            candy_pacer_input_sampled(ctx);
 
-        candy_imgui_new_frame(ctx);
+            // F9 captures a trace of the next TRACE_CAPTURE_FRAMES frames
+            bool key_down = glfwGetKey(ctx->core.window, GLFW_KEY_F9) == GLFW_PRESS;
+            if (key_down && !trace_key_down) {
+                candy_profiler_capture(TRACE_CAPTURE_FRAMES);
+            }
+            trace_key_down = key_down;
 
-        if (ctx->game_module.api.update) {
-            ctx->game_module.api.update(ctx, ctx->game_module.game_state, delta_time);
-        }
-        if (ctx->game_module.api.render) {
-            ctx->game_module.api.render(ctx, ctx->game_module.game_state);
+            {
+                CANDY_ZONE("Hot Reload Check");
+                candy_check_hot_reload(ctx);
+            }
+
+            candy_imgui_new_frame(ctx);
+            candy_begin_frame(ctx);
+
+            // The simulation ticks on its own thread, frames draw its latest snapshot
+            void *snapshot = candy_sim_acquire_snapshot(ctx);
+            if (ctx->game_module.api.render) {
+                CANDY_ZONE("Game Render");
+                ctx->game_module.api.render(ctx, snapshot, ctx->sim.alpha);
+            }
+
+            candy_draw_frame(ctx);
         }
+        candy_pacer_end_frame(ctx);
+        candy_profiler_frame_end();
+    }
+    candy_stop_sim_thread(ctx);
+    vkDeviceWaitIdle(ctx->core.logical_device);
+
+    return;
+}
 
-        candy_draw_frame(ctx);
+// Lays out --instances N small meshes on a grid spanning twice the screen in each
+// direction, so roughly a quarter of them survive frustum culling.
+struct candy_bench_fill {
+    candy_instance *instances;
+    uint32_t side;
+    float step;
+};
+
+static void candy_fill_bench_range(void *data, uint32_t begin, uint32_t end) {
+    const candy_bench_fill *fill = (const candy_bench_fill *)data;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        fill->instances[i] = {
+            .offset = {-2.0f + fill->step * (float)(i % fill->side),
+                       -2.0f + fill->step * (float)(i / fill->side), 0.0f},
+            .scale = fill->step * 0.5f,
+        };
+    }
+}
+
+static void candy_fill_bench_instances(candy_context *ctx) {
+    uint32_t count = std::min(ctx->config.bench_instance_count, MAX_INSTANCES);
+    if (count == 0) {
+        return;
     }
+
+    candy_instance *instances = candy_reserve_instances(ctx, count);
+    if (!instances) {
+        return;
+    }
+
+    uint32_t side = (uint32_t)std::ceil(std::sqrt((double)count));
+    candy_bench_fill fill = {
+        .instances = instances,
+        .side = side,
+        .step = 4.0f / (float)side,
+    };
+    candy_parallel_for(ctx, count, BENCH_FILL_GRAIN, candy_fill_bench_range, &fill);
+}
+
+// Runs a fixed number of frames with presentation taken out and reports the
+// throughput the pipeline sustains. Timing uses steady_clock since GLFW is never
+// initialised in headless mode.
+void candy_headless_loop(candy_context *ctx) {
+    using clock = std::chrono::steady_clock;
+
+    uint32_t frame_count = ctx->config.headless_frame_count;
+    clock::time_point start_time = clock::now();
+    candy_start_sim_thread(ctx);
+
+    for (uint32_t i = 0; i < frame_count; ++i) {
+        candy_pacer_begin_frame(ctx);
+        {
+            CANDY_ZONE("Frame");
+            {
+                CANDY_ZONE("Hot Reload Check");
+                candy_check_hot_reload(ctx);
+            }
+
+            candy_begin_frame(ctx);
+            candy_fill_bench_instances(ctx);
+
+            // The simulation ticks on its own thread, frames draw its latest snapshot
+            void *snapshot = candy_sim_acquire_snapshot(ctx);
+            if (ctx->game_module.api.render) {
+                CANDY_ZONE("Game Render");
+                ctx->game_module.api.render(ctx, snapshot, ctx->sim.alpha);
+            }
+
+            candy_draw_frame_headless(ctx);
+        }
+        candy_pacer_end_frame(ctx);
+        candy_profiler_frame_end();
+    }
+    candy_stop_sim_thread(ctx);
     vkDeviceWaitIdle(ctx->core.logical_device);
 
+    double seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+    std::cout << "[CANDY HEADLESS] " << ctx->config.bench_instance_count
+              << " bench instances, GPU culling "
+              << (ctx->culling.enabled ? "on" : "off") << std::endl;
+    std::cout << "[CANDY HEADLESS] " << frame_count << " frames in " << seconds * 1000.0
+              << " ms (" << (seconds > 0.0 ? frame_count / seconds : 0.0)
+              << " FPS, " << (frame_count ? seconds * 1000.0 / frame_count : 0.0)
+              << " ms/frame)" << std::endl;
+
+    for (uint32_t i = 0; i < CANDY_GPU_SCOPE_COUNT; ++i) {
+        uint32_t samples = ctx->gpu_profiler.total_samples[i];
+        if (samples > 0) {
+            std::cout << "[CANDY HEADLESS] GPU "
+                      << candy_gpu_scope_name((candy_gpu_scope)i) << ": "
+                      << ctx->gpu_profiler.total_ms[i] / samples << " ms avg"
+                      << std::endl;
+        }
+    }
+
+    if (candy_write_offscreen_ppm(ctx, "headless_frame.ppm")) {
+        std::cout << "[CANDY HEADLESS] Last frame written to headless_frame.ppm"
+                  << std::endl;
+    }
+
     return;
 }
 
@@ -1578,14 +2487,59 @@ void candy_loop(candy_context *ctx) {
 // MAIN
 // ============================================================================
 
-int main() {
+// Self tests for ctest, by the name given to --test. Each runs without a window or a
+// GPU and returns whether it passed.
+static bool candy_run_test(candy_context *ctx, const char *name) {
+    if (strcmp(name, "reload-init") == 0) {
+        return candy_test_reload_init(ctx);
+    }
+    if (strcmp(name, "jobs-overflow") == 0) {
+        return candy_test_jobs_overflow(ctx);
+    }
+    if (strcmp(name, "net-first-ack") == 0) {
+        return candy_net_test_first_ack();
+    }
+    std::cerr << "[CANDY TEST] Unknown test: " << name << std::endl;
+    return false;
+}
+
+int main(int argc, char **argv) {
     std::cout << "[CANDY] Starting...\n";
 
     candy_context candy_ctx = {};
 
-    candy_init(&candy_ctx);
+    candy_init(&candy_ctx, argc, argv);
 
-    candy_loop(&candy_ctx);
+    if (candy_ctx.config.bench_integrate_count > 0) {
+        candy_entity_bench_integrate(candy_ctx.config.bench_integrate_count);
+        return 0;
+    }
+    if (candy_ctx.config.bench_snapshot) {
+        candy_snapshot_bench();
+        return 0;
+    }
+    if (candy_ctx.config.bench_predict) {
+        candy_predict_bench();
+        return 0;
+    }
+    if (candy_ctx.config.check_module) {
+        return candy_check_module(&candy_ctx, candy_ctx.config.check_module) ? 0 : 1;
+    }
+    if (candy_ctx.config.test) {
+        return candy_run_test(&candy_ctx, candy_ctx.config.test) ? 0 : 1;
+    }
+    if (candy_ctx.config.net_loopback_clients > 0) {
+        candy_net_loopback_test(candy_ctx.config.net_loopback_clients,
+                                &candy_ctx.config.net_conditions,
+                                candy_ctx.config.net_loopback_seconds);
+        return 0;
+    }
+
+    if (candy_ctx.config.headless) {
+        candy_headless_loop(&candy_ctx);
+    } else {
+        candy_loop(&candy_ctx);
+    }
 
     candy_cleanup(&candy_ctx);
 
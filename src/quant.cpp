@@ -6,6 +6,8 @@ struct quant_state {};
 extern "C" {
 
 size_t game_state_size = sizeof(quant_state);
+// No fields yet, the engine has nothing to migrate
+extern const candy_state_layout game_state_layout = {sizeof(quant_state), 0, nullptr};
 
 void game_init(candy_context *ctx, void *state) {
 
@@ -16,12 +18,12 @@ void game_init(candy_context *ctx, void *state) {
     return;
 }
 
-void game_update(candy_context *ctx, void *state, uint32_t delta_time) {
+void game_update(candy_context *ctx, void *state, float dt) {
 
     return;
 }
 
-void game_render(candy_context *ctx, void *state) {
+void game_render(candy_context *ctx, void *state, float alpha) {
 
     quant_state *quant_vis = (quant_state *)state;
 
@@ -35,20 +37,6 @@ void game_render(candy_context *ctx, void *state) {
     return;
 }
 
-void game_on_reload(void *old_state, void *new_state) {
-
-    quant_state *quant_vis_old = (quant_state *)old_state;
-    quant_state *quant_vis_new = (quant_state *)new_state;
-
-    memcpy(quant_vis_new, quant_vis_old, sizeof(quant_state));
-
-    uint32_t quant_vis_version = 8;
-    std::cout << "Game version: " << quant_vis_version << std::endl;
-    std::cout.flush();
-
-    return;
-}
-
 void game_cleanup(candy_context *ctx, void *state) {
 
     (void)ctx;
@@ -0,0 +1,369 @@
+#include "candy_match.h"
+#include "candy_net.h"
+#include "candy_snapshot.h"
+#include "candy_tick.h"
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// The dedicated server: one match, its clients and nothing else. Built without
+// GLFW, Vulkan or ImGui from the core.h-free modules, so a host can run one per core.
+
+// ============================================================================
+// CONFIG
+// ============================================================================
+
+struct candy_server_config {
+    uint16_t port;
+    float tick_rate;
+    uint64_t spin_ns;
+    uint32_t cores[TICK_MAX_CORES];
+    uint32_t core_count; // 0 to let the scheduler place the thread
+    float report_seconds;
+    float seconds; // 0 to run until interrupted
+    candy_net_conditions conditions;
+};
+
+static bool candy_server_parse_args(candy_server_config *config, int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            config->port = (uint16_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            config->tick_rate = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--spin-us") == 0 && i + 1 < argc) {
+            config->spin_ns = strtoull(argv[++i], nullptr, 10) * 1000ull;
+        } else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+            config->core_count =
+                candy_tick_parse_cores(argv[++i], config->cores, TICK_MAX_CORES);
+            if (config->core_count == 0) {
+                std::cerr << "[CANDY SERVER] Bad core list: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (strcmp(argv[i], "--report-seconds") == 0 && i + 1 < argc) {
+            config->report_seconds = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            config->seconds = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--net-conditions") == 0 && i + 3 < argc) {
+            config->conditions.latency_ms = strtof(argv[++i], nullptr);
+            config->conditions.jitter_ms = strtof(argv[++i], nullptr);
+            config->conditions.loss = strtof(argv[++i], nullptr) / 100.0f;
+        } else {
+            std::cerr << "[CANDY SERVER] Ignoring unknown argument: " << argv[i]
+                      << std::endl;
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// SERVER
+// ============================================================================
+
+constexpr uint32_t SERVER_COMMAND_QUEUE = 64; // commands held per client, a ring
+constexpr uint32_t SERVER_MAX_BUFFERED = 6;   // more waiting and the oldest are dropped
+
+static_assert((SERVER_COMMAND_QUEUE & (SERVER_COMMAND_QUEUE - 1)) == 0,
+              "queue is a ring");
+static_assert(MATCH_INPUT_COMMANDS < SERVER_COMMAND_QUEUE, "a packet must fit");
+
+// Connection slot i plays player i. Its commands are queued by command tick and
+// applied one per tick, so a burst of packets after a stall is not applied at once.
+struct candy_server_client {
+    bool connected;
+    candy_net_address address;
+    uint32_t acked_tick; // newest snapshot it decoded, MATCH_NO_TICK if none
+
+    bool commands_started;
+    uint32_t next_command;   // command tick applied next
+    uint32_t newest_command; // newest command tick received
+    uint32_t input_tick;     // newest command applied, MATCH_NO_TICK if none
+    uint8_t buttons;         // last applied, repeated while starved
+    uint32_t queue_tick[SERVER_COMMAND_QUEUE]; // MATCH_NO_TICK while empty
+    uint8_t queue_buttons[SERVER_COMMAND_QUEUE];
+};
+
+struct candy_server {
+    candy_server_config config;
+    candy_tick_scheduler scheduler;
+    candy_net_endpoint endpoint;
+    candy_server_client clients[MATCH_MAX_PLAYERS];
+    candy_match match;
+    void *match_memory; // the match's columns
+    candy_snapshot_history history; // what was sent, for baselines
+};
+
+static volatile sig_atomic_t candy_server_quit = 0;
+
+static void candy_server_on_signal(int) {
+    candy_server_quit = 1;
+}
+
+// Keeps the commands not applied yet. The first packet starts the queue at its
+// newest command; every later one is placed by command tick, repeats and all.
+static void candy_server_queue_commands(candy_server_client *client,
+                                        const candy_match_input *input) {
+    if (input->count == 0) {
+        return;
+    }
+    uint32_t newest = input->first_tick + input->count - 1;
+    if (!client->commands_started) {
+        client->commands_started = true;
+        client->next_command = newest;
+        client->newest_command = newest;
+    }
+
+    for (uint32_t c = 0; c < input->count; ++c) {
+        uint32_t tick = input->first_tick + c;
+        if ((int32_t)(tick - client->next_command) < 0 ||
+            tick - client->next_command >= SERVER_COMMAND_QUEUE) {
+            continue; // applied already, or too far ahead to hold
+        }
+        client->queue_tick[tick % SERVER_COMMAND_QUEUE] = tick;
+        client->queue_buttons[tick % SERVER_COMMAND_QUEUE] = input->buttons[c];
+        if ((int32_t)(tick - client->newest_command) > 0) {
+            client->newest_command = tick;
+        }
+    }
+}
+
+// The buttons a client plays this tick. A command lost on the way is replaced by the
+// last buttons and counted as applied; with none waiting at all, the last buttons
+// are repeated without taking up a command, and the client's prediction gets
+// corrected either way. Too many waiting means the client runs ahead, so the oldest
+// are dropped to keep its commands from lagging ever further behind.
+static uint8_t candy_server_next_buttons(candy_server_client *client) {
+    if (!client->connected || !client->commands_started) {
+        return 0;
+    }
+
+    uint32_t waiting = client->newest_command - client->next_command + 1;
+    if ((int32_t)waiting > (int32_t)SERVER_MAX_BUFFERED) {
+        client->next_command = client->newest_command - SERVER_MAX_BUFFERED + 1;
+    }
+    if ((int32_t)(client->newest_command - client->next_command) < 0) {
+        return client->buttons; // starved
+    }
+
+    uint32_t slot = client->next_command % SERVER_COMMAND_QUEUE;
+    if (client->queue_tick[slot] == client->next_command) {
+        client->buttons = client->queue_buttons[slot];
+    }
+    client->input_tick = client->next_command++;
+    return client->buttons;
+}
+
+// Picks up joins, leaves and the newest input of every connection
+static void candy_server_read_clients(candy_server *server) {
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        candy_net_connection *connection = &server->endpoint.connections[i];
+        candy_server_client *client = &server->clients[i];
+
+        bool same_peer = client->address.ip == connection->address.ip &&
+                         client->address.port == connection->address.port;
+        if (connection->connected && (!client->connected || !same_peer)) {
+            std::cout << "[CANDY SERVER] Player " << i << " joined from port "
+                      << connection->address.port << std::endl;
+            *client = {
+                .connected = true,
+                .address = connection->address,
+                .acked_tick = MATCH_NO_TICK,
+                .commands_started = false,
+                .next_command = 0,
+                .newest_command = 0,
+                .input_tick = MATCH_NO_TICK,
+                .buttons = 0,
+                .queue_tick = {},
+                .queue_buttons = {},
+            };
+            for (uint32_t c = 0; c < SERVER_COMMAND_QUEUE; ++c) {
+                client->queue_tick[c] = MATCH_NO_TICK;
+            }
+        } else if (!connection->connected && client->connected) {
+            std::cout << "[CANDY SERVER] Player " << i << " left" << std::endl;
+            client->connected = false;
+            client->buttons = 0;
+        }
+        if (!client->connected) {
+            continue;
+        }
+
+        uint8_t data[MATCH_INPUT_MAX_SIZE];
+        candy_match_input input;
+        uint32_t size = candy_net_receive_snapshot(connection, data, sizeof(data));
+        if (candy_match_read_input(data, size, &input)) {
+            client->acked_tick = input.acked_tick;
+            candy_server_queue_commands(client, &input);
+        }
+    }
+}
+
+// Captures the tick once and encodes it for every client against what it last acked,
+// behind the ack for its prediction. A baseline the history no longer holds, or one
+// too old, is sent in full.
+static void candy_server_send_snapshots(candy_server *server, uint64_t now_ns) {
+    candy_match *match = &server->match;
+    candy_snapshot *snapshot =
+        candy_snapshot_history_store(&server->history, match->tick);
+    candy_snapshot_capture(&match->entities, match->kill_count, match->tick, snapshot);
+
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        const candy_server_client *client = &server->clients[i];
+        if (!client->connected) {
+            continue;
+        }
+
+        const candy_snapshot *baseline =
+            client->acked_tick != MATCH_NO_TICK
+                ? candy_snapshot_history_find(&server->history, client->acked_tick)
+                : nullptr;
+        // Its player's exact state after its newest applied command goes first
+        candy_match_ack ack = {
+            .player = (uint8_t)i,
+            .input_tick = client->input_tick,
+            .motion = {},
+        };
+        candy_match_get_motion(match, i, &ack.motion);
+        uint8_t data[NET_MAX_PACKET];
+        candy_match_write_ack(&ack, data);
+        uint32_t size = candy_snapshot_encode(snapshot, baseline, data + MATCH_ACK_SIZE,
+                                              sizeof(data) - MATCH_ACK_SIZE);
+        candy_net_set_snapshot(&server->endpoint.connections[i], data,
+                               MATCH_ACK_SIZE + size);
+    }
+    candy_net_send(&server->endpoint, now_ns);
+}
+
+static void candy_server_report(candy_server *server) {
+    candy_tick_report(&server->scheduler);
+
+    uint32_t clients = 0;
+    float sent_kbps = 0.0f;
+    float received_kbps = 0.0f;
+    for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+        const candy_net_connection *connection = &server->endpoint.connections[i];
+        if (server->clients[i].connected) {
+            clients++;
+            sent_kbps += connection->sent_kbps;
+            received_kbps += connection->received_kbps;
+        }
+    }
+    std::cout << "[CANDY SERVER] Tick " << server->match.tick << ", " << clients
+              << " clients, up " << sent_kbps << " kbps, down " << received_kbps
+              << " kbps" << std::endl;
+}
+
+// Every tick: network in, one fixed step of the match, snapshots out. Only the work
+// between candy_tick_begin and candy_tick_end counts as the tick's CPU time.
+static void candy_server_run(candy_server *server) {
+    const candy_server_config *config = &server->config;
+    float dt = (float)server->scheduler.tick_ns * 1e-9f;
+    uint64_t start_ns = candy_tick_now_ns();
+    uint64_t end_ns = start_ns + (uint64_t)(config->seconds * 1e9f);
+    uint64_t report_ns = (uint64_t)(config->report_seconds * 1e9f);
+
+    while (!candy_server_quit) {
+        candy_tick_begin(&server->scheduler);
+        uint64_t now = candy_tick_now_ns();
+
+        candy_net_receive(&server->endpoint, now);
+        candy_server_read_clients(server);
+
+        uint8_t buttons[MATCH_MAX_PLAYERS];
+        for (uint32_t i = 0; i < MATCH_MAX_PLAYERS; ++i) {
+            buttons[i] = candy_server_next_buttons(&server->clients[i]);
+        }
+        candy_match_tick(&server->match, buttons, dt);
+        candy_server_send_snapshots(server, now);
+
+        candy_tick_end(&server->scheduler);
+
+        if (report_ns > 0 && now - server->scheduler.report_start_ns >= report_ns) {
+            candy_server_report(server);
+        }
+        if (config->seconds > 0.0f && now >= end_ns) {
+            break;
+        }
+    }
+    candy_server_report(server);
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+int main(int argc, char **argv) {
+    candy_server_config config = {
+        .port = 27015,
+        .tick_rate = 60.0f,
+        .spin_ns = TICK_DEFAULT_SPIN_NS,
+        .cores = {},
+        .core_count = 0,
+        .report_seconds = 5.0f,
+        .seconds = 0.0f,
+        .conditions = {},
+    };
+    if (!candy_server_parse_args(&config, argc, argv)) {
+        return 1;
+    }
+    config.tick_rate = config.tick_rate > 0.0f ? config.tick_rate : 60.0f;
+
+    // Pinned before the state is allocated, so its pages are first touched, and
+    // placed, on these cores
+    if (config.core_count > 0 &&
+        !candy_tick_pin_thread(config.cores, config.core_count)) {
+        return 1;
+    }
+
+    candy_server *server =
+        (candy_server *)aligned_alloc(alignof(candy_server), sizeof(candy_server));
+    if (!server) {
+        std::cerr << "[CANDY SERVER] Failed to allocate the server" << std::endl;
+        return 1;
+    }
+    memset(server, 0, sizeof(candy_server));
+    server->config = config;
+
+    if (!candy_net_open(&server->endpoint, config.port, MATCH_MAX_PLAYERS, true,
+                        config.tick_rate)) {
+        free(server);
+        return 1;
+    }
+    server->endpoint.conditions = config.conditions;
+
+    signal(SIGINT, candy_server_on_signal);
+    signal(SIGTERM, candy_server_on_signal);
+
+    // Room for as many entities as a snapshot carries, like a client's match
+    server->match_memory = aligned_alloc(64, candy_match_bytes(SNAPSHOT_MAX_ENTITIES));
+    if (!server->match_memory) {
+        std::cerr << "[CANDY SERVER] Failed to allocate the match" << std::endl;
+        candy_net_close(&server->endpoint);
+        free(server);
+        return 1;
+    }
+    candy_match_init(&server->match, SNAPSHOT_MAX_ENTITIES, server->match_memory);
+    candy_tick_init(&server->scheduler, config.tick_rate, config.spin_ns);
+
+    std::cout << "[CANDY SERVER] Port " << server->endpoint.port << ", "
+              << config.tick_rate << " ticks/s, " << config.spin_ns / 1000
+              << " us spin, ";
+    if (config.core_count > 0) {
+        std::cout << "pinned to";
+        for (uint32_t i = 0; i < config.core_count; ++i) {
+            std::cout << " " << config.cores[i];
+        }
+    } else {
+        std::cout << "not pinned";
+    }
+    std::cout << std::endl;
+
+    candy_server_run(server);
+
+    candy_net_close(&server->endpoint);
+    free(server->match_memory);
+    free(server);
+    return 0;
+}
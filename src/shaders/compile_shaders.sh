@@ -1,2 +1,3 @@
 glslc simple_shader.vert -o simple_shader.vert.spv
 glslc simple_shader.frag -o simple_shader.frag.spv
+glslc cull.comp -o cull.comp.spv
@@ -3,11 +3,15 @@
 layout(location = 0) in vec2 in_position;
 layout(location = 1) in vec3 in_color;
 
+// Per instance (binding 1)
+layout(location = 2) in vec3 in_offset;
+layout(location = 3) in float in_scale;
+
 layout(location = 0) out vec3 fragColor;
 
 
 
 void main() {
-    gl_Position = vec4(in_position, 0.0, 1.0);
+    gl_Position = vec4(in_position * in_scale + in_offset.xy, 0.0, 1.0);
     fragColor = in_color; 
 }